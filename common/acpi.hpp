@@ -0,0 +1,147 @@
+#pragma once
+
+#include "common.hpp"
+
+// ACPI table layouts we read. Only the fields we use are named, everything else is padding.
+// See the ACPI specification, chapter 5.2.
+
+namespace acpi
+{
+#	pragma pack (push, 1)
+	// Root System Description Pointer. Found by scanning low memory for the signature.
+	struct rsdp
+	{
+		char	m_Signature[8];		// "RSD PTR "
+		u8		m_Checksum;			// Covers the first 20 bytes
+		char	m_OEMID[6];
+		u8		m_Revision;			// 0 for ACPI 1.0 (no XSDT), 2 and up otherwise
+		u32		m_RSDTAddress;
+
+		// Revision 2 and up
+		u32		m_Length;
+		u64		m_XSDTAddress;
+		u8		m_ExtendedChecksum;	// Covers m_Length bytes
+		u8		_reserved[3];
+	};
+
+	// Common header of every System Description Table.
+	struct sdt_header
+	{
+		char	m_Signature[4];
+		u32		m_Length;			// Including this header
+		u8		m_Revision;
+		u8		m_Checksum;			// Covers m_Length bytes
+		char	m_OEMID[6];
+		char	m_OEMTableID[8];
+		u32		m_OEMRevision;
+		u32		m_CreatorID;
+		u32		m_CreatorRevision;
+	};
+
+	// System Resource Affinity Table. The header is followed by a list of variable length affinity structures,
+	// each starting with srat_entry.
+	struct srat
+	{
+		sdt_header	m_Header;
+		u32			_reserved0;
+		u64			_reserved1;
+	};
+
+	struct srat_entry
+	{
+		u8		m_Type;
+		u8		m_Length;
+	};
+
+	enum srat_type
+	{
+		e_SRATLocalAPIC		= 0,
+		e_SRATMemory		= 1,
+		e_SRATx2APIC		= 2,
+	};
+
+	// Affinity structure flags
+	enum
+	{
+		e_SRATEnabled		= (1 << 0),
+		e_SRATHotPluggable	= (1 << 1),		// Memory only
+		e_SRATNonVolatile	= (1 << 2),		// Memory only
+	};
+
+	struct srat_local_apic
+	{
+		srat_entry	m_Entry;
+		u8			m_DomainLow;		// Bits 0-7 of the proximity domain
+		u8			m_APICID;
+		u32			m_Flags;
+		u8			m_SAPICEID;
+		u8			m_DomainHigh[3];	// Bits 8-31 of the proximity domain
+		u32			m_ClockDomain;
+
+		u32 getDomain () const
+		{
+			return u32(m_DomainLow) | (u32(m_DomainHigh[0]) << 8) | (u32(m_DomainHigh[1]) << 16) | (u32(m_DomainHigh[2]) << 24);
+		}
+	};
+
+	struct srat_memory
+	{
+		srat_entry	m_Entry;
+		u32			m_Domain;
+		u16			_reserved0;
+		u64			m_BaseAddress;
+		u64			m_Length;
+		u32			_reserved1;
+		u32			m_Flags;
+		u64			_reserved2;
+	};
+
+	struct srat_x2apic
+	{
+		srat_entry	m_Entry;
+		u16			_reserved0;
+		u32			m_Domain;
+		u32			m_x2APICID;
+		u32			m_Flags;
+		u32			m_ClockDomain;
+		u32			_reserved1;
+	};
+
+	// System Locality Information Table. The header is followed by an m_Localities x m_Localities matrix of relative
+	// distances, row major, indexed by proximity domain. 10 is local.
+	struct slit
+	{
+		sdt_header	m_Header;
+		u64			m_Localities;
+
+		u8 getDistance (u64 from, u64 to) const
+		{
+			return ((const u8 *)(this + 1))[from * m_Localities + to];
+		}
+	};
+#	pragma pack (pop)
+
+	// Distance SLIT reports for a domain to itself.
+	static const u8 sc_LocalDistance = 10;
+	// Distance assumed between two different domains if there is no SLIT.
+	static const u8 sc_RemoteDistance = 20;
+
+	// Sum of size bytes, which must be zero for a valid table.
+	static inline u8 checksum (const void *data, u64 size)
+	{
+		u8 sum = 0;
+		for (u64 i = 0; i < size; ++i)
+			sum += ((const u8 *)data)[i];
+		return sum;
+	}
+
+	static inline bool signatureIs (const char *sig, const char *expected, u32 length)
+	{
+		for (u32 i = 0; i < length; ++i)
+		{
+			if (sig[i] != expected[i])
+				return false;
+		}
+		return true;
+	}
+}
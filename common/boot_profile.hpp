@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.hpp"
+
+// Boot phase timings.
+// Filled in by the loader while it runs and handed to the kernel as-is, so the layout must stay plain data.
+// All values are TSC cycles. Phase start times are relative to m_BootTSC.
+
+namespace bootprofile
+{
+	enum phase
+	{
+		e_PhaseCPUInit = 0,
+		e_PhaseLIOInit,
+		e_PhaseMemoryMap,
+		e_PhaseNUMA,
+		e_PhaseFrameInit,
+		e_PhaseKernelExtents,
+		e_PhasePlaceKernel,
+		e_PhaseBuddyInit,
+		e_PhaseVideoWC,
+		e_PhaseKernelPaging,
+		e_PhaseTLBBench,
+		e_PhaseExtentDump,
+
+		e_PhaseCount
+	};
+
+	static const char * const s_PhaseNames[e_PhaseCount] = {
+		"cpu::init",
+		"lio::init",
+		"MemoryMap::Process",
+		"NUMA::Init",
+		"PhysicalMemory::Init",
+		"KernelImage::Allocate",
+		"KernelImage::Place",
+		"PhysicalMemory::InitBuddy",
+		"Video WC remap",
+		"KernelPaging::Build",
+		"TLBBench::Run",
+		"Extent dump",
+	};
+
+#	pragma pack (push, 1)
+	struct entry
+	{
+		u64		m_Start;
+		u64		m_Cycles;
+	};
+
+	struct table
+	{
+		u64		m_TSCHz;		// 0 if unknown
+		u64		m_BootTSC;		// TSC on entry to loader::entry
+		u64		m_TotalCycles;	// loader::entry to the end of the last phase
+		entry	m_Phases[e_PhaseCount];
+	};
+#	pragma pack (pop)
+}
@@ -2,24 +2,213 @@
 
 #include "common.hpp"
 
-static u64 getHash (const u8 *data, u64 size)
+// Section integrity hash, shared by kdfgen (host) and the loader, so both must produce identical results.
+// This is XXH64: four independent 64-bit lanes, 32 bytes per round, multiply/rotate only. It has no
+// dependence on CPU features, so there is nothing to dispatch and nothing that can differ between the two.
+
+namespace xxh
 {
-	u64 startHash = 0;
-	u8 *bytes = (u8 *)&startHash;
+	static const u64 sc_Prime1 = 0x9E3779B185EBCA87ULL;
+	static const u64 sc_Prime2 = 0xC2B2AE3D27D4EB4FULL;
+	static const u64 sc_Prime3 = 0x165667B19E3779F9ULL;
+	static const u64 sc_Prime4 = 0x85EBCA77C2B2AE63ULL;
+	static const u64 sc_Prime5 = 0x27D4EB2F165667C5ULL;
+
+	static inline u64 rotl (u64 v, u32 r) { return (v << r) | (v >> (64 - r)); }
 
-	startHash = 0;
+	static inline u64 read64 (const u8 *p) { return *(const u64 *)p; }
+	static inline u32 read32 (const u8 *p) { return *(const u32 *)p; }
 
-	for (u64 i = 0; i < size; ++i)
+	static inline u64 mixRound (u64 acc, u64 input)
 	{
-		u8 byte = data[i];
-		bytes[0] += byte;
+		acc += input * sc_Prime2;
+		acc = rotl(acc, 31);
+		return acc * sc_Prime1;
+	}
 
-		for (int ii = 0; ii < 6; ++ii)
+	static inline u64 mergeRound (u64 acc, u64 lane)
+	{
+		acc ^= mixRound(0, lane);
+		return acc * sc_Prime1 + sc_Prime4;
+	}
+
+	// Incremental state, so data can be hashed while it is being streamed somewhere else.
+	// Either feed whole 32-byte stripes through stripes () and hand the remainder to finish (), or feed arbitrary
+	// chunks through update ()/copyUpdate () and call digest () at the end.
+	struct state
+	{
+		u64 m_Lanes[4];
+		u64 m_Total;
+		u64 m_Seed;
+		u8	m_Buffer[32];	// Partial stripe carried between update ()/copyUpdate () calls
+		u64 m_BufferSize;
+
+		void init (u64 seed = 0)
 		{
-			bytes[ii + 1] += bytes[ii];
-			bytes[ii + 2] += bytes[ii];
+			m_Lanes[0] = seed + sc_Prime1 + sc_Prime2;
+			m_Lanes[1] = seed + sc_Prime2;
+			m_Lanes[2] = seed;
+			m_Lanes[3] = seed - sc_Prime1;
+			m_Total = 0;
+			m_Seed = seed;
+			m_BufferSize = 0;
 		}
-	}
 
-	return startHash;
-}
\ No newline at end of file
+		// Consumes size / 32 stripes from data. Returns the number of bytes consumed.
+		u64 stripes (const u8 *data, u64 size)
+		{
+			u64 l0 = m_Lanes[0];
+			u64 l1 = m_Lanes[1];
+			u64 l2 = m_Lanes[2];
+			u64 l3 = m_Lanes[3];
+
+			const u64 n = size & ~31ULL;
+			for (u64 i = 0; i < n; i += 32)
+			{
+				l0 = mixRound(l0, read64(data + i + 0));
+				l1 = mixRound(l1, read64(data + i + 8));
+				l2 = mixRound(l2, read64(data + i + 16));
+				l3 = mixRound(l3, read64(data + i + 24));
+			}
+
+			m_Lanes[0] = l0;
+			m_Lanes[1] = l1;
+			m_Lanes[2] = l2;
+			m_Lanes[3] = l3;
+			m_Total += n;
+			return n;
+		}
+
+		// Copies size / 32 stripes from src to dst, hashing them in the same pass. Returns the number of bytes consumed.
+		// Each stripe is loaded once, so the data only crosses the memory bus once for both jobs.
+		u64 copyStripes (u8 *dst, const u8 *src, u64 size)
+		{
+			u64 l0 = m_Lanes[0];
+			u64 l1 = m_Lanes[1];
+			u64 l2 = m_Lanes[2];
+			u64 l3 = m_Lanes[3];
+
+			const u64 n = size & ~31ULL;
+			for (u64 i = 0; i < n; i += 32)
+			{
+				const u64 a = read64(src + i + 0);
+				const u64 b = read64(src + i + 8);
+				const u64 c = read64(src + i + 16);
+				const u64 d = read64(src + i + 24);
+				*(u64 *)(dst + i + 0) = a;
+				*(u64 *)(dst + i + 8) = b;
+				*(u64 *)(dst + i + 16) = c;
+				*(u64 *)(dst + i + 24) = d;
+				l0 = mixRound(l0, a);
+				l1 = mixRound(l1, b);
+				l2 = mixRound(l2, c);
+				l3 = mixRound(l3, d);
+			}
+
+			m_Lanes[0] = l0;
+			m_Lanes[1] = l1;
+			m_Lanes[2] = l2;
+			m_Lanes[3] = l3;
+			m_Total += n;
+			return n;
+		}
+
+		// Copies size bytes from src to dst and adds them to the hash. Chunks may be any size; a partial stripe is
+		// carried over to the next call. dst is optional, pass nullptr to only hash (see update ()).
+		void copyUpdate (u8 *dst, const u8 *src, u64 size)
+		{
+			// Complete a stripe left over from the last call first.
+			if (m_BufferSize != 0)
+			{
+				while (m_BufferSize < 32 && size != 0)
+				{
+					if (dst)
+						*dst++ = *src;
+					m_Buffer[m_BufferSize++] = *src++;
+					--size;
+				}
+				if (m_BufferSize < 32)
+					return;
+				stripes(m_Buffer, 32);
+				m_BufferSize = 0;
+			}
+
+			const u64 n = dst ? copyStripes(dst, src, size) : stripes(src, size);
+
+			for (u64 i = n; i < size; ++i)
+			{
+				if (dst)
+					dst[i] = src[i];
+				m_Buffer[m_BufferSize++] = src[i];
+			}
+		}
+
+		// Adds size bytes to the hash. Chunks may be any size.
+		void update (const u8 *data, u64 size)
+		{
+			copyUpdate(nullptr, data, size);
+		}
+
+		// Returns the digest of everything passed to update ()/copyUpdate ().
+		u64 digest () const
+		{
+			return finish(m_Buffer, m_BufferSize);
+		}
+
+		// Hashes the final (size < 32) bytes and returns the digest.
+		u64 finish (const u8 *tail, u64 size) const
+		{
+			const u64 total = m_Total + size;
+
+			u64 h;
+			if (total >= 32)
+			{
+				h = rotl(m_Lanes[0], 1) + rotl(m_Lanes[1], 7) + rotl(m_Lanes[2], 12) + rotl(m_Lanes[3], 18);
+				h = mergeRound(h, m_Lanes[0]);
+				h = mergeRound(h, m_Lanes[1]);
+				h = mergeRound(h, m_Lanes[2]);
+				h = mergeRound(h, m_Lanes[3]);
+			}
+			else
+			{
+				h = m_Seed + sc_Prime5;
+			}
+
+			h += total;
+
+			u64 i = 0;
+			for (; i + 8 <= size; i += 8)
+			{
+				h ^= mixRound(0, read64(tail + i));
+				h = rotl(h, 27) * sc_Prime1 + sc_Prime4;
+			}
+			if (i + 4 <= size)
+			{
+				h ^= u64(read32(tail + i)) * sc_Prime1;
+				h = rotl(h, 23) * sc_Prime2 + sc_Prime3;
+				i += 4;
+			}
+			for (; i < size; ++i)
+			{
+				h ^= u64(tail[i]) * sc_Prime5;
+				h = rotl(h, 11) * sc_Prime1;
+			}
+
+			h ^= h >> 33;
+			h *= sc_Prime2;
+			h ^= h >> 29;
+			h *= sc_Prime3;
+			h ^= h >> 32;
+
+			return h;
+		}
+	};
+}
+
+static u64 getHash (const u8 *data, u64 size)
+{
+	xxh::state st;
+	st.init();
+	const u64 consumed = st.stripes(data, size);
+	return st.finish(data + consumed, size - consumed);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "common.hpp"
+
+// NUMA topology, built by the loader from the ACPI SRAT/SLIT and handed to the kernel as-is, so the layout must
+// stay plain data.
+// Proximity domains are renumbered to dense node indices in the order the SRAT lists them. Without an SRAT there is a
+// single node 0 that owns everything.
+
+namespace numa
+{
+	static const u32 sc_MaxNodes = 8;
+	static const u32 sc_MaxRanges = 64;
+	static const u32 sc_MaxCPUs = 64;
+	// Node index for anything that is not in the topology.
+	static const u32 sc_NoNode = ~0U;
+
+#	pragma pack (push, 1)
+	// A range of physical memory that belongs to one node.
+	struct range
+	{
+		u64		m_Start;
+		u64		m_End;
+		u32		m_Node;
+	};
+
+	struct cpu
+	{
+		u32		m_APICID;
+		u32		m_Node;
+	};
+
+	struct topology
+	{
+		u32		m_NodeCount;
+		u32		m_Domains[sc_MaxNodes];							// Proximity domain of each node
+		u8		m_Distance[sc_MaxNodes][sc_MaxNodes];			// SLIT distance, 10 is local
+		u32		m_Fallback[sc_MaxNodes][sc_MaxNodes];			// Every node, nearest first, starting with itself
+
+		u32		m_RangeCount;
+		range	m_Ranges[sc_MaxRanges];							// Sorted by m_Start, not overlapping
+
+		u32		m_CPUCount;
+		cpu		m_CPUs[sc_MaxCPUs];
+	};
+#	pragma pack (pop)
+
+	// Node owning the given physical address, or sc_NoNode.
+	static inline u32 nodeOf (const topology &t, u64 phys)
+	{
+		u32 lo = 0;
+		u32 hi = t.m_RangeCount;
+		while (lo < hi)
+		{
+			const u32 mid = (lo + hi) / 2;
+			if (phys < t.m_Ranges[mid].m_Start)
+				hi = mid;
+			else if (phys >= t.m_Ranges[mid].m_End)
+				lo = mid + 1;
+			else
+				return t.m_Ranges[mid].m_Node;
+		}
+		return sc_NoNode;
+	}
+
+	// Node of the CPU with the given APIC ID. CPUs the SRAT doesn't list are put on node 0.
+	static inline u32 nodeOfAPIC (const topology &t, u32 apicID)
+	{
+		for (u32 i = 0; i < t.m_CPUCount; ++i)
+		{
+			if (t.m_CPUs[i].m_APICID == apicID)
+				return t.m_CPUs[i].m_Node;
+		}
+		return 0;
+	}
+}
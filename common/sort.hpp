@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace sort
+{
+	template <typename T, typename Less>
+	inline void siftDown (T *items, u64 root, u64 count, Less &less)
+	{
+		for (;;)
+		{
+			u64 child = root * 2 + 1;
+			if (child >= count)
+				return;
+			if (child + 1 < count && less(items[child], items[child + 1]))
+				++child;
+			if (!less(items[root], items[child]))
+				return;
+
+			T temp = items[root];
+			items[root] = items[child];
+			items[child] = temp;
+			root = child;
+		}
+	}
+
+	// In-place heap sort. O(n log n) worst case, with no recursion and no extra memory, which is what we want
+	// before there is a heap or a large stack.
+	// less(a, b) returns true if a orders before b. Not stable.
+	template <typename T, typename Less>
+	void heapSort (T *items, u64 count, Less less)
+	{
+		if (count < 2)
+			return;
+
+		for (u64 i = count / 2; i-- > 0;)
+		{
+			siftDown(items, i, count, less);
+		}
+
+		for (u64 end = count - 1; end > 0; --end)
+		{
+			T temp = items[0];
+			items[0] = items[end];
+			items[end] = temp;
+			siftDown(items, 0, end, less);
+		}
+	}
+}
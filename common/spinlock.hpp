@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <intrin.h>
+
+// Test-and-test-and-set spinlock.
+// Waiters spin on a plain read with pause, so the cache line is only written when the lock looks free.
+// Not reentrant, and it does not disable interrupts: don't take it from an interrupt handler if the interrupted
+// code might hold it.
+
+struct spinlock
+{
+	volatile long	m_Locked;
+
+	void init () { m_Locked = 0; }
+
+	void lock ()
+	{
+		while (_InterlockedExchange(&m_Locked, 1) != 0)
+		{
+			while (m_Locked != 0)
+				_mm_pause();
+		}
+	}
+
+	bool tryLock ()
+	{
+		return _InterlockedExchange(&m_Locked, 1) == 0;
+	}
+
+	void unlock ()
+	{
+		// Stores are not reordered with older stores on x86, so a compiler barrier is all the release needs.
+		_ReadWriteBarrier();
+		m_Locked = 0;
+	}
+};
+
+// Holds a spinlock for the enclosing scope.
+class scoped_lock
+{
+	spinlock	&m_Lock;
+
+	scoped_lock & operator = (const scoped_lock &);
+public:
+	scoped_lock (spinlock &l) : m_Lock(l) { m_Lock.lock(); }
+	~scoped_lock () { m_Lock.unlock(); }
+};
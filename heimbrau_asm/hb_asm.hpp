@@ -5,6 +5,10 @@
 #include <intrin.h>
 #include <cstdint>
 
+#include "hb_cpu.hpp"
+#include "hb_mem.hpp"
+#include "hb_tsc.hpp"
+
 extern "C"
 {
 	// Disable the 8259 Programmable Interrupt Controller (PIC)
@@ -15,6 +19,13 @@ extern "C"
 	// It must be the highest-tier page structure for the given architecture
 	// PML4 on x86-64
 	void asm_loadPT (const void *pPT);
+	// Invalidate TLB entries by PCID. type is the INVPCID type (rcx), pDesc the 16 byte descriptor (rdx)
+	void asm_invpcid (u64 type, const void *pDesc);
+	// Returns the current code segment selector
+	u16 asm_readCS ();
+	// Page fault entry for the IDT. Calls isr_pageFault (interrupt_frame *), which the kernel defines, with the
+	// extended state saved in isr_extendedStateSize bytes (0 for FXSAVE), which it also defines.
+	void asm_isrPageFault ();
 	// Enable the x87 FPU
 	// Not implemented on x86-64 as we use SSE and do not support x87.
 	void asm_enableFPU ();
@@ -24,88 +35,69 @@ namespace native
 {
 	template <typename L, typename R>
 	// 16-byte aligned memcpy
-	// TODO MMK : replace all memcpys with template overloaded versions
+	// Size is rounded down to a multiple of 16.
 	inline void memcpy_16 (L dst, const R src, u64 sz) {
-		for (u64 i = 0; i < sz >> 4; ++i)
-		{
-			((__m128i *)dst)[i] = ((__m128i *)src)[i];
-		}
+		mem::copy((void *)dst, (const void *)src, sz & ~15ULL);
 	}
 	template <typename L, typename R>
 	// 8-byte aligned memcpy
-	// TODO MMK : replace all memcpys with template overloaded versions
+	// Size is rounded down to a multiple of 8.
 	inline void memcpy_8 (L dst, const R src, u64 sz) {
-		for (u64 i = 0; i < sz >> 3; ++i)
-		{
-			((u64 *)dst)[i] = ((u64 *)src)[i];
-		}
+		mem::copy((void *)dst, (const void *)src, sz & ~7ULL);
 	}
 	template <typename L, typename R>
 	// 4-byte aligned memcpy
-	// TODO MMK : replace all memcpys with template overloaded versions
+	// Size is rounded down to a multiple of 4.
 	inline void memcpy_4 (L dst, const R src, u64 sz) {
-		for (u64 i = 0; i < sz >> 2; ++i)
-		{
-			((u32 *)dst)[i] = ((u32 *)src)[i];
-		}
+		mem::copy((void *)dst, (const void *)src, sz & ~3ULL);
 	}
 	template <typename L, typename R>
 	// Unaligned memcpy
-	// TODO MMK : replace all memcpys with template overloaded versions
+	// The regions must not overlap. Use memmove if they might.
 	inline void memcpy (L dst, const R src, u64 sz) {
-		for (u64 i = 0; i < sz; ++i)
-		{
-			((u8 *)dst)[i] = ((u8 *)src)[i];
-		}
+		mem::copy((void *)dst, (const void *)src, sz);
+	}
+	template <typename L, typename R>
+	// Unaligned memmove
+	// The regions may overlap.
+	inline void memmove (L dst, const R src, u64 sz) {
+		mem::move((void *)dst, (const void *)src, sz);
 	}
 	template <typename L>
 	// 16-byte aligned memset
-	// TODO MMK : replace all memsets with template overloaded versions
+	// Size is rounded down to a multiple of 16.
 	inline void memset_16 (L dst, __m128i val, u64 sz) {
-		for (u64 i = 0; i < (sz >> 4ULL); ++i)
-		{
-			((__m128i *)dst)[i] = val;
-		}
+		mem::fill((void *)dst, val, sz & ~15ULL);
 	}
 	template <typename L>
 	// 16-byte aligned memset
-	// TODO MMK : replace all memsets with template overloaded versions
+	// Each 16-byte block gets val in the low 8 bytes and zero in the high 8 bytes.
 	inline void memset_16 (L dst, u64 val, u64 sz) {
-		__m128i _val;
-		_val.m128i_u64[0] = val;
-		_val.m128i_u64[1] = 0;
-		for (u64 i = 0; i < (sz >> 4ULL); ++i)
-		{
-			((__m128i *)dst)[i] = _val;
-		}
+		mem::fill((void *)dst, _mm_set_epi64x(0, s64(val)), sz & ~15ULL);
 	}
 	template <typename L>
 	// 8-byte aligned memset
-	// TODO MMK : replace all memsets with template overloaded versions
+	// Size is rounded down to a multiple of 8.
 	inline void memset_8 (L dst, u64 val, u64 sz) {
-		for (u64 i = 0; i < (sz >> 3ULL); ++i)
-		{
-			((u64 *)dst)[i] = val;
-		}
+		mem::fill((void *)dst, _mm_set1_epi64x(s64(val)), sz & ~7ULL);
 	}
 	template <typename L>
 	// 4-byte aligned memset
-	// TODO MMK : replace all memsets with template overloaded versions
+	// Size is rounded down to a multiple of 4.
 	inline void memset_4 (L dst, u32 val, u64 sz) {
-		for (u64 i = 0; i < (sz >> 2ULL); ++i)
-		{
-			((u32 *)dst)[i] = val;
-		}
+		mem::fill((void *)dst, _mm_set1_epi32(s32(val)), sz & ~3ULL);
 	}
 	template <typename L>
 	// Unaligned memset
-	// TODO MMK : replace all memsets with template overloaded versions
 	inline void memset (L dst, u8 val, u64 sz) {
-		for (u64 i = 0; i < sz; ++i)
-		{
-			((u8 *)dst)[i] = val;
-		}
+		mem::fillBytes((void *)dst, val, sz);
 	}
+	// Executes CPUID for the given leaf and subleaf, storing EAX, EBX, ECX and EDX into regs.
+	inline void cpuid (u32 leaf, u32 subleaf, u32 regs[4]) { __cpuidex((int *)regs, int(leaf), int(subleaf)); }
+	// Returns the value of the given Extended Control Register (XCR). Requires CR4.OSXSAVE.
+	inline u64 xgetbv (u32 reg) { return _xgetbv(reg); }
+	// Write the value of the given Extended Control Register (XCR). Requires CR4.OSXSAVE.
+	inline void xsetbv (u32 reg, u64 v) { _xsetbv(reg, v); }
 	// Permanently halts the system until an interrupt.
 	__declspec(noreturn) inline void fullhalt () { for (;;) __halt(); }
 	// Executes x86 hlt instruction.
@@ -117,19 +109,63 @@ namespace native
 	inline void cli () { _disable(); }
 	// Start Interrupts - Starts interrupts for the current CPU/Core
 	inline void sti () { _enable(); }
+	// Returns RFLAGS, to put the interrupt flag back with writeFlags after a cli.
+	inline u64 readFlags () { return __readeflags(); }
+	// Sets RFLAGS.
+	inline void writeFlags (u64 flags) { __writeeflags(flags); }
 	// Permanently halts the system and disables interrupts.
 	__declspec(noreturn) inline void stop () { cli(); for (;;) __halt(); }
 	// Set the Interrupt Descriptor Table (IDT) at the given pointer.
 	inline void lidt (const void *ptr) { __lidt((void *)ptr); }
 	// Set the Global Descriptor Table (GDT) at the given pointer.
 	inline void lgdt (const void *ptr) { asm_lgdt(ptr); }
+	// Writes back and invalidates every cache line. Very slow; for memory type changes only.
+	inline void wbinvd () { __wbinvd(); }
 	// Invalidates a page in the Translation Lookaside Buffer (TLB)
 	inline void invlpg (void * const ptr) { __invlpg(ptr); }
 	// Set the current top-level page structure to the given pointer.
 	// On x86-64, this is the PML4 (Page Map Level 4)
 	inline void loadPT (const void *ptr) { asm_loadPT(ptr); }
+	// Set the current PML4 together with a Process-Context Identifier. Requires CR4.PCIDE.
+	// With keep set, translations already cached under pcid stay valid (CR3 bit 63), otherwise they are flushed.
+	inline void loadPT (u64 pml4, u32 pcid, bool keep) { asm_loadPT((const void *)(pml4 | (pcid & 0xFFF) | (keep ? (1ULL << 63) : 0))); }
+	// INVPCID types
+	enum
+	{
+		e_InvPCIDAddress		= 0,	// One address under one PCID
+		e_InvPCIDContext		= 1,	// Everything but global pages under one PCID
+		e_InvPCIDAllGlobal		= 2,	// Everything, global pages included, under all PCIDs
+		e_InvPCIDAll			= 3,	// Everything but global pages under all PCIDs
+	};
+	// Invalidates TLB entries by PCID. Requires INVPCID (cpu::get().m_INVPCID).
+	inline void invpcid (u64 type, u32 pcid, u64 address) {
+		_align(16) u64 desc[2] = { pcid & 0xFFF, address };
+		asm_invpcid(type, desc);
+	}
+	// Returns the current value of the Time Stamp Counter (TSC).
+	// Not serializing. Use native::tsc::start/stop to time a region.
+	inline u64 rdtsc () { return __rdtsc(); }
+	// Returns the current value of the Time Stamp Counter (TSC) once all earlier instructions have executed,
+	// and stores IA32_TSC_AUX (the CPU number, by convention) into aux.
+	inline u64 rdtscp (u32 &aux) { unsigned int a; const u64 t = __rdtscp(&a); aux = a; return t; }
+	// Read a byte from the given I/O port.
+	inline u8 inb (u16 port) { return __inbyte(port); }
+	// Write a byte to the given I/O port.
+	inline void outb (u16 port, u8 v) { __outbyte(port, v); }
 	// No Operation opcode
 	inline void nop () { __nop(); }
+	// Returns the index of the lowest set bit. val must not be zero.
+	inline u32 lowestBit (u64 val) { unsigned long idx; _BitScanForward64(&idx, val); return u32(idx); }
+	// Returns the index of the highest set bit. val must not be zero.
+	inline u32 highestBit (u64 val) { unsigned long idx; _BitScanReverse64(&idx, val); return u32(idx); }
+	// Returns the number of set bits.
+	// popcnt isn't guaranteed on x86-64 and we build with no enhanced instruction set, so this is done by hand.
+	inline u32 popcount (u64 val) {
+		val = val - ((val >> 1) & 0x5555555555555555ULL);
+		val = (val & 0x3333333333333333ULL) + ((val >> 2) & 0x3333333333333333ULL);
+		val = (val + (val >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+		return u32((val * 0x0101010101010101ULL) >> 56);
+	}
 	// Returns the value of the given Control Register (CR)
 	// TODO MMK : Implement the rest of the CRs (will have to use asm stubs)
 	inline u64 readCR (int reg)
@@ -171,6 +207,8 @@ namespace native
 	inline void writeDR (int reg, u64 v) { return __writedr(reg, v); }
 	// Write the value of the given Model-Specific Register (MSR)
 	inline void writeMSR (int reg, u64 v) { return __writemsr(reg, v); }
+	// Returns the current code segment selector.
+	inline u16 readCS () { return asm_readCS(); }
 	// Store (reads) the value of the IDT to the given pointer.
 	inline void sidt (void *ptr) { __sidt(ptr); }
 	// Enables the x87 FPU
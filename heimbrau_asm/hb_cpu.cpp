@@ -0,0 +1,159 @@
+#include "hb_asm.hpp"
+
+native::cpu::features native::cpu::s_Features;
+
+namespace
+{
+	inline bool bit (u32 reg, u32 b) { return (reg & (1U << b)) != 0; }
+
+	// What GS points at on each CPU. A line each, so no CPU's word shares a line with another's.
+	struct _align(64) cpu_word
+	{
+		u32	m_Index;
+	};
+
+	cpu_word s_Words[native::cpu::sc_MaxCPUs];
+}
+
+void native::cpu::init ()
+{
+	features &f = s_Features;
+	native::mem::fillBytes(&f, 0, sizeof(features));
+
+	u32 regs[4];
+
+	// Leaf 0 : Max leaf and vendor string (EBX, EDX, ECX order)
+	cpuid(0, 0, regs);
+	f.m_MaxLeaf = regs[0];
+	*(u32 *)(f.m_VendorString + 0) = regs[1];
+	*(u32 *)(f.m_VendorString + 4) = regs[3];
+	*(u32 *)(f.m_VendorString + 8) = regs[2];
+	f.m_VendorString[12] = '\0';
+
+	if (regs[1] == 0x756E6547 && regs[3] == 0x49656E69 && regs[2] == 0x6C65746E)		// GenuineIntel
+		f.m_Vendor = e_VendorIntel;
+	else if (regs[1] == 0x68747541 && regs[3] == 0x69746E65 && regs[2] == 0x444D4163)	// AuthenticAMD
+		f.m_Vendor = e_VendorAMD;
+	else
+		f.m_Vendor = e_VendorUnknown;
+
+	// Leaf 1 : Family/model/stepping and base feature flags
+	cpuid(1, 0, regs);
+	{
+		const u32 eax = regs[0];
+		u32 family = (eax >> 8) & 0xF;
+		u32 model = (eax >> 4) & 0xF;
+		if (family == 0xF)
+			family += (eax >> 20) & 0xFF;
+		if (family == 0x6 || family >= 0xF)
+			model += ((eax >> 16) & 0xF) << 4;
+		f.m_Family = family;
+		f.m_Model = model;
+		f.m_Stepping = eax & 0xF;
+		f.m_APICID = regs[1] >> 24;
+	}
+	const u32 leaf1ecx = regs[2];
+	const u32 leaf1edx = regs[3];
+	f.m_SSE3		= bit(leaf1ecx, 0);
+	f.m_SSSE3		= bit(leaf1ecx, 9);
+	f.m_PCID		= bit(leaf1ecx, 17);
+	f.m_SSE41		= bit(leaf1ecx, 19);
+	f.m_SSE42		= bit(leaf1ecx, 20);
+	f.m_x2APIC		= bit(leaf1ecx, 21);
+	f.m_POPCNT		= bit(leaf1ecx, 23);
+	f.m_TSCDeadline	= bit(leaf1ecx, 24);
+	f.m_XSAVE		= bit(leaf1ecx, 26);
+	f.m_PGE			= bit(leaf1edx, 13);
+	f.m_PAT			= bit(leaf1edx, 16);
+	const bool cpuAVX = bit(leaf1ecx, 28);
+
+	// Leaf 7 : Structured extended features
+	bool cpuAVX2 = false;
+	bool cpuAVX512F = false;
+	if (f.m_MaxLeaf >= 7)
+	{
+		cpuid(7, 0, regs);
+		f.m_BMI1	= bit(regs[1], 3);
+		f.m_BMI2	= bit(regs[1], 8);
+		f.m_ERMSB	= bit(regs[1], 9);
+		f.m_INVPCID	= bit(regs[1], 10);
+		f.m_LA57	= bit(regs[2], 16);
+		f.m_FSRM	= bit(regs[3], 4);
+		cpuAVX2		= bit(regs[1], 5);
+		cpuAVX512F	= bit(regs[1], 16);
+	}
+
+	// Extended leaves
+	cpuid(0x80000000, 0, regs);
+	f.m_MaxExtendedLeaf = regs[0];
+	if (f.m_MaxExtendedLeaf >= 0x80000001)
+	{
+		cpuid(0x80000001, 0, regs);
+		f.m_NX		= bit(regs[3], 20);
+		f.m_Page1GB	= bit(regs[3], 26);
+		f.m_RDTSCP	= bit(regs[3], 27);
+	}
+	if (f.m_MaxExtendedLeaf >= 0x80000007)
+	{
+		cpuid(0x80000007, 0, regs);
+		f.m_InvariantTSC = bit(regs[3], 8);
+	}
+	if (f.m_MaxExtendedLeaf >= 0x80000008)
+	{
+		cpuid(0x80000008, 0, regs);
+		f.m_PhysicalAddressBits = regs[0] & 0xFF;
+		f.m_LinearAddressBits = (regs[0] >> 8) & 0xFF;
+	}
+	else
+	{
+		// Architectural minimums for long mode.
+		f.m_PhysicalAddressBits = 36;
+		f.m_LinearAddressBits = 48;
+	}
+
+	// XSAVE / XCR0 setup. Without OSXSAVE, none of the AVX state exists as far as the CPU is concerned.
+	if (f.m_XSAVE && f.m_MaxLeaf >= 0xD)
+	{
+		cpuid(0xD, 0, regs);
+		f.m_XCR0Supported = u64(regs[0]) | (u64(regs[3]) << 32);
+		f.m_XSAVEMaxSize = regs[2];
+
+		u64 cr4 = readCR(4);
+		cr4 |= (1 << 18);	// OSXSAVE : Enable XSAVE/XRSTOR and XGETBV/XSETBV
+		writeCR(4, cr4);
+
+		u64 xcr0 = e_XCR0_x87 | e_XCR0_SSE;
+		if (cpuAVX && (f.m_XCR0Supported & e_XCR0_AVX))
+		{
+			xcr0 |= e_XCR0_AVX;
+			// AVX-512 state can only be enabled together with AVX state.
+			if (cpuAVX512F && (f.m_XCR0Supported & e_XCR0_AVX512) == e_XCR0_AVX512)
+				xcr0 |= e_XCR0_AVX512;
+		}
+		xsetbv(0, xcr0);
+
+		f.m_XCR0 = xgetbv(0);
+
+		// EBX reflects the currently enabled components, so it has to be read after XSETBV.
+		cpuid(0xD, 0, regs);
+		f.m_XSAVESize = regs[1];
+	}
+
+	f.m_AVX		= cpuAVX && (f.m_XCR0 & e_XCR0_AVX) != 0;
+	f.m_AVX2	= cpuAVX2 && f.m_AVX;
+	f.m_AVX512F	= cpuAVX512F && f.m_AVX && (f.m_XCR0 & e_XCR0_AVX512) == e_XCR0_AVX512;
+
+	setIndex(0);
+}
+
+void native::cpu::setIndex (u32 index)
+{
+	// Every per-CPU table would be indexed out of bounds, and 1 << index would wrap in every CPU mask.
+	if (index >= sc_MaxCPUs)
+		stop();
+
+	s_Words[index].m_Index = index;
+	__writemsr(0xC0000101, u64(&s_Words[index]));	// IA32_GS_BASE
+	if (s_Features.m_RDTSCP)
+		__writemsr(0xC0000103, index);	// IA32_TSC_AUX
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <intrin.h>
+
+// Cached CPU feature table.
+// native::cpu::init () probes CPUID once at boot, enables the extended register state in XCR0 that we
+// know how to use, and fills s_Features. Everything else should check the table instead of executing CPUID.
+
+namespace native
+{
+	namespace cpu
+	{
+		enum vendor
+		{
+			e_VendorUnknown = 0,
+			e_VendorIntel,
+			e_VendorAMD,
+		};
+
+		// XCR0 state components
+		enum
+		{
+			e_XCR0_x87			= (1 << 0),
+			e_XCR0_SSE			= (1 << 1),
+			e_XCR0_AVX			= (1 << 2),
+			e_XCR0_Opmask		= (1 << 5),
+			e_XCR0_ZMM_Hi256	= (1 << 6),
+			e_XCR0_Hi16_ZMM		= (1 << 7),
+			e_XCR0_AVX512		= e_XCR0_Opmask | e_XCR0_ZMM_Hi256 | e_XCR0_Hi16_ZMM,
+		};
+
+		struct features
+		{
+			char	m_VendorString[13];
+			vendor	m_Vendor;
+			u32		m_Family;
+			u32		m_Model;
+			u32		m_Stepping;
+			u32		m_APICID;		// Initial APIC ID of the CPU that ran init (), ie: the boot CPU
+
+			u32		m_MaxLeaf;
+			u32		m_MaxExtendedLeaf;
+
+			// Address widths from 0x80000008
+			u32		m_PhysicalAddressBits;
+			u32		m_LinearAddressBits;
+
+			// Instruction set extensions.
+			// The AVX family flags are only set if their register state is also enabled in XCR0, ie: they are usable.
+			bool	m_SSE3;
+			bool	m_SSSE3;
+			bool	m_SSE41;
+			bool	m_SSE42;
+			bool	m_POPCNT;
+			bool	m_XSAVE;
+			bool	m_AVX;
+			bool	m_AVX2;
+			bool	m_AVX512F;
+			bool	m_BMI1;
+			bool	m_BMI2;
+
+			// String operations
+			bool	m_ERMSB;	// Enhanced rep movsb/stosb
+			bool	m_FSRM;		// Fast short rep movsb
+
+			// Paging
+			bool	m_NX;
+			bool	m_PAT;
+			bool	m_PGE;		// Global pages
+			bool	m_Page1GB;
+			bool	m_PCID;
+			bool	m_INVPCID;
+			bool	m_LA57;
+
+			// APIC and timers
+			bool	m_x2APIC;
+			bool	m_TSCDeadline;
+			bool	m_InvariantTSC;
+			bool	m_RDTSCP;
+
+			// XSAVE information. Only valid if m_XSAVE is set.
+			u64		m_XCR0Supported;	// State components the CPU supports
+			u64		m_XCR0;				// State components we enabled
+			u32		m_XSAVESize;		// Size of the XSAVE area for m_XCR0
+			u32		m_XSAVEMaxSize;		// Size of the XSAVE area for m_XCR0Supported
+		};
+
+		extern features s_Features;
+
+		// Probes the CPU, sets CR4.OSXSAVE and XCR0 (x87/SSE/AVX/AVX-512 as available) and fills s_Features.
+		// SSE must already be enabled. Call once at boot, before anything that queries the table.
+		void init ();
+
+		// Returns the cached feature table.
+		inline const features & get () { return s_Features; }
+
+		// Most CPUs that can be numbered, and so the size of every per-CPU table.
+		static const u32 sc_MaxCPUs = 64;
+
+		// Numbers the current CPU for per-CPU data, from 0 to sc_MaxCPUs - 1, each CPU a different number. Stops the
+		// CPU for good (interrupts off) on a number past the per-CPU tables.
+		// The number is kept in a per-CPU word that GS points at, so GS is reserved for it, and is also put in
+		// IA32_TSC_AUX for rdtscp where that exists. init () numbers the boot CPU 0.
+		void setIndex (u32 index);
+
+		// Returns the number setIndex () gave the current CPU. A single load through GS.
+		inline u32 index () { return __readgsdword(0); }
+	}
+}
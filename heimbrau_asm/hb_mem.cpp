@@ -0,0 +1,298 @@
+#include "hb_asm.hpp"
+
+bool native::mem::s_UseERMSB = false;
+bool native::mem::s_UseAVX2 = false;
+
+native::mem::stream_stats native::mem::s_StreamStats = { 0, 0, 0 };
+
+void native::mem::init ()
+{
+	const cpu::features &f = cpu::get();
+
+	// m_AVX2 is only set when YMM state is enabled in XCR0, so it is safe to use as-is.
+	s_UseAVX2 = f.m_AVX2;
+	s_UseERMSB = f.m_ERMSB;
+}
+
+namespace
+{
+	// All of these are only called with sz > sc_InlineMax, so head and tail vectors never exceed the buffer.
+
+	void copySSE2 (u8 *d, const u8 *s, u64 sz)
+	{
+		u8 * const dend = d + sz;
+		const __m128i head = _mm_loadu_si128((const __m128i *)s);
+		const __m128i tail = _mm_loadu_si128((const __m128i *)(s + sz - 16));
+		_mm_storeu_si128((__m128i *)d, head);
+
+		// Bring the destination up to 16-byte alignment. The head store already covered the skipped bytes.
+		const u64 skew = 16 - (u64(d) & 15);
+		d += skew;
+		s += skew;
+
+		while (u64(dend - d) > 64)
+		{
+			const __m128i a = _mm_loadu_si128((const __m128i *)s + 0);
+			const __m128i b = _mm_loadu_si128((const __m128i *)s + 1);
+			const __m128i c = _mm_loadu_si128((const __m128i *)s + 2);
+			const __m128i e = _mm_loadu_si128((const __m128i *)s + 3);
+			_mm_store_si128((__m128i *)d + 0, a);
+			_mm_store_si128((__m128i *)d + 1, b);
+			_mm_store_si128((__m128i *)d + 2, c);
+			_mm_store_si128((__m128i *)d + 3, e);
+			d += 64;
+			s += 64;
+		}
+		while (u64(dend - d) > 16)
+		{
+			_mm_store_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+			d += 16;
+			s += 16;
+		}
+
+		_mm_storeu_si128((__m128i *)(dend - 16), tail);
+	}
+
+	void copyAVX2 (u8 *d, const u8 *s, u64 sz)
+	{
+		u8 * const dend = d + sz;
+		const __m256i head = _mm256_loadu_si256((const __m256i *)s);
+		const __m256i tail = _mm256_loadu_si256((const __m256i *)(s + sz - 32));
+		_mm256_storeu_si256((__m256i *)d, head);
+
+		const u64 skew = 32 - (u64(d) & 31);
+		d += skew;
+		s += skew;
+
+		while (u64(dend - d) > 128)
+		{
+			const __m256i a = _mm256_loadu_si256((const __m256i *)s + 0);
+			const __m256i b = _mm256_loadu_si256((const __m256i *)s + 1);
+			const __m256i c = _mm256_loadu_si256((const __m256i *)s + 2);
+			const __m256i e = _mm256_loadu_si256((const __m256i *)s + 3);
+			_mm256_store_si256((__m256i *)d + 0, a);
+			_mm256_store_si256((__m256i *)d + 1, b);
+			_mm256_store_si256((__m256i *)d + 2, c);
+			_mm256_store_si256((__m256i *)d + 3, e);
+			d += 128;
+			s += 128;
+		}
+		while (u64(dend - d) > 32)
+		{
+			_mm256_store_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+			d += 32;
+			s += 32;
+		}
+
+		_mm256_storeu_si256((__m256i *)(dend - 32), tail);
+
+		// Avoid the AVX->SSE transition penalty in whatever legacy-encoded code runs next.
+		_mm256_zeroupper();
+	}
+
+	void fillSSE2 (u8 *d, __m128i pattern, u64 sz)
+	{
+		u8 * const dend = d + sz;
+		_mm_storeu_si128((__m128i *)d, pattern);
+
+		// The pattern period divides the alignment of d, so skipping ahead to a 16-byte boundary keeps its phase.
+		d += 16 - (u64(d) & 15);
+
+		while (u64(dend - d) > 64)
+		{
+			_mm_store_si128((__m128i *)d + 0, pattern);
+			_mm_store_si128((__m128i *)d + 1, pattern);
+			_mm_store_si128((__m128i *)d + 2, pattern);
+			_mm_store_si128((__m128i *)d + 3, pattern);
+			d += 64;
+		}
+		while (u64(dend - d) > 16)
+		{
+			_mm_store_si128((__m128i *)d, pattern);
+			d += 16;
+		}
+
+		_mm_storeu_si128((__m128i *)(dend - 16), pattern);
+	}
+
+	void fillAVX2 (u8 *d, __m128i pattern, u64 sz)
+	{
+		u8 * const dend = d + sz;
+		const __m256i wide = _mm256_insertf128_si256(_mm256_castsi128_si256(pattern), pattern, 1);
+		_mm256_storeu_si256((__m256i *)d, wide);
+
+		d += 32 - (u64(d) & 31);
+
+		while (u64(dend - d) > 128)
+		{
+			_mm256_store_si256((__m256i *)d + 0, wide);
+			_mm256_store_si256((__m256i *)d + 1, wide);
+			_mm256_store_si256((__m256i *)d + 2, wide);
+			_mm256_store_si256((__m256i *)d + 3, wide);
+			d += 128;
+		}
+		while (u64(dend - d) > 32)
+		{
+			_mm256_store_si256((__m256i *)d, wide);
+			d += 32;
+		}
+
+		_mm256_storeu_si256((__m256i *)(dend - 32), wide);
+
+		_mm256_zeroupper();
+	}
+
+	// Streaming stores (movntdq/vmovntdq) require an aligned destination, so the unaligned head and the
+	// tail are done with normal stores and only the body bypasses the cache.
+	// sz is always >= sc_StreamThreshold here.
+
+	void streamSSE2 (u8 *d, __m128i pattern, u64 sz)
+	{
+		u8 * const dend = d + sz;
+		_mm_storeu_si128((__m128i *)d, pattern);
+		d += 16 - (u64(d) & 15);
+
+		while (u64(dend - d) > 64)
+		{
+			_mm_stream_si128((__m128i *)d + 0, pattern);
+			_mm_stream_si128((__m128i *)d + 1, pattern);
+			_mm_stream_si128((__m128i *)d + 2, pattern);
+			_mm_stream_si128((__m128i *)d + 3, pattern);
+			d += 64;
+		}
+		while (u64(dend - d) > 16)
+		{
+			_mm_stream_si128((__m128i *)d, pattern);
+			d += 16;
+		}
+
+		_mm_storeu_si128((__m128i *)(dend - 16), pattern);
+	}
+
+	void streamAVX2 (u8 *d, __m128i pattern, u64 sz)
+	{
+		u8 * const dend = d + sz;
+		const __m256i wide = _mm256_insertf128_si256(_mm256_castsi128_si256(pattern), pattern, 1);
+		_mm256_storeu_si256((__m256i *)d, wide);
+		d += 32 - (u64(d) & 31);
+
+		while (u64(dend - d) > 128)
+		{
+			_mm256_stream_si256((__m256i *)d + 0, wide);
+			_mm256_stream_si256((__m256i *)d + 1, wide);
+			_mm256_stream_si256((__m256i *)d + 2, wide);
+			_mm256_stream_si256((__m256i *)d + 3, wide);
+			d += 128;
+		}
+		while (u64(dend - d) > 32)
+		{
+			_mm256_stream_si256((__m256i *)d, wide);
+			d += 32;
+		}
+
+		_mm256_storeu_si256((__m256i *)(dend - 32), wide);
+
+		_mm256_zeroupper();
+	}
+}
+
+void native::mem::copyLarge (void *dst, const void *src, u64 sz)
+{
+	if (s_UseERMSB && sz >= sc_ERMSBThreshold)
+	{
+		__movsb((unsigned char *)dst, (const unsigned char *)src, sz);
+	}
+	else if (s_UseAVX2)
+	{
+		copyAVX2((u8 *)dst, (const u8 *)src, sz);
+	}
+	else
+	{
+		copySSE2((u8 *)dst, (const u8 *)src, sz);
+	}
+}
+
+void native::mem::fillLarge (void *dst, __m128i pattern, u64 sz)
+{
+	if (s_UseAVX2)
+	{
+		fillAVX2((u8 *)dst, pattern, sz);
+	}
+	else
+	{
+		fillSSE2((u8 *)dst, pattern, sz);
+	}
+}
+
+void native::mem::fillBytesLarge (void *dst, u8 val, u64 sz)
+{
+	if (s_UseERMSB && sz >= sc_ERMSBThreshold)
+	{
+		__stosb((unsigned char *)dst, val, sz);
+	}
+	else
+	{
+		fillLarge(dst, _mm_set1_epi8(char(val)), sz);
+	}
+}
+
+void native::mem::streamLarge (void *dst, __m128i pattern, u64 sz)
+{
+	const u64 start = rdtsc();
+
+	if (s_UseAVX2)
+	{
+		streamAVX2((u8 *)dst, pattern, sz);
+	}
+	else
+	{
+		streamSSE2((u8 *)dst, pattern, sz);
+	}
+
+	// Non-temporal stores are weakly ordered. Make them globally visible before anybody uses the memory.
+	_mm_sfence();
+
+	_InterlockedIncrement64(&s_StreamStats.m_Calls);
+	_InterlockedExchangeAdd64(&s_StreamStats.m_Bytes, s64(sz));
+	_InterlockedExchangeAdd64(&s_StreamStats.m_Cycles, s64(rdtsc() - start));
+}
+
+// The overlapping head/tail trick used by the copy loops is not safe when the regions overlap,
+// so moves use plain chunked loops. Each chunk is loaded before it is stored, which is enough as
+// long as we walk away from the overlap.
+
+void native::mem::moveForward (void *dst, const void *src, u64 sz)
+{
+	u8 *d = (u8 *)dst;
+	const u8 *s = (const u8 *)src;
+
+	while (sz >= 16)
+	{
+		_mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+		d += 16;
+		s += 16;
+		sz -= 16;
+	}
+	while (sz--)
+	{
+		*d++ = *s++;
+	}
+}
+
+void native::mem::moveBackward (void *dst, const void *src, u64 sz)
+{
+	u8 *d = (u8 *)dst + sz;
+	const u8 *s = (const u8 *)src + sz;
+
+	while (sz >= 16)
+	{
+		d -= 16;
+		s -= 16;
+		sz -= 16;
+		_mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+	}
+	while (sz--)
+	{
+		*--d = *--s;
+	}
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <intrin.h>
+
+// Copy/fill engine that sits behind the native::memcpy*/memset* templates in hb_asm.hpp.
+// Anything up to sc_InlineMax bytes is done inline with overlapping moves (all loads happen before
+// any store, so the small path is also safe for overlapping regions). Larger sizes go out of line
+// to whichever engine native::mem::init () selected from the CPU feature table.
+
+namespace native
+{
+	namespace mem
+	{
+		// Sizes at or below this never leave the inlined code.
+		static const u64 sc_InlineMax = 64;
+		// rep movsb/stosb have a fixed startup cost; below this the vector loops are faster even with ERMSB.
+		static const u64 sc_ERMSBThreshold = 2048;
+		// zeroPages/fillPages only bypass the cache at or above this. Anything smaller is likely to be used
+		// again soon, so it is filled with normal stores.
+		static const u64 sc_StreamThreshold = 4096;
+
+		// Selected engine. Defaults to the SSE2 loops, which every x86-64 CPU supports.
+		// Set by init (), do not touch directly.
+		extern bool s_UseERMSB;
+		extern bool s_UseAVX2;
+
+		// Selects the large copy/fill engine from native::cpu's feature table.
+		// native::cpu::init () must have been called first.
+		void init ();
+
+		// Out of line bodies. Do not call these with sizes <= sc_InlineMax.
+		void copyLarge (void *dst, const void *src, u64 sz);
+		// Fills sz bytes with a 16-byte pattern. The pattern period must divide both the alignment of dst and sz.
+		void fillLarge (void *dst, __m128i pattern, u64 sz);
+		void fillBytesLarge (void *dst, u8 val, u64 sz);
+		void moveForward (void *dst, const void *src, u64 sz);
+		void moveBackward (void *dst, const void *src, u64 sz);
+		void streamLarge (void *dst, __m128i pattern, u64 sz);
+
+		// Running totals for the non-temporal fill path, so the achieved bandwidth can be reported.
+		// Bytes/cycle is m_Bytes / m_Cycles. Updated atomically: any CPU can be streaming at once.
+		struct stream_stats
+		{
+			volatile s64	m_Calls;
+			volatile s64	m_Bytes;
+			volatile s64	m_Cycles;
+		};
+
+		extern stream_stats s_StreamStats;
+
+		// Copies sz bytes. No alignment requirements. Regions must not overlap (use move for that).
+		inline void copy (void *dst, const void *src, u64 sz)
+		{
+			u8 *d = (u8 *)dst;
+			const u8 *s = (const u8 *)src;
+
+			if (sz <= 16)
+			{
+				if (sz >= 8)
+				{
+					const u64 a = *(const u64 *)s;
+					const u64 b = *(const u64 *)(s + sz - 8);
+					*(u64 *)d = a;
+					*(u64 *)(d + sz - 8) = b;
+				}
+				else if (sz >= 4)
+				{
+					const u32 a = *(const u32 *)s;
+					const u32 b = *(const u32 *)(s + sz - 4);
+					*(u32 *)d = a;
+					*(u32 *)(d + sz - 4) = b;
+				}
+				else if (sz)
+				{
+					// 1, 2 or 3 bytes. Head, middle and tail cover all three cases.
+					const u8 a = s[0];
+					const u8 b = s[sz >> 1];
+					const u8 c = s[sz - 1];
+					d[0] = a;
+					d[sz >> 1] = b;
+					d[sz - 1] = c;
+				}
+			}
+			else if (sz <= sc_InlineMax)
+			{
+				// Up to four overlapping 16-byte moves, covering from both ends.
+				const __m128i a = _mm_loadu_si128((const __m128i *)s);
+				const __m128i b = _mm_loadu_si128((const __m128i *)(s + sz - 16));
+				if (sz > 32)
+				{
+					const __m128i c = _mm_loadu_si128((const __m128i *)(s + 16));
+					const __m128i e = _mm_loadu_si128((const __m128i *)(s + sz - 32));
+					_mm_storeu_si128((__m128i *)(d + 16), c);
+					_mm_storeu_si128((__m128i *)(d + sz - 32), e);
+				}
+				_mm_storeu_si128((__m128i *)d, a);
+				_mm_storeu_si128((__m128i *)(d + sz - 16), b);
+			}
+			else
+			{
+				copyLarge(dst, src, sz);
+			}
+		}
+
+		// Copies sz bytes. Regions may overlap.
+		inline void move (void *dst, const void *src, u64 sz)
+		{
+			if (sz <= sc_InlineMax)
+			{
+				copy(dst, src, sz);
+			}
+			else if (u64(dst) - u64(src) >= sz)
+			{
+				// dst is below src, or past its end. Either way a forward copy is safe.
+				moveForward(dst, src, sz);
+			}
+			else
+			{
+				moveBackward(dst, src, sz);
+			}
+		}
+
+		// Fills sz bytes with a repeating 16-byte pattern.
+		// The period of the pattern must divide both sz and the alignment of dst (ie: a u32 pattern needs 4-byte
+		// alignment and a multiple-of-4 size), otherwise the overlapping stores will shift its phase.
+		inline void fill (void *dst, __m128i pattern, u64 sz)
+		{
+			u8 *d = (u8 *)dst;
+
+			if (sz < 16)
+			{
+				if (sz >= 8)
+				{
+					const u64 p = u64(_mm_cvtsi128_si64(pattern));
+					*(u64 *)d = p;
+					*(u64 *)(d + sz - 8) = p;
+				}
+				else if (sz >= 4)
+				{
+					const u32 p = u32(_mm_cvtsi128_si32(pattern));
+					*(u32 *)d = p;
+					*(u32 *)(d + sz - 4) = p;
+				}
+				else if (sz)
+				{
+					const u8 p = u8(_mm_cvtsi128_si32(pattern));
+					d[0] = p;
+					d[sz >> 1] = p;
+					d[sz - 1] = p;
+				}
+			}
+			else if (sz <= sc_InlineMax)
+			{
+				if (sz > 32)
+				{
+					_mm_storeu_si128((__m128i *)(d + 16), pattern);
+					_mm_storeu_si128((__m128i *)(d + sz - 32), pattern);
+				}
+				_mm_storeu_si128((__m128i *)d, pattern);
+				_mm_storeu_si128((__m128i *)(d + sz - 16), pattern);
+			}
+			else
+			{
+				fillLarge(dst, pattern, sz);
+			}
+		}
+
+		// Fills sz bytes with val. No alignment requirements.
+		inline void fillBytes (void *dst, u8 val, u64 sz)
+		{
+			if (sz <= sc_InlineMax)
+			{
+				fill(dst, _mm_set1_epi8(char(val)), sz);
+			}
+			else
+			{
+				fillBytesLarge(dst, val, sz);
+			}
+		}
+	
+		// Fills sz bytes of freshly allocated memory (page frames, page tables, BSS) with a repeating 16-byte pattern,
+		// using non-temporal stores so the fill does not evict the working set. Sizes under sc_StreamThreshold use
+		// normal stores. Same pattern rules as fill. The stores are fenced before returning.
+		inline void fillPages (void *dst, __m128i pattern, u64 sz)
+		{
+			if (sz < sc_StreamThreshold)
+			{
+				fill(dst, pattern, sz);
+			}
+			else
+			{
+				streamLarge(dst, pattern, sz);
+			}
+		}
+
+		// Zeroes sz bytes of freshly allocated memory without pulling it into the cache. See fillPages.
+		inline void zeroPages (void *dst, u64 sz)
+		{
+			fillPages(dst, _mm_setzero_si128(), sz);
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#include "hb_asm.hpp"
+
+u64 native::tsc::s_Hz = 0;
+bool native::tsc::s_UseRDTSCP = false;
+
+namespace
+{
+	// PIT input clock, in Hz.
+	static const u64 sc_PITHz = 1193182;
+
+	// Counts TSC cycles across a ~10ms one-shot countdown on PIT channel 2.
+	// Channel 2 is gated through port 0x61, and its output can be read back from bit 5 of the same port,
+	// so this needs neither interrupts nor the speaker.
+	u64 calibrateWithPIT ()
+	{
+		static const u16 count = u16(sc_PITHz / 100);
+
+		// Gate high, speaker data off.
+		native::outb(0x61, u8((native::inb(0x61) & ~0x02) | 0x01));
+
+		// Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count), binary.
+		native::outb(0x43, 0xB0);
+		native::outb(0x42, u8(count & 0xFF));
+		native::outb(0x42, u8(count >> 8));
+
+		// Retrigger the gate so the count starts now.
+		const u8 gate = u8(native::inb(0x61) & ~0x01);
+		native::outb(0x61, gate);
+		native::outb(0x61, u8(gate | 0x01));
+
+		const u64 start = native::tsc::start();
+		while ((native::inb(0x61) & 0x20) == 0)
+		{
+			// Wait for OUT2 to go high.
+		}
+		const u64 end = native::tsc::stop();
+
+		return ((end - start) * sc_PITHz) / count;
+	}
+}
+
+void native::tsc::init ()
+{
+	const cpu::features &f = cpu::get();
+
+	s_UseRDTSCP = f.m_RDTSCP;
+
+	u64 hz = 0;
+	u32 regs[4];
+
+	// Leaf 0x15 : TSC/crystal ratio (EBX/EAX) and crystal frequency (ECX).
+	if (f.m_MaxLeaf >= 0x15)
+	{
+		cpuid(0x15, 0, regs);
+		if (regs[0] != 0 && regs[1] != 0 && regs[2] != 0)
+		{
+			hz = (u64(regs[2]) * regs[1]) / regs[0];
+		}
+	}
+
+	// Leaf 0x16 : Processor base frequency in MHz. On CPUs with an invariant TSC this is the TSC rate.
+	if (hz == 0 && f.m_MaxLeaf >= 0x16)
+	{
+		cpuid(0x16, 0, regs);
+		hz = u64(regs[0] & 0xFFFF) * 1000000;
+	}
+
+	// Neither is reported by most hypervisors or by older CPUs.
+	if (hz == 0)
+	{
+		hz = calibrateWithPIT();
+	}
+
+	s_Hz = hz;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <intrin.h>
+
+// Time Stamp Counter (TSC) helpers for cycle-accurate timing.
+// start ()/stop () are fenced so the measured region can't leak out of the timer through out-of-order execution.
+
+namespace native
+{
+	namespace tsc
+	{
+		// TSC frequency in Hz. 0 until init () has run, or if it could not be determined.
+		extern u64 s_Hz;
+		// Whether rdtscp can be used by stop (). Set by init ().
+		extern bool s_UseRDTSCP;
+
+		// Determines the TSC frequency, from CPUID leaf 0x15/0x16 if the CPU reports it, otherwise by calibrating
+		// against PIT channel 2. native::cpu::init () must have been called first.
+		void init ();
+
+		// Reads the TSC at the start of a measured region. Earlier instructions complete first.
+		inline u64 start ()
+		{
+			_mm_lfence();
+			const u64 t = __rdtsc();
+			_mm_lfence();
+			return t;
+		}
+
+		// Reads the TSC at the end of a measured region. The region's instructions complete first.
+		inline u64 stop ()
+		{
+			u64 t;
+			if (s_UseRDTSCP)
+			{
+				unsigned int aux;
+				t = __rdtscp(&aux);
+			}
+			else
+			{
+				_mm_lfence();
+				t = __rdtsc();
+			}
+			_mm_lfence();
+			return t;
+		}
+
+		// Converts a cycle count to microseconds. Returns 0 if the frequency is unknown.
+		inline u64 toMicroseconds (u64 cycles)
+		{
+			const u64 mhz = s_Hz / 1000000;
+			return mhz ? (cycles / mhz) : 0;
+		}
+
+		// Adds the cycles spent in its scope to the given counter.
+		class scoped_timer
+		{
+			u64	&m_Target;
+			u64	m_Start;
+
+			scoped_timer & operator = (const scoped_timer &);
+		public:
+			scoped_timer (u64 &target) : m_Target(target), m_Start(start()) {}
+			~scoped_timer () { m_Target += stop() - m_Start; }
+		};
+	}
+}
@@ -22,6 +22,92 @@ asm_loadPT:
 	mov cr3, rcx
 	ret
 
+; Invalidate TLB entries by PCID (type in rcx, descriptor pointer in rdx)
+global asm_invpcid;
+asm_invpcid:
+	invpcid rcx, [rdx]
+	ret
+
+; Current code segment selector, for interrupt gates
+global asm_readCS;
+asm_readCS:
+	xor eax, eax
+	mov ax, cs
+	ret
+
+; Page fault (#PF, vector 14) entry.
+; The CPU has pushed SS, RSP, RFLAGS, CS, RIP and the error code, leaving RSP 16 byte aligned. The fault can hit
+; any code, including a vector loop halfway through its registers, and the handler zeroes frames with the same
+; vector code (which ends with vzeroupper). So besides the general purpose registers the Microsoft x64 ABI lets
+; isr_pageFault clobber (rax, rcx, rdx, r8-r11), the whole extended state is saved around the call: XSAVE into
+; isr_extendedStateSize bytes on the stack, or FXSAVE when that is 0 (no XSAVE). isr_pageFault gets a pointer to the
+; error code, ie: the interrupt_frame.
+extern isr_pageFault;
+extern isr_extendedStateSize;
+global asm_isrPageFault;
+asm_isrPageFault:
+	push rbp
+	mov rbp, rsp				; [rbp + 8]: the error code
+	push rax
+	push rcx
+	push rdx
+	push r8
+	push r9
+	push r10
+	push r11
+	mov rax, [rel isr_extendedStateSize]
+	test rax, rax
+	jz .fxsave
+
+	sub rsp, rax
+	and rsp, -64
+	; XRSTOR faults unless the header past XSTATE_BV is zero, and XSAVE leaves it as it was.
+	xor ecx, ecx
+	mov [rsp + 512], rcx
+	mov [rsp + 520], rcx
+	mov [rsp + 528], rcx
+	mov [rsp + 536], rcx
+	mov [rsp + 544], rcx
+	mov [rsp + 552], rcx
+	mov [rsp + 560], rcx
+	mov [rsp + 568], rcx
+	mov eax, -1					; Every component enabled in XCR0
+	mov edx, -1
+	xsave64 [rsp]
+	sub rsp, 32					; Shadow space
+	cld
+	lea rcx, [rbp + 8]
+	call isr_pageFault
+	add rsp, 32
+	mov eax, -1
+	mov edx, -1
+	xrstor64 [rsp]
+	jmp .restore
+
+.fxsave:
+	sub rsp, 512
+	and rsp, -16
+	fxsave64 [rsp]
+	sub rsp, 32					; Shadow space
+	cld
+	lea rcx, [rbp + 8]
+	call isr_pageFault
+	add rsp, 32
+	fxrstor64 [rsp]
+
+.restore:
+	lea rsp, [rbp - 56]			; The 7 pushes after rbp
+	pop r11
+	pop r10
+	pop r9
+	pop r8
+	pop rdx
+	pop rcx
+	pop rax
+	pop rbp
+	add rsp, 8					; Error code
+	iretq
+
 ; Enable FPU - unimplemented in x86-64 as we use SSE
 global asm_enableFPU;
 asm_enableFPU:
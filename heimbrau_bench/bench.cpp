@@ -0,0 +1,504 @@
+#include "common.hpp"
+
+#include "heimbrau_asm/hb_asm.hpp"
+
+// MMK : For hashing
+#include "common/hash.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+/* Host Benchmark
+ *
+ * Measures the native:: memory primitives (memcpy_16/8/4, memcpy, memmove, memset_16/8/4, memset, zeroPages)
+ * and getHash on the build machine, next to glibc's memcpy/memset as a baseline. Every native row is run once per
+ * copy engine the host supports (sse2, avx2, ermsb), so a regression in any dispatch path shows up without booting.
+ *
+ * First a check, per engine: every native copy and fill against memmove/memset (or a byte by byte fill for the
+ * patterned ones), for every size up to 512 bytes and a spread of sizes past sc_StreamThreshold, at every
+ * destination and source offset mod 64 the primitive allows, and memmove with overlaps in both directions. The bytes
+ * around the destination are checked too, for stray stores. Then getHash against published XXH64 digests, and
+ * xxh::state fed the same data in random chunks against getHash. A mismatch exits with status 1 before anything is
+ * timed.
+ *
+ * Sweeps:
+ *	size		- 8 bytes to 4 MiB, including sizes that are not a multiple of the vector width.
+ *	alignment	- destination/source offsets from a 4 KiB boundary, filtered to what each primitive allows.
+ *	residency	- hot: the same buffers every call (cache resident).
+ *				  cold: every call uses the next slice of a 256 MiB arena, so data comes from DRAM.
+ *
+ * Output is CSV on stdout, one row per measurement:
+ *	op,impl,engine,size,dst_align,src_align,residency,calls,cycles_per_call,ns_per_call,bytes_per_cycle,gib_per_s
+ *
+ * Options:
+ *	--ms N			minimum measurement time per row, in milliseconds (default 5)
+ *	--filter STR	only run ops whose name contains STR
+*/
+
+namespace
+{
+	enum op_kind
+	{
+		e_Copy,
+		e_Move,		// Copy that may overlap
+		e_Set,
+		e_Hash,
+	};
+
+	typedef void (*op_func)(u8 *dst, const u8 *src, u64 sz);
+
+	struct op
+	{
+		const char	*name;
+		const char	*impl;		// native, glibc
+		op_kind		kind;
+		u64			align;		// Alignment the primitive requires of dst/src and size
+		op_func		func;
+		op_func		reference;	// What the check compares func against, nullptr for none
+	};
+
+	volatile u64 s_Sink = 0;
+
+	inline void clobber (void *p) { __asm__ volatile ("" : : "r"(p) : "memory"); }
+
+	void op_memcpy_16 (u8 *d, const u8 *s, u64 sz)	{ native::memcpy_16(d, s, sz); }
+	void op_memcpy_8 (u8 *d, const u8 *s, u64 sz)	{ native::memcpy_8(d, s, sz); }
+	void op_memcpy_4 (u8 *d, const u8 *s, u64 sz)	{ native::memcpy_4(d, s, sz); }
+	void op_memcpy (u8 *d, const u8 *s, u64 sz)		{ native::memcpy(d, s, sz); }
+	void op_memmove (u8 *d, const u8 *s, u64 sz)	{ native::memmove(d, s, sz); }
+	void op_glibc_memcpy (u8 *d, const u8 *s, u64 sz)	{ ::memcpy(d, s, sz); clobber(d); }
+	void op_glibc_memmove (u8 *d, const u8 *s, u64 sz)	{ ::memmove(d, s, sz); clobber(d); }
+
+	void op_memset_16 (u8 *d, const u8 *, u64 sz)	{ native::memset_16(d, 0x0123456789ABCDEFULL, sz); }
+	void op_memset_8 (u8 *d, const u8 *, u64 sz)	{ native::memset_8(d, 0x0123456789ABCDEFULL, sz); }
+	void op_memset_4 (u8 *d, const u8 *, u64 sz)	{ native::memset_4(d, 0x01234567U, sz); }
+	void op_memset (u8 *d, const u8 *, u64 sz)		{ native::memset(d, 0x5A, sz); }
+	void op_zeroPages (u8 *d, const u8 *, u64 sz)	{ native::mem::zeroPages(d, sz); }
+	void op_glibc_memset (u8 *d, const u8 *, u64 sz)	{ ::memset(d, 0x5A, sz); clobber(d); }
+
+	void op_getHash (u8 *, const u8 *s, u64 sz)		{ s_Sink += getHash(s, sz); }
+
+	// References for the check, one byte at a time where glibc has no equivalent.
+	void fillPattern (u8 *d, const u8 *pattern, u64 period, u64 sz)
+	{
+		for (u64 i = 0; i < sz; ++i)
+			d[i] = pattern[i % period];
+	}
+
+	const u8 sc_Pattern64[16] = { 0xEF, 0xCD, 0xAB, 0x89, 0x67, 0x45, 0x23, 0x01 };
+	const u8 sc_Pattern32[4] = { 0x67, 0x45, 0x23, 0x01 };
+
+	void ref_memmove (u8 *d, const u8 *s, u64 sz)	{ ::memmove(d, s, sz); }
+	void ref_memset_16 (u8 *d, const u8 *, u64 sz)	{ fillPattern(d, sc_Pattern64, 16, sz); }
+	void ref_memset_8 (u8 *d, const u8 *, u64 sz)	{ fillPattern(d, sc_Pattern64, 8, sz); }
+	void ref_memset_4 (u8 *d, const u8 *, u64 sz)	{ fillPattern(d, sc_Pattern32, 4, sz); }
+	void ref_memset (u8 *d, const u8 *, u64 sz)		{ ::memset(d, 0x5A, sz); }
+	void ref_zero (u8 *d, const u8 *, u64 sz)		{ ::memset(d, 0, sz); }
+
+	const op s_Ops[] = {
+		{ "memcpy_16",	"native",	e_Copy,	16,	op_memcpy_16,		ref_memmove },
+		{ "memcpy_8",	"native",	e_Copy,	8,	op_memcpy_8,		ref_memmove },
+		{ "memcpy_4",	"native",	e_Copy,	4,	op_memcpy_4,		ref_memmove },
+		{ "memcpy",		"native",	e_Copy,	1,	op_memcpy,			ref_memmove },
+		{ "memcpy",		"glibc",	e_Copy,	1,	op_glibc_memcpy,	nullptr },
+		{ "memmove",	"native",	e_Move,	1,	op_memmove,			ref_memmove },
+		{ "memmove",	"glibc",	e_Move,	1,	op_glibc_memmove,	nullptr },
+		{ "memset_16",	"native",	e_Set,	16,	op_memset_16,		ref_memset_16 },
+		{ "memset_8",	"native",	e_Set,	8,	op_memset_8,		ref_memset_8 },
+		{ "memset_4",	"native",	e_Set,	4,	op_memset_4,		ref_memset_4 },
+		{ "memset",		"native",	e_Set,	1,	op_memset,			ref_memset },
+		{ "memset",		"glibc",	e_Set,	1,	op_glibc_memset,	nullptr },
+		{ "zeroPages",	"native",	e_Set,	16,	op_zeroPages,		ref_zero },
+		{ "getHash",	"native",	e_Hash,	1,	op_getHash,			nullptr },
+	};
+
+	struct engine
+	{
+		const char	*name;
+		bool		avx2;
+		bool		ermsb;
+	};
+
+	// Destination/source offsets from a page boundary.
+	const u64 s_Alignments[][2] = {
+		{ 0, 0 },
+		{ 8, 0 },
+		{ 4, 4 },
+		{ 1, 0 },
+		{ 7, 13 },
+	};
+
+	const u64 s_Sizes[] = {
+		8, 13, 16, 31, 64, 100, 128, 256, 512, 1024, 2048, 3000, 4096, 8192, 16384, 65536, 262144, 1048576, 4194304
+	};
+
+	const u64 sc_ArenaSize = 256ULL << 20;
+
+	u64 nowNs ()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return u64(ts.tv_sec) * 1000000000ULL + u64(ts.tv_nsec);
+	}
+
+	// The bench can't run native::cpu::init (it writes CR4 and XCR0), so it asks the host directly
+	// which engines are usable.
+	vector<engine> hostEngines ()
+	{
+		u32 regs[4];
+		native::cpuid(0, 0, regs);
+		const u32 maxLeaf = regs[0];
+
+		native::cpuid(1, 0, regs);
+		const bool osxsave = (regs[2] & (1U << 27)) != 0;
+		const bool avx = (regs[2] & (1U << 28)) != 0;
+
+		bool avx2 = false;
+		bool ermsb = false;
+		if (maxLeaf >= 7)
+		{
+			native::cpuid(7, 0, regs);
+			avx2 = (regs[1] & (1U << 5)) != 0;
+			ermsb = (regs[1] & (1U << 9)) != 0;
+		}
+		avx2 = avx2 && osxsave && avx && (native::xgetbv(0) & 0x6) == 0x6;
+
+		vector<engine> engines;
+		engines.push_back(engine{ "sse2", false, false });
+		if (avx2)
+			engines.push_back(engine{ "avx2", true, false });
+		if (ermsb)
+			engines.push_back(engine{ "ermsb", avx2, true });
+		return engines;
+	}
+
+	void useEngine (const engine &e)
+	{
+		native::mem::s_UseAVX2 = e.avx2;
+		native::mem::s_UseERMSB = e.ermsb;
+	}
+
+	const u64 sc_CheckSmall = 512;		// Every size up to here
+	const u64 sc_CheckMax = 6144;		// Then a spread of sizes up to here
+	const u64 sc_CheckGuard = 64;		// Bytes checked on either side of what a call may write
+	// Room for an overlapping source on either side of the destination.
+	const u64 sc_CheckOrigin = sc_CheckMax + 128;
+	const u64 sc_CheckBuffer = sc_CheckOrigin + 64 + 2 * sc_CheckMax + 128;
+
+	// The source, what the destinations start as, and the destination for the primitive and for its reference. Line
+	// aligned, so offsets from the buffers are offsets from a cache line.
+	_align(64) u8 s_CheckSource[sc_CheckBuffer];
+	_align(64) u8 s_CheckPristine[sc_CheckBuffer];
+	_align(64) u8 s_CheckGot[sc_CheckBuffer];
+	_align(64) u8 s_CheckExpected[sc_CheckBuffer];
+
+	vector<u64> checkSizes ()
+	{
+		vector<u64> sizes;
+		for (u64 sz = 0; sz <= sc_CheckSmall; ++sz)
+			sizes.push_back(sz);
+		for (u64 sz = sc_CheckSmall + 1; sz <= sc_CheckMax; sz += 1 + sz / 8)
+			sizes.push_back(sz);
+
+		// Either side of where the large paths change strategy.
+		const u64 edges[] = { native::mem::sc_ERMSBThreshold, native::mem::sc_StreamThreshold };
+		for (u64 edge : edges)
+		{
+			for (u64 sz = edge - 16; sz <= edge + 16; ++sz)
+				sizes.push_back(sz);
+		}
+		return sizes;
+	}
+
+	// One call of the primitive on s_CheckGot and of its reference on s_CheckExpected, with the destination dst bytes
+	// in. The source is src bytes into s_CheckSource, or into the destination buffer itself when overlapping.
+	bool checkCall (const op &o, const char *engineName, u64 sz, u64 dst, u64 src, bool overlap)
+	{
+		o.func(s_CheckGot + dst, (overlap ? s_CheckGot : s_CheckSource) + src, sz);
+		o.reference(s_CheckExpected + dst, (overlap ? s_CheckExpected : s_CheckSource) + src, sz);
+
+		// Everything either call may have touched, and the guard bytes around it.
+		const u64 first = (overlap && src < dst ? src : dst) - sc_CheckGuard;
+		const u64 last = (overlap && src > dst ? src : dst) + sz + sc_CheckGuard;
+
+		bool ok = true;
+		if (::memcmp(s_CheckGot + first, s_CheckExpected + first, last - first) != 0)
+		{
+			u64 i = first;
+			while (s_CheckGot[i] == s_CheckExpected[i])
+				++i;
+			fprintf(stderr, "FAIL %s (%s): size %llu, dst offset %llu, src %s %lld: byte %lld is 0x%02x, expected 0x%02x\n",
+				o.name, engineName, (unsigned long long)sz, (unsigned long long)(dst % 64),
+				overlap ? "at dst" : "offset", overlap ? (long long)(src - dst) : (long long)(src % 64),
+				(long long)(i - dst), s_CheckGot[i], s_CheckExpected[i]);
+			ok = false;
+		}
+
+		::memcpy(s_CheckGot + first, s_CheckPristine + first, last - first);
+		::memcpy(s_CheckExpected + first, s_CheckPristine + first, last - first);
+		return ok;
+	}
+
+	// Every native copy and fill against its reference, on every engine. Returns false on the first mismatch.
+	bool check (const vector<engine> &engines)
+	{
+		u64 state = 0x9E3779B97F4A7C15ULL;
+		for (u64 i = 0; i < sc_CheckBuffer; ++i)
+		{
+			state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+			s_CheckSource[i] = u8(state >> 56);
+			s_CheckPristine[i] = u8(state >> 48);
+		}
+		::memcpy(s_CheckGot, s_CheckPristine, sc_CheckBuffer);
+		::memcpy(s_CheckExpected, s_CheckPristine, sc_CheckBuffer);
+
+		const vector<u64> sizes = checkSizes();
+		u64 calls = 0;
+
+		for (const engine &e : engines)
+		{
+			useEngine(e);
+
+			for (const op &o : s_Ops)
+			{
+				if (!o.reference)
+					continue;
+
+				for (u64 sz : sizes)
+				{
+					if ((sz % o.align) != 0)
+						continue;
+
+					for (u64 dskew = 0; dskew < 64; dskew += o.align)
+					{
+						const u64 dst = sc_CheckOrigin + dskew;
+
+						// Sets ignore the source.
+						const u64 sskews = o.kind == e_Set ? 1 : 64;
+						for (u64 sskew = 0; sskew < sskews; sskew += o.align, ++calls)
+						{
+							if (!checkCall(o, e.name, sz, dst, sc_CheckGuard + sskew, false))
+								return false;
+						}
+
+						if (o.kind != e_Move)
+							continue;
+
+						// Overlapping by a little, by a vector or a line and either side of them, and by a lot, with
+						// the source below the destination (a backward move) and above it (a forward one).
+						const u64 deltas[] = { 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, sz / 2, sz - 1 };
+						for (u64 delta : deltas)
+						{
+							if (delta == 0 || delta >= sz)
+								continue;
+							calls += 2;
+							if (!checkCall(o, e.name, sz, dst, dst - delta, true) || !checkCall(o, e.name, sz, dst, dst + delta, true))
+								return false;
+						}
+					}
+				}
+			}
+		}
+
+		fprintf(stderr, "check: %llu calls on %u engines OK\n", (unsigned long long)calls, u32(engines.size()));
+		return true;
+	}
+
+	// getHash against published XXH64 digests (seed 0), then xxh::state::copyUpdate and update, fed the same data in
+	// random chunks, against getHash. Uses the check buffers, so run it after check ().
+	bool checkHash ()
+	{
+		struct vector_case
+		{
+			const char	*input;
+			u64			digest;
+		};
+		static const vector_case sc_Vectors[] = {
+			{ "",		0xEF46DB3751D8E999ULL },
+			{ "a",		0xD24EC4F1A98C6E5BULL },
+			{ "abc",	0x44BC2CF5AD770999ULL },
+		};
+		for (const vector_case &v : sc_Vectors)
+		{
+			const u64 got = getHash((const u8 *)v.input, ::strlen(v.input));
+			if (got != v.digest)
+			{
+				fprintf(stderr, "FAIL getHash(\"%s\"): got %016llx, expected %016llx\n", v.input,
+					(unsigned long long)got, (unsigned long long)v.digest);
+				return false;
+			}
+		}
+
+		// Chunks from 1 byte to a few stripes, so partial stripes are carried over, completed and skipped past.
+		u64 random = 0x2545F4914F6CDD1DULL;
+		u64 runs = 0;
+		for (u64 sz = 0; sz <= 2048; sz += (sz < 128) ? 1 : 1 + sz / 16)
+		{
+			const u64 expected = getHash(s_CheckSource, sz);
+			for (u32 pass = 0; pass < 8; ++pass, ++runs)
+			{
+				xxh::state copied;
+				xxh::state hashed;
+				copied.init();
+				hashed.init();
+				::memset(s_CheckGot, 0, sz);
+
+				for (u64 offset = 0; offset < sz;)
+				{
+					random ^= random >> 12;
+					random ^= random << 25;
+					random ^= random >> 27;
+					u64 chunk = 1 + (random * 2685821657736338717ULL >> 32) % (pass < 4 ? 8 : 100);
+					if (chunk > sz - offset)
+						chunk = sz - offset;
+
+					copied.copyUpdate(s_CheckGot + offset, s_CheckSource + offset, chunk);
+					hashed.update(s_CheckSource + offset, chunk);
+					offset += chunk;
+				}
+
+				if (copied.digest() != expected || hashed.digest() != expected || ::memcmp(s_CheckGot, s_CheckSource, sz) != 0)
+				{
+					fprintf(stderr, "FAIL chunked hash of %llu bytes: copyUpdate %016llx, update %016llx, getHash %016llx%s\n",
+						(unsigned long long)sz, (unsigned long long)copied.digest(), (unsigned long long)hashed.digest(),
+						(unsigned long long)expected, ::memcmp(s_CheckGot, s_CheckSource, sz) != 0 ? ", copy differs" : "");
+					return false;
+				}
+			}
+		}
+
+		::memcpy(s_CheckGot, s_CheckPristine, sc_CheckBuffer);
+		fprintf(stderr, "check: %u XXH64 vectors and %llu chunked hashes OK\n", u32(sizeof(sc_Vectors) / sizeof(sc_Vectors[0])),
+			(unsigned long long)runs);
+		return true;
+	}
+
+	void run (const op &o, const char *engineName, u64 sz, u64 dalign, u64 salign, bool cold, u8 *arena, u64 minNs)
+	{
+		// Slices are page aligned, with room for the misalignment and the source behind the destination.
+		const u64 slice = ((sz + 64 + 4095) & ~4095ULL) * 2;
+		const u64 nslices = cold ? (sc_ArenaSize / slice) : 1;
+
+		auto call = [&] (u64 i)
+		{
+			u8 *base = arena + (i % nslices) * slice;
+			u8 *dst = base + dalign;
+			const u8 *src = base + (slice / 2) + salign;
+			o.func(dst, src, sz);
+		};
+
+		// Warm up (and fault in) whatever we are about to touch.
+		const u64 warm = cold ? nslices : 16;
+		for (u64 i = 0; i < warm; ++i)
+			call(i);
+
+		u64 calls = 0;
+		const u64 startNs = nowNs();
+		const u64 startTsc = native::rdtsc();
+		u64 elapsedNs = 0;
+		do
+		{
+			for (u32 i = 0; i < 16; ++i)
+				call(calls++);
+			elapsedNs = nowNs() - startNs;
+		} while (elapsedNs < minNs);
+		const u64 cycles = native::rdtsc() - startTsc;
+
+		const double cyclesPerCall = double(cycles) / double(calls);
+		const double nsPerCall = double(elapsedNs) / double(calls);
+		printf("%s,%s,%s,%llu,%llu,%llu,%s,%llu,%.2f,%.2f,%.3f,%.3f\n",
+			o.name, o.impl, engineName,
+			(unsigned long long)sz, (unsigned long long)dalign, (unsigned long long)salign,
+			cold ? "cold" : "hot",
+			(unsigned long long)calls,
+			cyclesPerCall,
+			nsPerCall,
+			double(sz) / cyclesPerCall,
+			(double(sz) / nsPerCall) * (1e9 / double(1ULL << 30))
+		);
+		fflush(stdout);
+	}
+}
+
+int main (int argc, const char **argv)
+{
+	u64 minMs = 5;
+	const char *filter = nullptr;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--ms") && i + 1 < argc)
+		{
+			minMs = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+		{
+			filter = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--ms N] [--filter STR]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	u8 *arena = (u8 *)aligned_alloc(4096, sc_ArenaSize);
+	if (!arena)
+	{
+		fprintf(stderr, "Could not allocate the %llu MiB arena\n", (unsigned long long)(sc_ArenaSize >> 20));
+		return 1;
+	}
+	::memset(arena, 0xA5, sc_ArenaSize);
+
+	const vector<engine> engines = hostEngines();
+	if (!check(engines) || !checkHash())
+		return 1;
+
+	printf("op,impl,engine,size,dst_align,src_align,residency,calls,cycles_per_call,ns_per_call,bytes_per_cycle,gib_per_s\n");
+
+	for (const op &o : s_Ops)
+	{
+		if (filter && !strstr(o.name, filter))
+			continue;
+
+		// Only native copy/fill primitives go through the engine; everything else runs once.
+		const bool perEngine = !strcmp(o.impl, "native") && o.kind != e_Hash;
+		const size_t nengines = perEngine ? engines.size() : 1;
+
+		for (size_t e = 0; e < nengines; ++e)
+		{
+			const char *engineName = perEngine ? engines[e].name : "-";
+			if (perEngine)
+				useEngine(engines[e]);
+
+			for (u64 sz : s_Sizes)
+			{
+				// Aligned primitives round the size down. Only measure sizes they process in full.
+				if ((sz % o.align) != 0)
+					continue;
+
+				for (const u64 *al : s_Alignments)
+				{
+					if ((al[0] % o.align) != 0 || (al[1] % o.align) != 0)
+						continue;
+					if ((o.kind == e_Set || o.kind == e_Hash) && al[1] != 0)
+						continue;
+
+					run(o, engineName, sz, al[0], al[1], false, arena, minMs * 1000000ULL);
+					run(o, engineName, sz, al[0], al[1], true, arena, minMs * 1000000ULL);
+				}
+			}
+		}
+	}
+
+	free(arena);
+
+	return 0;
+}
@@ -0,0 +1,304 @@
+#include "common.hpp"
+
+#include "heimbrau_asm/hb_asm.hpp"
+#include "heimbrau_loader/Loader/MemoryMap.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <vector>
+
+using namespace std;
+
+/* Host Memory Map Benchmark
+ *
+ * Runs SimpleMemoryEntry::cleanup and MemoryMap::Summarize, the loader's memory map normalization, on generated maps.
+ *
+ * First a randomized check: maps of random, overlapping ranges (some empty, some of types the loader doesn't know)
+ * over a window of 1 KiB slots, so ranges start and end inside pages. Every slot of the window gets the type a
+ * brute-force model says it has, the highest priority type of every range covering it (reserved over ACPI, so not the
+ * highest value), and the cleaned map must be exactly that model run-length encoded: sorted, with adjacent ranges of
+ * the same type merged and nothing left untyped covered. The summary is compared against totals counted slot by slot, and the input against a copy taken before.
+ * A mismatch prints the map and exits with status 1 before anything is timed.
+ *
+ * Then the timings. Output is CSV on stdout, one row per measurement:
+ *	entries,calls,ns_per_call,ns_per_entry
+ * for cleanup of random maps of that many entries, spread over 64 GiB.
+ *
+ * Options:
+ *	--ms N		minimum measurement time per row, in milliseconds (default 20)
+ *	--seed N	seed for the randomized check (default 1)
+*/
+
+namespace
+{
+	const u64 sc_Slot = 1024;
+	const u64 sc_Slots = 4096;
+	const u32 sc_SlotsPerPage = 4096 / sc_Slot;
+
+	u64 nowNs ()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return u64(ts.tv_sec) * 1000000000ULL + u64(ts.tv_nsec);
+	}
+
+	// xorshift64*, so runs are reproducible from --seed.
+	u64 s_Random = 1;
+	u64 random ()
+	{
+		s_Random ^= s_Random >> 12;
+		s_Random ^= s_Random << 25;
+		s_Random ^= s_Random >> 27;
+		return s_Random * 2685821657736338717ULL;
+	}
+
+	// What cleanup treats an entry's type as.
+	u32 modelType (u32 type)
+	{
+		return (type == 0 || type > MemoryMap::e_TypeBad) ? u32(MemoryMap::e_TypeReserved) : type;
+	}
+
+	// Overlap priority of each type, higher wins: usable, ACPI, NVS, reserved, bad. 0 is no type.
+	const u32 sc_Priority[MemoryMap::e_TypeBad + 1] = { 0, 1, 4, 2, 3, 5 };
+
+	void dump (const char *what, const SimpleMemoryEntry *entries, u32 count)
+	{
+		fprintf(stderr, "%s (%u entries):\n", what, count);
+		for (u32 i = 0; i < count; ++i)
+		{
+			fprintf(stderr, "\t0x%016llx 0x%016llx %u\n",
+				(unsigned long long)entries[i].offset, (unsigned long long)entries[i].extent, entries[i].type);
+		}
+	}
+
+	bool fail (const char *what, u64 got, u64 expected, const vector<SimpleMemoryEntry> &input, const SimpleMemoryEntry *output, u32 count)
+	{
+		fprintf(stderr, "FAIL %s: got 0x%llx, expected 0x%llx\n", what, (unsigned long long)got, (unsigned long long)expected);
+		dump("input", input.data(), u32(input.size()));
+		dump("output", output, count);
+		return false;
+	}
+
+	// One random map with base as the first slot's address, checked against the slot model.
+	bool checkMap (u64 base, u32 entries)
+	{
+		vector<SimpleMemoryEntry> input(entries);
+		for (SimpleMemoryEntry &entry : input)
+		{
+			// Mostly short ranges, so there are gaps, with the odd one covering much of the window.
+			const u64 first = random() % sc_Slots;
+			u64 slots = random() % 8 == 0 ? random() % sc_Slots : random() % 64;
+			if (first + slots > sc_Slots)
+				slots = sc_Slots - first;
+
+			// Types 1 to 5 mostly, sometimes 0 or one past the end.
+			const u64 kind = random() % 16;
+			entry.type = kind < 14 ? u32(1 + random() % MemoryMap::e_TypeBad) : (kind == 14 ? 0 : u32(6 + random() % 32));
+			entry.offset = base + first * sc_Slot;
+			entry.extent = slots * sc_Slot;
+			entry.node = 0;
+		}
+		const vector<SimpleMemoryEntry> original(input);
+
+		// The model: the highest priority type covering each slot, 0 for none.
+		vector<u32> model(sc_Slots, 0);
+		for (const SimpleMemoryEntry &entry : input)
+		{
+			const u64 first = (entry.offset - base) / sc_Slot;
+			const u64 type = modelType(entry.type);
+			for (u64 s = first; s < first + entry.extent / sc_Slot; ++s)
+			{
+				if (sc_Priority[model[s]] < sc_Priority[type])
+					model[s] = u32(type);
+			}
+		}
+
+		vector<SimpleMemoryEntry> output(entries ? 2 * entries - 1 : 1);
+		const u32 count = SimpleMemoryEntry::cleanup(input.data(), entries, output.data());
+		const SimpleMemoryEntry *out = output.data();
+
+		if (count > output.size())
+			return fail("entry count over 2n - 1", count, output.size(), input, out, count);
+		if (::memcmp(input.data(), original.data(), entries * sizeof(SimpleMemoryEntry)) != 0)
+			return fail("input changed", 1, 0, input, out, count);
+
+		// The model, run-length encoded, must be the output entry for entry.
+		u32 e = 0;
+		for (u64 s = 0; s < sc_Slots;)
+		{
+			if (model[s] == 0)
+			{
+				++s;
+				continue;
+			}
+
+			u64 end = s + 1;
+			while (end < sc_Slots && model[end] == model[s])
+				++end;
+
+			if (e == count)
+				return fail("missing entry at", base + s * sc_Slot, 0, input, out, count);
+			if (out[e].offset != base + s * sc_Slot)
+				return fail("entry offset", out[e].offset, base + s * sc_Slot, input, out, count);
+			if (out[e].extent != (end - s) * sc_Slot)
+				return fail("entry extent", out[e].extent, (end - s) * sc_Slot, input, out, count);
+			if (out[e].type != model[s])
+				return fail("entry type", out[e].type, model[s], input, out, count);
+			if (out[e].node != 0)
+				return fail("entry node", out[e].node, 0, input, out, count);
+
+			++e;
+			s = end;
+		}
+		if (e != count)
+			return fail("entry count", count, e, input, out, count);
+
+		// The summary, counted slot by slot.
+		MemoryMap::stats expected;
+		::memset(&expected, 0, sizeof(expected));
+		for (u64 s = 0; s < sc_Slots;)
+		{
+			const u32 type = model[s];
+			u64 end = s + 1;
+			while (end < sc_Slots && model[end] == type)
+				++end;
+
+			const u64 bytes = (end - s) * sc_Slot;
+			switch (type)
+			{
+			case 0:
+				break;
+			case MemoryMap::e_TypeUsable:
+				expected.m_UsableBytes += bytes;
+				if (bytes > expected.m_LargestRunBytes)
+				{
+					expected.m_LargestRunOffset = base + s * sc_Slot;
+					expected.m_LargestRunBytes = bytes;
+				}
+				expected.m_HighestUsableAddress = base + end * sc_Slot;
+				break;
+			case MemoryMap::e_TypeACPI:
+				expected.m_ACPIBytes += bytes;
+				break;
+			case MemoryMap::e_TypeNVS:
+				expected.m_NVSBytes += bytes;
+				break;
+			default:
+				expected.m_ReservedBytes += bytes;
+				break;
+			}
+			s = end;
+		}
+
+		// base is page aligned, so a page is usable when all of its slots are.
+		for (u64 page = 0; page < sc_Slots / sc_SlotsPerPage; ++page)
+		{
+			u32 usable = 0;
+			for (u32 i = 0; i < sc_SlotsPerPage; ++i)
+				usable += model[page * sc_SlotsPerPage + i] == MemoryMap::e_TypeUsable;
+			expected.m_UsablePages += usable == sc_SlotsPerPage;
+		}
+
+		const MemoryMap::stats got = MemoryMap::Summarize(out, count);
+		const u64 *g = (const u64 *)&got;
+		const u64 *x = (const u64 *)&expected;
+		static const char * const sc_Fields[] = {
+			"usable bytes", "usable pages", "reserved bytes", "ACPI bytes", "NVS bytes", "largest run offset",
+			"largest run bytes", "highest usable address",
+		};
+		static_assert(sizeof(sc_Fields) / sizeof(sc_Fields[0]) == sizeof(MemoryMap::stats) / sizeof(u64), "A name per stat");
+		for (u32 i = 0; i < sizeof(MemoryMap::stats) / sizeof(u64); ++i)
+		{
+			if (g[i] != x[i])
+				return fail(sc_Fields[i], g[i], x[i], input, out, count);
+		}
+
+		return true;
+	}
+
+	bool check (u64 seed)
+	{
+		static const u32 sc_Maps = 20000;
+
+		s_Random = seed | 1;
+		for (u32 i = 0; i < sc_Maps; ++i)
+		{
+			// Low memory, and the top of the physical address space.
+			const u64 base = (i & 1) ? 0 : (1ULL << 52) - sc_Slots * sc_Slot;
+			const u32 entries = u32(random() % (i % 16 == 0 ? 256 : 24));
+			if (!checkMap(base, entries))
+				return false;
+		}
+
+		fprintf(stderr, "check: %u random maps OK\n", sc_Maps);
+		return true;
+	}
+
+	void bench (u32 entries, u64 minNs)
+	{
+		vector<SimpleMemoryEntry> input(entries);
+		for (SimpleMemoryEntry &entry : input)
+		{
+			entry.offset = (random() % (64ULL << 30)) & ~4095ULL;
+			entry.extent = ((random() % (256ULL << 20)) + 4096) & ~4095ULL;
+			entry.type = u32(1 + random() % MemoryMap::e_TypeBad);
+			entry.node = 0;
+		}
+		vector<SimpleMemoryEntry> output(2 * entries);
+
+		u64 calls = 0;
+		u64 sink = 0;
+		const u64 start = nowNs();
+		u64 elapsed = 0;
+		do
+		{
+			for (u32 i = 0; i < 16; ++i, ++calls)
+				sink += SimpleMemoryEntry::cleanup(input.data(), entries, output.data());
+			elapsed = nowNs() - start;
+		} while (elapsed < minNs);
+
+		if (sink == 0)
+			fprintf(stderr, "cleanup returned nothing\n");
+
+		const double nsPerCall = double(elapsed) / double(calls);
+		printf("%u,%llu,%.1f,%.2f\n", entries, (unsigned long long)calls, nsPerCall, nsPerCall / double(entries));
+		fflush(stdout);
+	}
+}
+
+int main (int argc, const char **argv)
+{
+	u64 minMs = 20;
+	u64 seed = 1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--ms") && i + 1 < argc)
+		{
+			minMs = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+		{
+			seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--ms N] [--seed N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!check(seed))
+		return 1;
+
+	printf("entries,calls,ns_per_call,ns_per_entry\n");
+
+	const u32 sizes[] = { 8, 32, 128, 512, MemoryMap::sc_MaxEntries };
+	for (u32 entries : sizes)
+		bench(entries, minMs * 1000000ULL);
+
+	return 0;
+}
@@ -0,0 +1,378 @@
+#include "common.hpp"
+
+#include "heimbrau_kernel/Paging/PageTable.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <map>
+#include <vector>
+
+using namespace std;
+
+/* Host Page Table Benchmark
+ *
+ * Runs Paging::page_table, the walker the loader and kernel use, against a simulated physical memory, so map/unmap
+ * can be checked and timed without booting an image.
+ *
+ * First a randomized check: random maps and unmaps (including partial unmaps that split large pages) over a 16 GiB
+ * window, every one compared page by page against a plain std::map model, then everything unmapped again and every
+ * table expected back. It runs with 4 levels and again with 5, across a PML5 entry boundary. A mismatch prints the address and exits with status 1 before anything is timed.
+ *
+ * Then the timings. Output is CSV on stdout, one row per measurement:
+ *	op,largest,size,calls,ns_per_call,ns_per_4k
+ * ns_per_4k is the time per 4 KiB of address space covered, so rows with different page sizes compare directly.
+ *
+ *	map			- map a region of the given size, timed without the unmap that follows it
+ *	unmap		- unmap it again, freeing every table
+ *	translate	- random lookups in a mapped 1 GiB region
+ *	churn		- map then unmap a single 4 KiB page at a random address in a 1 GiB window, which allocates and
+ *				  frees its tables every time: the shape of a fault handler and munmap
+ *
+ * Options:
+ *	--ms N		minimum measurement time per row, in milliseconds (default 20)
+ *	--seed N	seed for the randomized check (default 1)
+*/
+
+namespace
+{
+	// Simulated RAM. Physical addresses start at sc_PhysBase so a zeroed entry can never point at a real table.
+	class sim_memory
+	{
+		u8				*m_Arena;
+		u64				m_Frames;
+		vector<u64>		m_Free;
+		u64				m_InUse;
+		bool			m_Poison;	// Fill freed tables with junk, so a use after free shows up in the check
+
+	public:
+		static const u64 sc_PhysBase = 0x100000;
+
+		sim_memory (u64 frames, bool poison) : m_Frames(frames), m_InUse(0), m_Poison(poison)
+		{
+			m_Arena = (u8 *)aligned_alloc(4096, frames * 4096);
+			if (!m_Arena)
+			{
+				fprintf(stderr, "Could not allocate %llu simulated frames\n", (unsigned long long)frames);
+				exit(1);
+			}
+			for (u64 i = frames; i-- > 0;)
+				m_Free.push_back(sc_PhysBase + i * 4096);
+		}
+
+		~sim_memory () { free(m_Arena); }
+
+		u64 * table (u64 phys)
+		{
+			if (phys < sc_PhysBase || phys >= sc_PhysBase + m_Frames * 4096 || (phys & 4095))
+			{
+				fprintf(stderr, "Walker followed a bad table pointer 0x%llx\n", (unsigned long long)phys);
+				exit(1);
+			}
+			return (u64 *)(m_Arena + (phys - sc_PhysBase));
+		}
+
+		u64 allocTable ()
+		{
+			if (m_Free.empty())
+				return Paging::sc_NoTable;
+			const u64 phys = m_Free.back();
+			m_Free.pop_back();
+			::memset(table(phys), 0, 4096);
+			++m_InUse;
+			return phys;
+		}
+
+		void freeTable (u64 phys)
+		{
+			if (m_Poison)
+				::memset(table(phys), 0xCC, 4096);
+			m_Free.push_back(phys);
+			--m_InUse;
+		}
+
+		u64 inUse () const { return m_InUse; }
+	};
+
+	typedef Paging::page_table<sim_memory> sim_table;
+
+	const u64 sc_PageSize = Paging::e_Page4K;
+
+	u64 nowNs ()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return u64(ts.tv_sec) * 1000000000ULL + u64(ts.tv_nsec);
+	}
+
+	// xorshift64*, so runs are reproducible from --seed.
+	u64 s_Random = 1;
+	u64 random ()
+	{
+		s_Random ^= s_Random >> 12;
+		s_Random ^= s_Random << 25;
+		s_Random ^= s_Random >> 27;
+		return s_Random * 2685821657736338717ULL;
+	}
+
+	bool fail (const char *what, u64 virt, u64 got, u64 expected)
+	{
+		fprintf(stderr, "FAIL %s at 0x%llx: got 0x%llx, expected 0x%llx\n",
+			what, (unsigned long long)virt, (unsigned long long)got, (unsigned long long)expected);
+		return false;
+	}
+
+	// Randomized check against a page-by-page model, with a Levels deep walk over the 16 GiB at virtBase.
+	// Returns false on the first mismatch.
+	template <u32 Levels>
+	bool check (u64 seed, u64 virtBase)
+	{
+		static const u64 sc_Window = 16ULL << 30;
+		static const u32 sc_Ops = 3000;
+
+		s_Random = seed | 1;
+
+		sim_memory memory(1 << 16, true);
+		const u64 root = memory.allocTable();
+		Paging::page_table<sim_memory, Levels> table(memory, root);
+		Paging::map_stats stats;
+		::memset(&stats, 0, sizeof(stats));
+
+		map<u64, u64> model;	// virtual page -> physical page
+
+		const u64 largest[] = { Paging::e_Page4K, Paging::e_Page2M, Paging::e_Page1G };
+
+		for (u32 op = 0; op < sc_Ops; ++op)
+		{
+			// Mostly small ranges, some crossing 2 MiB boundaries, a few big enough for 1 GiB pages.
+			const u64 kind = random() % 8;
+			u64 pages;
+			if (kind < 4)
+				pages = 1 + random() % 64;
+			else if (kind < 7)
+				pages = 1 + random() % 2048;
+			else
+				pages = 262144 + random() % 4096;
+
+			u64 start = (random() % (sc_Window / sc_PageSize - pages)) * sc_PageSize;
+			if (random() % 2)
+				start &= ~u64(Paging::e_Page2M - 1);
+			if (kind == 7 && (random() % 2))
+				start &= ~u64(Paging::e_Page1G - 1);
+			const u64 virt = virtBase + start;
+			const u64 size = pages * sc_PageSize;
+
+			if (random() % 3 != 0)
+			{
+				// Map, if the range is free in the model. Physical memory follows virtual at a 1 GiB aligned offset,
+				// or a page-misaligned one so large pages can't be used.
+				map<u64, u64>::iterator it = model.lower_bound(virt);
+				if (it != model.end() && it->first < virt + size)
+					continue;
+
+				u64 phys = (1 + random() % 64) << 30;
+				if (random() % 4 == 0)
+					phys += (1 + random() % 511) * sc_PageSize;
+				phys += start;
+
+				const u64 lim = largest[random() % 3];
+				if (!table.map(virt, phys, size, Paging::sc_Writable, lim, stats))
+					return fail("map", virt, 0, 1);
+				for (u64 p = 0; p < pages; ++p)
+					model[virt + p * sc_PageSize] = phys + p * sc_PageSize;
+			}
+			else
+			{
+				if (!table.unmap(virt, size, stats))
+					return fail("unmap", virt, 0, 1);
+				model.erase(model.lower_bound(virt), model.lower_bound(virt + size));
+			}
+
+			// The touched range and its edges, plus a random sample of the window.
+			for (u64 v = (virt > virtBase ? virt - sc_PageSize : virt); v <= virt + size && v < virtBase + sc_Window; v += sc_PageSize)
+			{
+				map<u64, u64>::const_iterator it = model.find(v);
+				const u64 expected = (it != model.end()) ? it->second + 0x123 : Paging::sc_NotMapped;
+				const u64 got = table.translate(v + 0x123);
+				if (got != expected)
+					return fail("translate", v, got, expected);
+			}
+			for (u32 i = 0; i < 64; ++i)
+			{
+				const u64 v = virtBase + (random() % (sc_Window / sc_PageSize)) * sc_PageSize;
+				map<u64, u64>::const_iterator it = model.find(v);
+				const u64 expected = (it != model.end()) ? it->second : Paging::sc_NotMapped;
+				const u64 got = table.translate(v);
+				if (got != expected)
+					return fail("translate (sample)", v, got, expected);
+			}
+
+			const u64 covered = stats.m_Pages4K + stats.m_Pages2M * 512 + stats.m_Pages1G * 512 * 512;
+			if (covered != model.size())
+				return fail("page count", virt, covered, model.size());
+			if (stats.m_Tables + 1 != memory.inUse())
+				return fail("table count", virt, stats.m_Tables + 1, memory.inUse());
+		}
+
+		if (!table.unmap(virtBase, sc_Window, stats))
+			return fail("final unmap", virtBase, 0, 1);
+		if (memory.inUse() != 1 || stats.m_Tables != 0 || stats.m_Pages4K || stats.m_Pages2M || stats.m_Pages1G)
+			return fail("tables left after unmapping everything", virtBase, memory.inUse(), 1);
+
+		fprintf(stderr, "check: %u random operations with %u levels OK\n", sc_Ops, Levels);
+		return true;
+	}
+
+	const char * pageName (u64 size)
+	{
+		return size == Paging::e_Page1G ? "1G" : (size == Paging::e_Page2M ? "2M" : "4K");
+	}
+
+	void row (const char *op, u64 largest, u64 size, u64 calls, u64 ns)
+	{
+		const double nsPerCall = double(ns) / double(calls);
+		printf("%s,%s,%llu,%llu,%.2f,%.4f\n", op, pageName(largest), (unsigned long long)size, (unsigned long long)calls,
+			nsPerCall, nsPerCall / double(size / sc_PageSize));
+		fflush(stdout);
+	}
+
+	void benchMap (sim_memory &memory, u64 root, u64 size, u64 largest, u64 minNs)
+	{
+		static const u64 sc_Virt = 0xFFFF800040000000ULL;
+		static const u64 sc_Phys = 0x0000004000000000ULL;
+
+		sim_table table(memory, root);
+		Paging::map_stats stats;
+		::memset(&stats, 0, sizeof(stats));
+
+		u64 calls = 0;
+		u64 mapNs = 0;
+		u64 unmapNs = 0;
+		while (mapNs + unmapNs < minNs)
+		{
+			const u64 t0 = nowNs();
+			table.map(sc_Virt, sc_Phys, size, Paging::sc_Writable, largest, stats);
+			const u64 t1 = nowNs();
+			table.unmap(sc_Virt, size, stats);
+			const u64 t2 = nowNs();
+			mapNs += t1 - t0;
+			unmapNs += t2 - t1;
+			++calls;
+		}
+
+		row("map", largest, size, calls, mapNs);
+		row("unmap", largest, size, calls, unmapNs);
+	}
+
+	void benchTranslate (sim_memory &memory, u64 root, u64 largest, u64 minNs)
+	{
+		static const u64 sc_Virt = 0xFFFF800040000000ULL;
+		static const u64 sc_Size = 1ULL << 30;
+
+		sim_table table(memory, root);
+		Paging::map_stats stats;
+		::memset(&stats, 0, sizeof(stats));
+		table.map(sc_Virt, 0x0000004000000000ULL, sc_Size, Paging::sc_Writable, largest, stats);
+
+		volatile u64 sink = 0;
+		u64 calls = 0;
+		const u64 start = nowNs();
+		u64 elapsed = 0;
+		do
+		{
+			for (u32 i = 0; i < 1024; ++i)
+				sink += table.translate(sc_Virt + (random() & (sc_Size - 1)));
+			calls += 1024;
+			elapsed = nowNs() - start;
+		} while (elapsed < minNs);
+
+		table.unmap(sc_Virt, sc_Size, stats);
+		row("translate", largest, sc_PageSize, calls, elapsed);
+	}
+
+	void benchChurn (sim_memory &memory, u64 root, u64 minNs)
+	{
+		static const u64 sc_Virt = 0x0000000080000000ULL;
+		static const u64 sc_Window = 1ULL << 30;
+
+		sim_table table(memory, root);
+		Paging::map_stats stats;
+		::memset(&stats, 0, sizeof(stats));
+
+		u64 calls = 0;
+		const u64 start = nowNs();
+		u64 elapsed = 0;
+		do
+		{
+			for (u32 i = 0; i < 1024; ++i)
+			{
+				const u64 v = sc_Virt + (random() & (sc_Window - 1) & ~(sc_PageSize - 1));
+				table.map(v, 0x100000000ULL + (v - sc_Virt), sc_PageSize, Paging::sc_Writable, Paging::e_Page4K, stats);
+				table.unmap(v, sc_PageSize, stats);
+			}
+			calls += 1024;
+			elapsed = nowNs() - start;
+		} while (elapsed < minNs);
+
+		row("churn", Paging::e_Page4K, sc_PageSize, calls, elapsed);
+	}
+}
+
+int main (int argc, const char **argv)
+{
+	u64 minMs = 20;
+	u64 seed = 1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--ms") && i + 1 < argc)
+		{
+			minMs = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+		{
+			seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--ms N] [--seed N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// The 4-level direct map base, and 8 GiB below the end of the first 5-level direct map slot, so the 5-level
+	// window crosses from one PML5 entry into the next.
+	if (!check<4>(seed, 0xFFFF800000000000ULL) || !check<5>(seed, 0xFF01000000000000ULL - (8ULL << 30)))
+		return 1;
+
+	// 1 GiB of 4 KiB pages takes 512 PTs, well inside 16384 frames.
+	sim_memory memory(16384, false);
+	const u64 root = memory.allocTable();
+	const u64 minNs = minMs * 1000000ULL;
+
+	printf("op,largest,size,calls,ns_per_call,ns_per_4k\n");
+
+	const u64 sizes[] = { 2ULL << 20, 64ULL << 20, 1ULL << 30 };
+	const u64 largest[] = { Paging::e_Page4K, Paging::e_Page2M, Paging::e_Page1G };
+	for (u64 size : sizes)
+	{
+		for (u64 lim : largest)
+		{
+			if (lim <= size)
+				benchMap(memory, root, size, lim, minNs);
+		}
+	}
+	for (u64 lim : largest)
+		benchTranslate(memory, root, lim, minNs);
+	benchChurn(memory, root, minNs);
+
+	if (memory.inUse() != 1)
+	{
+		fprintf(stderr, "FAIL %llu tables leaked by the benchmarks\n", (unsigned long long)(memory.inUse() - 1));
+		return 1;
+	}
+
+	return 0;
+}
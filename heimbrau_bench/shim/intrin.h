@@ -0,0 +1,93 @@
+#pragma once
+
+// Host shim for <intrin.h>
+// Lets the freestanding headers (common.hpp, heimbrau_asm/hb_asm.hpp, common/hash.hpp) compile with GCC/Clang
+// on Linux, so the memory primitives can be benchmarked and tested without booting an image.
+// Only the user-mode intrinsics actually do anything. The privileged ones are stubs, and must never be called.
+
+#include <x86intrin.h>
+#include <stddef.h>
+
+// __declspec(x) is mapped onto the GCC attribute for x.
+#define __declspec(x)				_hb_declspec_##x
+#define _hb_declspec_align(x)		__attribute__((aligned(x)))
+#define _hb_declspec_noreturn		__attribute__((noreturn))
+#define _hb_declspec_naked			__attribute__((naked))
+#define _hb_declspec_dllexport
+#define _hb_declspec_selectany		__attribute__((weak))
+#define _hb_declspec_allocate(x)
+
+// User-mode intrinsics
+static inline void __cpuidex (int regs[4], int leaf, int subleaf)
+{
+	__asm__ volatile ("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+}
+static inline void __movsb (unsigned char *dst, const unsigned char *src, size_t n)
+{
+	__asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+static inline void __stosb (unsigned char *dst, unsigned char val, size_t n)
+{
+	__asm__ volatile ("rep stosb" : "+D"(dst), "+c"(n) : "a"(val) : "memory");
+}
+static inline void __nop () { __asm__ volatile ("nop"); }
+static inline unsigned long __readgsdword (unsigned long offset)
+{
+	unsigned int v;
+	__asm__ volatile ("movl %%gs:(%1), %0" : "=r"(v) : "r"((unsigned long long)offset));
+	return v;
+}
+static inline long _InterlockedExchange (volatile long *target, long v) { return __atomic_exchange_n(target, v, __ATOMIC_SEQ_CST); }
+static inline long long _InterlockedIncrement64 (volatile long long *target) { return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST); }
+static inline long _InterlockedDecrement (volatile long *target) { return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST); }
+static inline long long _InterlockedDecrement64 (volatile long long *target) { return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST); }
+static inline long long _InterlockedExchangeAdd64 (volatile long long *target, long long v) { return __atomic_fetch_add(target, v, __ATOMIC_SEQ_CST); }
+static inline long long _InterlockedCompareExchange64 (volatile long long *target, long long v, long long cmp)
+{
+	__atomic_compare_exchange_n(target, &cmp, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return cmp;
+}
+static inline long long _InterlockedOr64 (volatile long long *target, long long v) { return __atomic_fetch_or(target, v, __ATOMIC_SEQ_CST); }
+static inline void * _InterlockedExchangePointer (void * volatile *target, void *v) { return __atomic_exchange_n(target, v, __ATOMIC_SEQ_CST); }
+static inline void * _InterlockedCompareExchangePointer (void * volatile *target, void *v, void *cmp)
+{
+	__atomic_compare_exchange_n(target, &cmp, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return cmp;
+}
+#define _ReadWriteBarrier()			__asm__ volatile ("" : : : "memory")
+static inline unsigned char _BitScanForward64 (unsigned long *idx, unsigned long long v)
+{
+	if (!v) return 0;
+	*idx = (unsigned long)__builtin_ctzll(v);
+	return 1;
+}
+static inline unsigned char _BitScanReverse64 (unsigned long *idx, unsigned long long v)
+{
+	if (!v) return 0;
+	*idx = 63UL - (unsigned long)__builtin_clzll(v);
+	return 1;
+}
+
+// Privileged intrinsics. Never executed on the host.
+static inline void __halt () {}
+static inline void _disable () {}
+static inline void _enable () {}
+static inline void __lidt (void *) {}
+static inline void __sidt (void *) {}
+static inline void __invlpg (void *) {}
+static inline void __wbinvd () {}
+static inline unsigned char __inbyte (unsigned short) { return 0; }
+static inline void __outbyte (unsigned short, unsigned char) {}
+static inline unsigned long long __readcr0 () { return 0; }
+static inline unsigned long long __readcr2 () { return 0; }
+static inline unsigned long long __readcr3 () { return 0; }
+static inline unsigned long long __readcr4 () { return 0; }
+static inline unsigned long long __readcr8 () { return 0; }
+static inline void __writecr0 (unsigned long long) {}
+static inline void __writecr3 (unsigned long long) {}
+static inline void __writecr4 (unsigned long long) {}
+static inline void __writecr8 (unsigned long long) {}
+static inline unsigned long long __readdr (unsigned int) { return 0; }
+static inline void __writedr (unsigned int, unsigned long long) {}
+static inline unsigned long long __readmsr (unsigned long) { return 0; }
+static inline void __writemsr (unsigned long, unsigned long long) {}
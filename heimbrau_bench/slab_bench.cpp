@@ -0,0 +1,530 @@
+#include "common.hpp"
+
+#include "heimbrau_asm/hb_asm.hpp"
+#include "heimbrau_kernel/Memory/Heap.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/* Host Heap Benchmark
+ *
+ * Runs Heap (kmalloc) and object_cache, the kernel's slab allocator, on host threads standing in for CPUs, with
+ * slabs from a simulated buddy source. Physical addresses are host pointers: outside the loader and kernel,
+ * Paging::phys_to_virt is the identity.
+ *
+ * First a randomized check: every thread allocates, fills and frees random sizes (some of them large blocks), and
+ * hands part of what it allocates to its neighbour to free, so objects cross CPUs through the depot. Every block is
+ * checked for its fill pattern and alignment on the way out, and sizes too large for any block must fail. Then
+ * everything is freed, every CPU flushed and the heap reaped, and every slab and block is expected back at the
+ * source. A failure exits with status 1 before anything is timed.
+ *
+ * Then the timings, next to glibc's malloc/free as a baseline. Output is CSV on stdout, one row per measurement:
+ *	op,allocator,threads,size,ops,ns_per_op
+ * ns_per_op is wall time per alloc or free, per thread.
+ *
+ *	pair	- alloc then free the same size: the magazine fast path
+ *	batch	- alloc 1024 objects, then free them all: magazines trade with the depot and refill from the slabs
+ *	remote	- thread 2n allocates, thread 2n+1 frees what it allocated: every object changes CPU
+ *
+ * Per-cache statistics after the timings go to stderr.
+ *
+ * Options:
+ *	--ms N		minimum measurement time per row, in milliseconds (default 20)
+ *	--seed N	seed for the randomized check (default 1)
+ *	--threads N	most threads to time with (default 4, at most native::cpu::sc_MaxCPUs)
+*/
+
+namespace
+{
+	// Block source for the heap: naturally aligned blocks carved from one arena, kept on a free list per order once
+	// given back. Nothing is ever merged, which a bench doesn't need.
+	class sim_source
+	{
+		static const u32 sc_Orders = 16;
+
+		u8				*m_Arena;
+		u64				m_Size;
+		u64				m_Next;
+		vector<u64>		m_Free[sc_Orders];
+		mutex			m_Lock;
+		atomic<s64>		m_Outstanding;
+
+	public:
+		explicit sim_source (u64 size) : m_Size(size), m_Next(0), m_Outstanding(0)
+		{
+			m_Arena = (u8 *)aligned_alloc(1 << 20, size);
+			if (!m_Arena)
+			{
+				fprintf(stderr, "Could not allocate a %llu MiB arena\n", (unsigned long long)(size >> 20));
+				exit(1);
+			}
+		}
+
+		~sim_source () { ::free(m_Arena); }
+
+		u64 alloc (u32 order)
+		{
+			lock_guard<mutex> _lock(m_Lock);
+
+			const u64 size = 4096ULL << order;
+			u64 phys;
+			if (order < sc_Orders && !m_Free[order].empty())
+			{
+				phys = m_Free[order].back();
+				m_Free[order].pop_back();
+			}
+			else
+			{
+				const u64 start = (m_Next + size - 1) & ~(size - 1);
+				if (order >= sc_Orders || start + size > m_Size)
+					return object_cache::sc_NoSlab;
+				m_Next = start + size;
+				phys = u64(m_Arena) + start;
+			}
+
+			++m_Outstanding;
+			return phys;
+		}
+
+		void free (u64 phys, u32 order)
+		{
+			lock_guard<mutex> _lock(m_Lock);
+			if ((phys & ((4096ULL << order) - 1)) != 0)
+			{
+				fprintf(stderr, "FAIL block 0x%llx given back misaligned for order %u\n", (unsigned long long)phys, order);
+				exit(1);
+			}
+			m_Free[order].push_back(phys);
+			--m_Outstanding;
+		}
+
+		s64 outstanding () const { return m_Outstanding; }
+	};
+
+	sim_source *s_Source = nullptr;
+
+	u64 sourceAlloc (u32, u32 order) { return s_Source->alloc(order); }
+	void sourceFree (u64 phys, u32 order) { s_Source->free(phys, order); }
+
+	u64 nowNs ()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return u64(ts.tv_sec) * 1000000000ULL + u64(ts.tv_nsec);
+	}
+
+	// xorshift64*, per thread, so runs are reproducible from --seed.
+	inline u64 random (u64 &state)
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 2685821657736338717ULL;
+	}
+
+	// Objects handed from one thread to the next to free. A mutex is plenty for a check.
+	struct mailbox
+	{
+		mutex					m_Lock;
+		vector<pair<u8 *, u64>>	m_Items;
+	};
+
+	atomic<bool> s_Failed(false);
+
+	void fail (const char *what, const void *p, u64 size)
+	{
+		fprintf(stderr, "FAIL %s: %p, %llu bytes\n", what, p, (unsigned long long)size);
+		s_Failed = true;
+	}
+
+	u8 patternOf (const u8 *p) { return u8((u64(p) >> 4) * 0x9D); }
+
+	void release (u32 cpu, u8 *p, u64 size)
+	{
+		const u8 expected = patternOf(p);
+		for (u64 i = 0; i < size; ++i)
+		{
+			if (p[i] != expected)
+			{
+				fail("block overwritten", p, size);
+				break;
+			}
+		}
+		Heap::free(cpu, p);
+	}
+
+	u64 randomSize (u64 &state)
+	{
+		const u64 kind = random(state) % 16;
+		if (kind < 10)
+			return random(state) % 129;
+		if (kind < 15)
+			return 129 + random(state) % (Heap::sc_MaxSmall - 128);
+		return Heap::sc_MaxSmall + 1 + random(state) % (64 << 10);
+	}
+
+	void checkThread (u32 cpu, u32 threads, u64 seed, mailbox *boxes)
+	{
+		static const u32 sc_Ops = 200000;
+		static const u32 sc_Live = 4096;
+
+		u64 state = (seed + cpu * 0x9E3779B97F4A7C15ULL) | 1;
+		vector<pair<u8 *, u64>> live;
+		mailbox &next = boxes[(cpu + 1) % threads];
+		mailbox &mine = boxes[cpu];
+
+		for (u32 op = 0; op < sc_Ops && !s_Failed; ++op)
+		{
+			if (live.size() < sc_Live && random(state) % 2)
+			{
+				const u64 size = randomSize(state);
+				u8 *p = (u8 *)Heap::alloc(cpu, size);
+				if (!p)
+				{
+					fail("out of memory", p, size);
+					return;
+				}
+				const u64 align = size > Heap::sc_MaxSmall ? 64 : 16;
+				if (u64(p) & (align - 1))
+					fail("misaligned", p, size);
+				::memset(p, patternOf(p), size);
+				live.push_back(make_pair(p, size));
+			}
+			else if (!live.empty())
+			{
+				const u64 i = random(state) % live.size();
+				const pair<u8 *, u64> item = live[i];
+				live[i] = live.back();
+				live.pop_back();
+
+				// A quarter go to the next thread to free.
+				if (threads > 1 && random(state) % 4 == 0)
+				{
+					lock_guard<mutex> _lock(next.m_Lock);
+					next.m_Items.push_back(item);
+				}
+				else
+				{
+					release(cpu, item.first, item.second);
+				}
+			}
+
+			if ((op & 255) == 0)
+			{
+				lock_guard<mutex> _lock(mine.m_Lock);
+				for (const pair<u8 *, u64> &item : mine.m_Items)
+					release(cpu, item.first, item.second);
+				mine.m_Items.clear();
+			}
+		}
+
+		for (const pair<u8 *, u64> &item : live)
+			release(cpu, item.first, item.second);
+	}
+
+	bool check (u64 seed)
+	{
+		static const u32 sc_Threads = 4;
+
+		mailbox boxes[sc_Threads];
+		vector<thread> workers;
+		for (u32 cpu = 0; cpu < sc_Threads; ++cpu)
+			workers.push_back(thread(checkThread, cpu, sc_Threads, seed, boxes));
+		for (thread &t : workers)
+			t.join();
+
+		for (u32 cpu = 0; cpu < sc_Threads; ++cpu)
+		{
+			for (const pair<u8 *, u64> &item : boxes[cpu].m_Items)
+				release(cpu, item.first, item.second);
+		}
+		if (s_Failed)
+			return false;
+
+		// Sizes whose frame count would wrap must fail, not come back as a small block.
+		static const u64 sc_Huge[] = { ~0ULL, ~0ULL - 4095, ~0ULL - object_cache::sc_HeaderSize - 4096 + 1 };
+		const u64 failures = Heap::getLargeStats().m_Failures;
+		for (u64 size : sc_Huge)
+		{
+			void *p = Heap::alloc(0, size);
+			if (p)
+			{
+				fprintf(stderr, "FAIL %llu bytes allocated at %p\n", (unsigned long long)size, p);
+				return false;
+			}
+		}
+		if (Heap::getLargeStats().m_Failures != failures + sizeof(sc_Huge) / sizeof(sc_Huge[0]))
+		{
+			fprintf(stderr, "FAIL huge allocations not counted as failures\n");
+			return false;
+		}
+
+		for (u32 cpu = 0; cpu < sc_Threads; ++cpu)
+			Heap::flush(cpu);
+
+		u64 allocs = 0;
+		for (u32 i = 0; i < Heap::sc_Classes; ++i)
+		{
+			const object_cache::stats st = Heap::getCache(i).getStats();
+			allocs += st.m_Allocs;
+			if (st.m_Allocs != st.m_Frees || st.m_Allocated != st.m_Cached)
+			{
+				fprintf(stderr, "FAIL %s: %llu allocs, %llu frees, %llu allocated from slabs, %llu cached\n", Heap::getCache(i).getName(),
+					(unsigned long long)st.m_Allocs, (unsigned long long)st.m_Frees, (unsigned long long)st.m_Allocated, (unsigned long long)st.m_Cached);
+				return false;
+			}
+		}
+
+		Heap::reap(0);
+		for (u32 i = 0; i < Heap::sc_Caches; ++i)
+		{
+			const object_cache::stats st = Heap::getCache(i).getStats();
+			if (st.m_Slabs != 0 || st.m_Allocated != 0)
+			{
+				fprintf(stderr, "FAIL %s: %llu slabs and %llu objects left after reaping\n", Heap::getCache(i).getName(),
+					(unsigned long long)st.m_Slabs, (unsigned long long)st.m_Allocated);
+				return false;
+			}
+		}
+		if (Heap::getLargeStats().m_Blocks != 0 || s_Source->outstanding() != 0)
+		{
+			fprintf(stderr, "FAIL %lld blocks not given back to the source\n", (long long)s_Source->outstanding());
+			return false;
+		}
+
+		fprintf(stderr, "check: %u threads, %llu small allocations, %llu large, all memory back OK\n", sc_Threads,
+			(unsigned long long)allocs, (unsigned long long)Heap::getLargeStats().m_Allocs);
+		return true;
+	}
+
+	// The two allocators under test, behind the same calls.
+	struct heap_ops
+	{
+		static const char * name () { return "kmalloc"; }
+		static void * alloc (u32 cpu, u64 size) { return Heap::alloc(cpu, size); }
+		static void free (u32 cpu, void *p) { Heap::free(cpu, p); }
+	};
+
+	struct libc_ops
+	{
+		static const char * name () { return "malloc"; }
+		static void * alloc (u32, u64 size) { return ::malloc(size); }
+		static void free (u32, void *p) { ::free(p); }
+	};
+
+	template <class Ops>
+	u64 runPair (u32 cpu, u64 size, u64 minNs, atomic<u64> *ops)
+	{
+		u64 done = 0;
+		const u64 start = nowNs();
+		do
+		{
+			for (u32 i = 0; i < 1024; ++i)
+			{
+				void *p = Ops::alloc(cpu, size);
+				*(volatile u8 *)p = 1;
+				Ops::free(cpu, p);
+			}
+			done += 2048;
+		} while (nowNs() - start < minNs);
+		*ops += done;
+		return nowNs() - start;
+	}
+
+	template <class Ops>
+	u64 runBatch (u32 cpu, u64 size, u64 minNs, atomic<u64> *ops)
+	{
+		void *batch[1024];
+		u64 done = 0;
+		const u64 start = nowNs();
+		do
+		{
+			for (u32 i = 0; i < 1024; ++i)
+			{
+				batch[i] = Ops::alloc(cpu, size);
+				*(volatile u8 *)batch[i] = 1;
+			}
+			for (u32 i = 0; i < 1024; ++i)
+				Ops::free(cpu, batch[i]);
+			done += 2048;
+		} while (nowNs() - start < minNs);
+		*ops += done;
+		return nowNs() - start;
+	}
+
+	// Single producer, single consumer ring between a pair of threads.
+	struct ring
+	{
+		static const u32 sc_Size = 4096;
+
+		void			*m_Slots[sc_Size];
+		atomic<u64>		m_Head;
+		atomic<u64>		m_Tail;
+		atomic<bool>	m_Done;
+	};
+
+	template <class Ops>
+	u64 runRemote (u32 cpu, u64 size, u64 minNs, atomic<u64> *ops, ring *rings)
+	{
+		ring &r = rings[cpu / 2];
+		u64 done = 0;
+		const u64 start = nowNs();
+		if ((cpu & 1) == 0)
+		{
+			do
+			{
+				for (u32 i = 0; i < 1024; ++i)
+				{
+					const u64 head = r.m_Head.load(memory_order_relaxed);
+					while (head - r.m_Tail.load(memory_order_acquire) == ring::sc_Size)
+						this_thread::yield();
+					void *p = Ops::alloc(cpu, size);
+					*(volatile u8 *)p = 1;
+					r.m_Slots[head % ring::sc_Size] = p;
+					r.m_Head.store(head + 1, memory_order_release);
+				}
+				done += 1024;
+			} while (nowNs() - start < minNs);
+			r.m_Done = true;
+		}
+		else
+		{
+			for (;;)
+			{
+				const u64 tail = r.m_Tail.load(memory_order_relaxed);
+				if (tail == r.m_Head.load(memory_order_acquire))
+				{
+					if (r.m_Done && tail == r.m_Head.load(memory_order_acquire))
+						break;
+					this_thread::yield();
+					continue;
+				}
+				Ops::free(cpu, r.m_Slots[tail % ring::sc_Size]);
+				r.m_Tail.store(tail + 1, memory_order_release);
+				++done;
+			}
+		}
+		*ops += done;
+		return nowNs() - start;
+	}
+
+	enum bench_kind { e_Pair, e_Batch, e_Remote };
+	const char * const sc_KindNames[] = { "pair", "batch", "remote" };
+
+	template <class Ops>
+	void bench (bench_kind kind, u32 threads, u64 size, u64 minNs)
+	{
+		atomic<u64> ops(0);
+		atomic<u64> totalNs(0);
+		vector<ring> rings(threads / 2 + 1);
+		for (ring &r : rings)
+		{
+			r.m_Head = 0;
+			r.m_Tail = 0;
+			r.m_Done = false;
+		}
+
+		vector<thread> workers;
+		for (u32 cpu = 0; cpu < threads; ++cpu)
+		{
+			workers.push_back(thread([&, cpu] ()
+			{
+				u64 ns = 0;
+				if (kind == e_Pair)
+					ns = runPair<Ops>(cpu, size, minNs, &ops);
+				else if (kind == e_Batch)
+					ns = runBatch<Ops>(cpu, size, minNs, &ops);
+				else
+					ns = runRemote<Ops>(cpu, size, minNs, &ops, rings.data());
+				totalNs += ns;
+			}));
+		}
+		for (thread &t : workers)
+			t.join();
+
+		printf("%s,%s,%u,%llu,%llu,%.2f\n", sc_KindNames[kind], Ops::name(), threads, (unsigned long long)size,
+			(unsigned long long)u64(ops), double(u64(totalNs)) / double(u64(ops)));
+		fflush(stdout);
+	}
+
+	void printCaches ()
+	{
+		fprintf(stderr, "cache,size,per_slab,slabs,empty_slabs,allocated,cached,utilization,fragmentation,hits,depot_hits,depot_misses\n");
+		for (u32 i = 0; i < Heap::sc_Caches; ++i)
+		{
+			const object_cache &cache = Heap::getCache(i);
+			const object_cache::stats st = cache.getStats();
+			if (st.m_SlabAllocs == 0)
+				continue;
+			fprintf(stderr, "%s,%llu,%u,%llu,%llu,%llu,%llu,%u,%u,%llu,%llu,%llu\n", cache.getName(),
+				(unsigned long long)cache.getSize(), cache.getSlabCapacity(), (unsigned long long)st.m_Slabs,
+				(unsigned long long)st.m_EmptySlabs, (unsigned long long)st.m_Allocated, (unsigned long long)st.m_Cached,
+				object_cache::utilization(st), object_cache::fragmentation(st), (unsigned long long)st.m_Hits,
+				(unsigned long long)st.m_DepotHits, (unsigned long long)st.m_DepotMisses);
+		}
+	}
+}
+
+int main (int argc, char **argv)
+{
+	u64 minMs = 20;
+	u64 seed = 1;
+	u32 maxThreads = 4;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--ms") && i + 1 < argc)
+		{
+			minMs = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+		{
+			seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+		{
+			maxThreads = u32(strtoul(argv[++i], nullptr, 10));
+			if (maxThreads < 1 || maxThreads > native::cpu::sc_MaxCPUs)
+				maxThreads = 4;
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--ms N] [--seed N] [--threads N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	sim_source source(1ULL << 30);
+	s_Source = &source;
+	Heap::init(sourceAlloc, sourceFree);
+
+	if (!check(seed))
+		return 1;
+
+	const u64 minNs = minMs * 1000000ULL;
+	const u64 sizes[] = { 32, 256, 2048 };
+
+	printf("op,allocator,threads,size,ops,ns_per_op\n");
+	for (u32 kind = e_Pair; kind <= e_Remote; ++kind)
+	{
+		for (u32 threads = (kind == e_Remote ? 2 : 1); threads <= maxThreads; threads *= 2)
+		{
+			for (u64 size : sizes)
+			{
+				bench<heap_ops>(bench_kind(kind), threads, size, minNs);
+				bench<libc_ops>(bench_kind(kind), threads, size, minNs);
+			}
+		}
+	}
+
+	printCaches();
+	return 0;
+}
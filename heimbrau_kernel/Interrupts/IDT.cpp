@@ -0,0 +1,61 @@
+#include "common.hpp"
+
+#include "..\..\heimbrau_asm\hb_asm.hpp"
+
+#include "IDT.hpp"
+
+namespace
+{
+	struct idt_gate
+	{
+		u16	m_OffsetLow;
+		u16	m_Selector;
+		u8	m_IST;
+		u8	m_Type;			// Present, DPL and gate type
+		u16	m_OffsetMid;
+		u32	m_OffsetHigh;
+		u32	m_Reserved;
+	};
+	static_assert(sizeof(idt_gate) == 16, "IDT gates are 16 bytes");
+
+#pragma pack(push, 1)
+	struct idt_pointer
+	{
+		u16	m_Limit;
+		u64	m_Base;
+	};
+#pragma pack(pop)
+
+	// Present, DPL 0, 64-bit interrupt gate.
+	const u8 sc_InterruptGate = 0x8E;
+
+	_align(16) idt_gate s_IDT[Interrupts::sc_Vectors];
+	u16 s_CodeSelector = 0;
+}
+
+void Interrupts::init ()
+{
+	native::mem::fillBytes(s_IDT, 0, sizeof(s_IDT));
+	s_CodeSelector = native::readCS();
+
+	idt_pointer pointer;
+	pointer.m_Limit = u16(sizeof(s_IDT) - 1);
+	pointer.m_Base = u64(s_IDT);
+	native::lidt(&pointer);
+}
+
+void Interrupts::setGate (u32 vector, void (*stub) (), u32 ist)
+{
+	const u64 offset = u64(stub);
+
+	idt_gate gate;
+	gate.m_OffsetLow = u16(offset);
+	gate.m_Selector = s_CodeSelector;
+	gate.m_IST = u8(ist & 7);
+	gate.m_Type = sc_InterruptGate;
+	gate.m_OffsetMid = u16(offset >> 16);
+	gate.m_OffsetHigh = u32(offset >> 32);
+	gate.m_Reserved = 0;
+
+	s_IDT[vector & (sc_Vectors - 1)] = gate;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.hpp"
+
+// Interrupt Descriptor Table.
+// 256 interrupt gates, all absent until setGate fills them in. Handlers are asm stubs (heimbrau_asm/stubs) that save
+// what the C++ side may clobber and call into it with a pointer to the interrupt_frame the CPU pushed.
+
+namespace Interrupts
+{
+	enum vector
+	{
+		e_VectorDivide			= 0,
+		e_VectorNMI				= 2,
+		e_VectorInvalidOpcode	= 6,
+		e_VectorDoubleFault		= 8,
+		e_VectorGeneralProtection	= 13,
+		e_VectorPageFault		= 14,
+	};
+
+	static const u32 sc_Vectors = 256;
+
+	// What the CPU pushes on an exception with an error code. m_Error is 0 for those without one.
+	struct interrupt_frame
+	{
+		u64	m_Error;
+		u64	m_RIP;
+		u64	m_CS;
+		u64	m_RFLAGS;
+		u64	m_RSP;
+		u64	m_SS;
+	};
+
+	// Clears the table and loads it. Gates use the current code segment.
+	void init ();
+
+	// Points vector at stub, as an interrupt gate (interrupts stay off in the handler). ist selects an Interrupt
+	// Stack Table entry of the TSS, or 0 to stay on the current stack.
+	void setGate (u32 vector, void (*stub) (), u32 ist = 0);
+}
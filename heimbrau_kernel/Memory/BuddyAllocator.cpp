@@ -0,0 +1,167 @@
+#include "BuddyAllocator.hpp"
+
+namespace
+{
+	inline u64 baseFrame (u64 base)
+	{
+		return (base >> buddy_allocator::sc_FrameShift) & ~((1ULL << buddy_allocator::sc_MaxOrder) - 1);
+	}
+}
+
+u64 buddy_allocator::storageSize (u64 base, u64 limit)
+{
+	const u64 frames = (limit >> sc_FrameShift) - baseFrame(base);
+	return frames * sizeof(link) + ((frames + 7) & ~7ULL);
+}
+
+u32 buddy_allocator::orderFor (u64 size)
+{
+	if (size <= sc_FrameSize)
+		return 0;
+	return native::highestBit((size - 1) >> sc_FrameShift) + 1;
+}
+
+void buddy_allocator::init (void *storage, u64 base, u64 limit)
+{
+	m_Base = baseFrame(base);
+	m_Frames = (limit >> sc_FrameShift) - m_Base;
+	if (m_Frames >= sc_None)
+		m_Frames = sc_None - 1;
+
+	m_Links = (link *)storage;
+	m_State = (u8 *)(m_Links + m_Frames);
+
+	for (u32 i = 0; i < sc_Orders; ++i)
+		m_Heads[i] = sc_None;
+	m_NonEmpty = 0;
+	native::mem::fillBytes(&m_Stats, 0, sizeof(stats));
+
+	// Only m_State needs a known value. Links are written before they are read.
+	native::mem::zeroPages(m_State, m_Frames);
+}
+
+void buddy_allocator::push (u32 frame, u32 order)
+{
+	const u32 head = m_Heads[order];
+	m_Links[frame].m_Next = head;
+	m_Links[frame].m_Prev = sc_None;
+	if (head != sc_None)
+		m_Links[head].m_Prev = frame;
+	m_Heads[order] = frame;
+
+	m_State[frame] = u8(e_Free | order);
+	m_NonEmpty |= 1U << order;
+	++m_Stats.m_FreeBlocks[order];
+}
+
+void buddy_allocator::unlink (u32 frame, u32 order)
+{
+	const link &l = m_Links[frame];
+	if (l.m_Prev != sc_None)
+		m_Links[l.m_Prev].m_Next = l.m_Next;
+	else
+		m_Heads[order] = l.m_Next;
+	if (l.m_Next != sc_None)
+		m_Links[l.m_Next].m_Prev = l.m_Prev;
+
+	if (m_Heads[order] == sc_None)
+		m_NonEmpty &= ~(1U << order);
+
+	m_State[frame] = 0;
+	--m_Stats.m_FreeBlocks[order];
+}
+
+void buddy_allocator::insert (u32 frame, u32 order)
+{
+	m_Stats.m_FreeFrames += 1ULL << order;
+
+	// Merge with the buddy for as long as it is free and the same size.
+	while (order < sc_MaxOrder)
+	{
+		const u32 buddy = frame ^ (1U << order);
+		if (buddy >= m_Frames || m_State[buddy] != u8(e_Free | order))
+			break;
+
+		unlink(buddy, order);
+		frame &= ~(1U << order);
+		++order;
+		++m_Stats.m_Merges;
+	}
+
+	push(frame, order);
+}
+
+void buddy_allocator::release (u64 phys, u64 size)
+{
+	u64 first = (phys + sc_FrameSize - 1) >> sc_FrameShift;
+	u64 end = (phys + size) >> sc_FrameShift;
+	first = (first > m_Base) ? (first - m_Base) : 0;
+	end = (end > m_Base) ? (end - m_Base) : 0;
+	if (end > m_Frames)
+		end = m_Frames;
+
+	while (first < end)
+	{
+		// Largest block that is aligned at first and still fits.
+		u32 order = first ? native::lowestBit(first) : sc_MaxOrder;
+		if (order > sc_MaxOrder)
+			order = sc_MaxOrder;
+		while ((1ULL << order) > end - first)
+			--order;
+
+		insert(u32(first), order);
+		m_Stats.m_TotalFrames += 1ULL << order;
+		first += 1ULL << order;
+	}
+}
+
+u64 buddy_allocator::alloc (u32 order)
+{
+	const u32 candidates = (order <= sc_MaxOrder) ? (m_NonEmpty & (~0U << order)) : 0;
+	if (candidates == 0)
+	{
+		++m_Stats.m_Failures;
+		return sc_NoBlock;
+	}
+
+	// Smallest free block that is large enough.
+	u32 current = native::lowestBit(candidates);
+	const u32 frame = m_Heads[current];
+	unlink(frame, current);
+
+	// Give back the upper half until it is the right size.
+	while (current > order)
+	{
+		--current;
+		push(frame + (1U << current), current);
+		++m_Stats.m_Splits;
+	}
+
+	m_Stats.m_FreeFrames -= 1ULL << order;
+	++m_Stats.m_Allocs;
+
+	return (m_Base + frame) << sc_FrameShift;
+}
+
+void buddy_allocator::free (u64 phys, u32 order)
+{
+	++m_Stats.m_Frees;
+	insert(u32((phys >> sc_FrameShift) - m_Base), order);
+}
+
+s32 buddy_allocator::largestFreeOrder () const
+{
+	return m_NonEmpty ? s32(native::highestBit(m_NonEmpty)) : -1;
+}
+
+u32 buddy_allocator::fragmentation (u32 order) const
+{
+	if (m_Stats.m_FreeFrames == 0)
+		return 0;
+
+	u64 usable = 0;
+	for (u32 i = order; i < sc_Orders; ++i)
+		usable += m_Stats.m_FreeBlocks[i] << i;
+
+	return u32(1000 - (usable * 1000) / m_Stats.m_FreeFrames);
+}
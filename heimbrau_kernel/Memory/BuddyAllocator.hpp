@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common.hpp"
+
+// Buddy allocator for naturally aligned, power-of-two runs of physical frames.
+// An order n block is 4 KiB << n frames, aligned to its own size, from order 0 (4 KiB) to sc_MaxOrder (1 GiB).
+// Free blocks sit on one doubly linked list per order, so taking a block, splitting it and merging a freed block with
+// its buddy are all O(1) (at most sc_MaxOrder steps).
+// The links and block state live in a side array (9 bytes per frame) instead of the free memory itself, so free
+// memory never has to be mapped or touched. Nothing here locks, callers serialize.
+
+class buddy_allocator
+{
+public:
+	static const u64 sc_FrameSize = 4096;
+	static const u32 sc_FrameShift = 12;
+	static const u32 sc_MaxOrder = 18;
+	static const u32 sc_Orders = sc_MaxOrder + 1;
+	// Returned by alloc () when no block is large enough.
+	static const u64 sc_NoBlock = ~0ULL;
+
+	// Running totals, for fragmentation and usage reports.
+	struct stats
+	{
+		u64	m_FreeBlocks[sc_Orders];	// Free blocks of each order
+		u64	m_FreeFrames;
+		u64	m_TotalFrames;				// Frames being managed, free or allocated
+		u64	m_Allocs;
+		u64	m_Frees;
+		u64	m_Failures;					// alloc () calls that found nothing
+		u64	m_Splits;
+		u64	m_Merges;
+	};
+
+	// Bytes of storage needed to track the frames in [base, limit).
+	static u64 storageSize (u64 base, u64 limit);
+
+	// Smallest order that holds size bytes.
+	static u32 orderFor (u64 size);
+
+	// Tracks the frames in [base, limit), which must span less than 16 TiB. storage must be storageSize(base, limit)
+	// bytes. base is rounded down to the largest block size so blocks stay naturally aligned.
+	// Nothing is free until it is handed over with release ().
+	void init (void *storage, u64 base, u64 limit);
+
+	// Adds every whole frame in [phys, phys + size) to the free lists, as the largest aligned blocks that fit.
+	// Anything outside [base, limit) is ignored. The frames must not already be free.
+	void release (u64 phys, u64 size);
+
+	// Allocates a block of the given order. Returns its physical address, aligned to its size, or sc_NoBlock.
+	u64 alloc (u32 order);
+	// Frees a block returned by alloc (), merging it with its buddy as far up as possible. order must match.
+	void free (u64 phys, u32 order);
+
+	const stats & getStats () const { return m_Stats; }
+
+	// Largest order with a free block, or -1 if nothing is free.
+	s32 largestFreeOrder () const;
+
+	// Fraction of free memory, in 1/1000ths, that is in blocks too small to satisfy an allocation of the given
+	// order. 0 means every free frame could be handed out at that order, 1000 means none of them could.
+	u32 fragmentation (u32 order) const;
+
+private:
+	static const u32 sc_None = 0xFFFFFFFF;
+	// m_State for the first frame of a free block: e_Free | order. Every other frame is 0.
+	static const u8 e_Free = 0x80;
+
+	struct link
+	{
+		u32	m_Next;
+		u32	m_Prev;
+	};
+
+	void push (u32 frame, u32 order);
+	void unlink (u32 frame, u32 order);
+	// Frees a block without counting it as a free () call.
+	void insert (u32 frame, u32 order);
+
+	link	*m_Links;
+	u8		*m_State;
+	u64		m_Base;				// First tracked frame. Frame indices below are relative to it.
+	u64		m_Frames;
+	u32		m_Heads[sc_Orders];
+	u32		m_NonEmpty;			// Bit n is set when the order n list has a block
+	stats	m_Stats;
+};
@@ -0,0 +1,269 @@
+#include "FrameBitmap.hpp"
+
+namespace
+{
+	inline u64 wordsFor (u64 bits) { return (bits + 63) >> 6; }
+
+	// Bits [from, 64) of a word.
+	inline u64 maskFrom (u64 from) { return ~0ULL << (from & 63); }
+}
+
+u64 frame_bitmap::storageSize (u64 limit)
+{
+	const u64 frames = limit >> sc_FrameShift;
+	const u64 words0 = wordsFor(frames);
+	const u64 words1 = wordsFor(words0);
+	const u64 words2 = wordsFor(words1);
+	return (words0 + words1 + words2) * sizeof(u64);
+}
+
+void frame_bitmap::init (void *storage, u64 limit)
+{
+	m_Frames = limit >> sc_FrameShift;
+	m_Words0 = wordsFor(m_Frames);
+	m_Words1 = wordsFor(m_Words0);
+	m_Words2 = wordsFor(m_Words1);
+
+	m_Level0 = (u64 *)storage;
+	m_Level1 = m_Level0 + m_Words0;
+	m_Level2 = m_Level1 + m_Words1;
+
+	m_FreeFrames = 0;
+	m_TotalFrames = 0;
+	m_Hint = m_Frames;
+
+	// Nobody is going to read the bitmap back soon, so keep it out of the cache.
+	native::mem::zeroPages(storage, storageSize(limit));
+}
+
+void frame_bitmap::summarize (u64 w)
+{
+	const u64 w1 = w >> 6;
+	const u64 w2 = w1 >> 6;
+	const u64 bit1 = 1ULL << (w & 63);
+	const u64 bit2 = 1ULL << (w1 & 63);
+
+	if (m_Level0[w] != 0)
+	{
+		m_Level1[w1] |= bit1;
+		m_Level2[w2] |= bit2;
+	}
+	else
+	{
+		m_Level1[w1] &= ~bit1;
+		if (m_Level1[w1] == 0)
+			m_Level2[w2] &= ~bit2;
+	}
+}
+
+u64 frame_bitmap::setRange (u64 first, u64 count, bool free)
+{
+	u64 changed = 0;
+	const u64 end = first + count;
+
+	while (first < end)
+	{
+		const u64 w = first >> 6;
+		const u64 lo = first & 63;
+		const u64 n = (end - first < 64 - lo) ? (end - first) : (64 - lo);
+		const u64 mask = (n == 64) ? ~0ULL : (((1ULL << n) - 1) << lo);
+
+		const u64 before = m_Level0[w];
+		const u64 after = free ? (before | mask) : (before & ~mask);
+		m_Level0[w] = after;
+
+		changed += native::popcount(before ^ after);
+		if ((before == 0) != (after == 0))
+			summarize(w);
+
+		first = (w + 1) << 6;
+	}
+
+	return changed;
+}
+
+u64 frame_bitmap::findFree (u64 frame) const
+{
+	if (frame >= m_Frames)
+		return sc_NoFrame;
+
+	u64 w0 = frame >> 6;
+	u64 bits = m_Level0[w0] & maskFrom(frame);
+	if (bits)
+		return (w0 << 6) + native::lowestBit(bits);
+
+	// Nothing left in this word. Ask level 1 for the next word with a free frame.
+	const u64 next0 = w0 + 1;
+	if (next0 >= m_Words0)
+		return sc_NoFrame;
+
+	u64 w1 = next0 >> 6;
+	bits = m_Level1[w1] & maskFrom(next0);
+	if (!bits)
+	{
+		// And level 2 for the next level 1 word, if that one is empty too.
+		const u64 next1 = w1 + 1;
+		if (next1 >= m_Words1)
+			return sc_NoFrame;
+
+		u64 w2 = next1 >> 6;
+		bits = m_Level2[w2] & maskFrom(next1);
+		while (!bits)
+		{
+			if (++w2 >= m_Words2)
+				return sc_NoFrame;
+			bits = m_Level2[w2];
+		}
+
+		w1 = (w2 << 6) + native::lowestBit(bits);
+		bits = m_Level1[w1];
+	}
+
+	w0 = (w1 << 6) + native::lowestBit(bits);
+	return (w0 << 6) + native::lowestBit(m_Level0[w0]);
+}
+
+u64 frame_bitmap::findUsed (u64 frame, u64 end) const
+{
+	while (frame < end)
+	{
+		const u64 w = frame >> 6;
+		const u64 bits = ~m_Level0[w] & maskFrom(frame);
+		if (bits)
+		{
+			const u64 used = (w << 6) + native::lowestBit(bits);
+			return used < end ? used : end;
+		}
+		frame = (w + 1) << 6;
+	}
+	return end;
+}
+
+void frame_bitmap::release (u64 phys, u64 size)
+{
+	// Only whole frames are usable.
+	u64 first = (phys + sc_FrameSize - 1) >> sc_FrameShift;
+	u64 end = (phys + size) >> sc_FrameShift;
+	if (end > m_Frames)
+		end = m_Frames;
+	if (first >= end)
+		return;
+
+	const u64 changed = setRange(first, end - first, true);
+	m_FreeFrames += changed;
+	m_TotalFrames += changed;
+
+	if (first < m_Hint)
+		m_Hint = first;
+}
+
+void frame_bitmap::reserve (u64 phys, u64 size)
+{
+	// Any frame the range touches is reserved, even partially.
+	u64 first = phys >> sc_FrameShift;
+	u64 end = (phys + size + sc_FrameSize - 1) >> sc_FrameShift;
+	if (end > m_Frames)
+		end = m_Frames;
+	if (first >= end)
+		return;
+
+	const u64 changed = setRange(first, end - first, false);
+	m_FreeFrames -= changed;
+	m_TotalFrames -= changed;
+}
+
+u64 frame_bitmap::alloc ()
+{
+	const u64 frame = findFree(m_Hint);
+	if (frame == sc_NoFrame)
+	{
+		m_Hint = m_Frames;
+		return sc_NoFrame;
+	}
+
+	const u64 w = frame >> 6;
+	m_Level0[w] &= ~(1ULL << (frame & 63));
+	if (m_Level0[w] == 0)
+		summarize(w);
+
+	--m_FreeFrames;
+	m_Hint = frame + 1;
+
+	return frame << sc_FrameShift;
+}
+
+u64 frame_bitmap::allocRun (u64 count, u64 align, u64 limit)
+{
+	if (count == 0)
+		return sc_NoFrame;
+	if (count == 1 && align <= sc_FrameSize && limit >= (m_Frames << sc_FrameShift))
+		return alloc();
+
+	const u64 step = (align > sc_FrameSize) ? (align >> sc_FrameShift) : 1;
+	const u64 end = (limit >> sc_FrameShift) < m_Frames ? (limit >> sc_FrameShift) : m_Frames;
+
+	u64 frame = findFree(m_Hint);
+	while (frame != sc_NoFrame)
+	{
+		const u64 start = (frame + step - 1) & ~(step - 1);
+		if (start + count > end)
+			break;
+
+		// Either the whole run is free, or we skip past the first used frame in it.
+		const u64 used = findUsed(start, start + count);
+		if (used == start + count)
+		{
+			setRange(start, count, false);
+			m_FreeFrames -= count;
+			return start << sc_FrameShift;
+		}
+
+		frame = findFree(used + 1);
+	}
+
+	return sc_NoFrame;
+}
+
+void frame_bitmap::free (u64 phys)
+{
+	const u64 frame = phys >> sc_FrameShift;
+	const u64 w = frame >> 6;
+
+	const u64 before = m_Level0[w];
+	m_Level0[w] = before | (1ULL << (frame & 63));
+	if (before == 0)
+		summarize(w);
+
+	++m_FreeFrames;
+	if (frame < m_Hint)
+		m_Hint = frame;
+}
+
+void frame_bitmap::freeRun (u64 phys, u64 count)
+{
+	const u64 frame = phys >> sc_FrameShift;
+
+	m_FreeFrames += setRange(frame, count, true);
+	if (frame < m_Hint)
+		m_Hint = frame;
+}
+
+bool frame_bitmap::isFree (u64 phys) const
+{
+	const u64 frame = phys >> sc_FrameShift;
+	if (frame >= m_Frames)
+		return false;
+	return (m_Level0[frame >> 6] & (1ULL << (frame & 63))) != 0;
+}
+
+bool frame_bitmap::findFreeRange (u64 from, u64 &phys, u64 &size) const
+{
+	const u64 first = findFree((from + sc_FrameSize - 1) >> sc_FrameShift);
+	if (first == sc_NoFrame)
+		return false;
+
+	const u64 end = findUsed(first, m_Frames);
+	phys = first << sc_FrameShift;
+	size = (end - first) << sc_FrameShift;
+	return true;
+}
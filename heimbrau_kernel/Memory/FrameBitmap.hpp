@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.hpp"
+
+// Physical frame allocator.
+// One bit per 4 KiB frame (set = free) in level 0, plus two summary levels: a level 1 bit is set when the level 0
+// word under it has any free frame, and a level 2 bit when the level 1 word under it does. Finding a free frame
+// is a short scan of level 2 (1 bit per 1 GiB) and then one bit scan per level.
+// Frames are identified by their physical address. Nothing here locks, callers serialize.
+
+class frame_bitmap
+{
+public:
+	static const u64 sc_FrameSize = 4096;
+	static const u32 sc_FrameShift = 12;
+	// Returned by the allocation functions when nothing fits.
+	static const u64 sc_NoFrame = ~0ULL;
+
+	// Bytes of storage needed to track the frames in [0, limit).
+	static u64 storageSize (u64 limit);
+
+	// Tracks the frames in [0, limit). storage must be storageSize(limit) bytes and 8-byte aligned.
+	// Every frame starts out used. Hand the usable ones over with release ().
+	void init (void *storage, u64 limit);
+
+	// Marks every whole frame in [phys, phys + size) as free (release) or used (reserve), and adjusts the number of
+	// frames being managed to match. Frames already in that state are left alone, so ranges may overlap.
+	void release (u64 phys, u64 size);
+	void reserve (u64 phys, u64 size);
+
+	// Allocates a single frame. The lowest free frame is always returned.
+	u64 alloc ();
+	// Allocates count contiguous frames, the first aligned to align bytes (a power of two, at least sc_FrameSize), all
+	// below limit.
+	u64 allocRun (u64 count, u64 align = sc_FrameSize, u64 limit = ~0ULL);
+	// Frees frames returned by alloc ()/allocRun (). Freeing a frame that is already free is a caller bug.
+	void free (u64 phys);
+	void freeRun (u64 phys, u64 count);
+
+	bool isFree (u64 phys) const;
+
+	// Finds the first run of free frames at or above from. Returns false if there is none.
+	bool findFreeRange (u64 from, u64 &phys, u64 &size) const;
+
+	// Frames currently free.
+	u64 freeFrames () const { return m_FreeFrames; }
+	// Frames being managed, free or allocated.
+	u64 totalFrames () const { return m_TotalFrames; }
+	// End of the tracked physical range.
+	u64 limit () const { return m_Frames << sc_FrameShift; }
+
+private:
+	// First free frame at or above frame, or sc_NoFrame.
+	u64 findFree (u64 frame) const;
+	// First used frame in [frame, end), or end.
+	u64 findUsed (u64 frame, u64 end) const;
+	// Sets frames [first, first + count) free or used. Returns how many changed state.
+	u64 setRange (u64 first, u64 count, bool free);
+	// Brings the summary bits above level 0 word w in line with it, after it went from zero to non-zero or back.
+	void summarize (u64 w);
+
+	u64	*m_Level0;
+	u64	*m_Level1;
+	u64	*m_Level2;
+	u64	m_Frames;
+	u64	m_Words0;
+	u64	m_Words1;
+	u64	m_Words2;
+	u64	m_FreeFrames;
+	u64	m_TotalFrames;
+	u64	m_Hint;			// No frame below this is free
+};
@@ -0,0 +1,82 @@
+#include "FrameCache.hpp"
+
+void frame_cache::init (node_allocator *backing)
+{
+	m_Backing = backing;
+	native::mem::fillBytes(m_Magazines, 0, sizeof(m_Magazines));
+}
+
+void frame_cache::refill (magazine &m)
+{
+	m.m_Count += m_Backing->allocBatch(m.m_Node, m.m_Frames + m.m_Count, sc_Batch);
+	++m.m_Stats.m_Refills;
+}
+
+void frame_cache::drain (magazine &m, u32 count)
+{
+	m_Backing->freeBatch(m.m_Frames, count);
+
+	// The newest frames are the most likely to still be in cache, so they are the ones kept.
+	m.m_Count -= count;
+	native::memmove(m.m_Frames, m.m_Frames + count, m.m_Count * sizeof(u64));
+
+	++m.m_Stats.m_Drains;
+}
+
+u64 frame_cache::alloc (u32 cpu)
+{
+	magazine &m = m_Magazines[cpu];
+
+	if (m.m_Count != 0)
+	{
+		++m.m_Stats.m_Hits;
+		return m.m_Frames[--m.m_Count];
+	}
+
+	++m.m_Stats.m_Misses;
+	refill(m);
+
+	return (m.m_Count != 0) ? m.m_Frames[--m.m_Count] : sc_NoFrame;
+}
+
+void frame_cache::free (u32 cpu, u64 phys)
+{
+	magazine &m = m_Magazines[cpu];
+
+	if (m.m_Count == sc_MagazineSize)
+		drain(m, sc_Batch);
+
+	m.m_Frames[m.m_Count++] = phys;
+}
+
+void frame_cache::flush (u32 cpu)
+{
+	magazine &m = m_Magazines[cpu];
+	if (m.m_Count != 0)
+		drain(m, m.m_Count);
+}
+
+frame_cache::stats frame_cache::getTotals () const
+{
+	stats totals;
+	native::mem::fillBytes(&totals, 0, sizeof(stats));
+
+	for (u32 i = 0; i < native::cpu::sc_MaxCPUs; ++i)
+	{
+		const stats &st = m_Magazines[i].m_Stats;
+		totals.m_Hits += st.m_Hits;
+		totals.m_Misses += st.m_Misses;
+		totals.m_Refills += st.m_Refills;
+		totals.m_Drains += st.m_Drains;
+	}
+
+	return totals;
+}
+
+u64 frame_cache::cachedFrames () const
+{
+	u64 count = 0;
+	for (u32 i = 0; i < native::cpu::sc_MaxCPUs; ++i)
+		count += m_Magazines[i].m_Count;
+	return count;
+}
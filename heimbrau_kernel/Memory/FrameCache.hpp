@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "NodeAllocator.hpp"
+
+// Per-CPU magazines of free 4 KiB frames in front of the shared node_allocator.
+// Single frame alloc ()/free () only touch the calling CPU's magazine. The node allocator (and its locks) is only
+// involved when a magazine runs dry or overflows, and then sc_Batch frames move at once, so a lock is taken
+// once per sc_Batch operations instead of once per frame. Refills come from the CPU's own node first.
+// A CPU's magazine must only be used by that CPU, and not from an interrupt handler that can interrupt it.
+
+class frame_cache
+{
+public:
+	static const u32 sc_MagazineSize = 64;
+	// Frames moved per refill/drain. A power of two, so a refill can usually be a single buddy block.
+	static const u32 sc_Batch = sc_MagazineSize / 2;
+	static const u64 sc_NoFrame = node_allocator::sc_NoBlock;
+
+	struct stats
+	{
+		u64	m_Hits;		// alloc () served from the magazine
+		u64	m_Misses;	// alloc () found the magazine empty
+		u64	m_Refills;	// Batches taken from the node allocator
+		u64	m_Drains;	// Batches given back to the node allocator
+	};
+
+	// backing must outlive the cache. Every magazine starts out empty, and every CPU on node 0.
+	void init (node_allocator *backing);
+
+	// Sets the node the CPU refills from first.
+	void setNode (u32 cpu, u32 node) { m_Magazines[cpu].m_Node = node; }
+
+	// Allocates a single frame for the given CPU. Returns sc_NoFrame if every node is out of memory too.
+	u64 alloc (u32 cpu);
+	// Frees a single frame, from any allocator call that returned one.
+	void free (u32 cpu, u64 phys);
+
+	// Gives every frame in the CPU's magazine back to the node allocator.
+	void flush (u32 cpu);
+
+	// Anything larger than a frame goes straight to the node allocator, from the CPU's node first.
+	u64 allocBlock (u32 cpu, u32 order) { return m_Backing->alloc(order, m_Magazines[cpu].m_Node); }
+	void freeBlock (u64 phys, u32 order) { m_Backing->free(phys, order); }
+
+	const stats & getStats (u32 cpu) const { return m_Magazines[cpu].m_Stats; }
+	// Sum over every CPU.
+	stats getTotals () const;
+	// Frames sitting in magazines, which the buddy allocators count as allocated.
+	u64 cachedFrames () const;
+
+private:
+	// One per CPU, on its own cache lines so CPUs never share a written line.
+	struct _align(64) magazine
+	{
+		u64		m_Frames[sc_MagazineSize];
+		u32		m_Count;
+		u32		m_Node;
+		stats	m_Stats;
+	};
+
+	void refill (magazine &m);
+	// Returns the oldest count frames to the node allocator.
+	void drain (magazine &m, u32 count);
+
+	magazine			m_Magazines[native::cpu::sc_MaxCPUs];
+	node_allocator		*m_Backing;
+};
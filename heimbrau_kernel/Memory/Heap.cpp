@@ -0,0 +1,154 @@
+#include "Heap.hpp"
+
+#include "../Paging/Paging.hpp"
+
+namespace
+{
+	// Steps of 16 bytes up to 64, then roughly 1.5x apart, so above 64 bytes at most a third of an object is rounding.
+	const u64 sc_ClassSizes[Heap::sc_Classes] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048 };
+	const char * const sc_ClassNames[Heap::sc_Classes] = {
+		"kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96", "kmalloc-128", "kmalloc-192",
+		"kmalloc-256", "kmalloc-384", "kmalloc-512", "kmalloc-768", "kmalloc-1024", "kmalloc-1536", "kmalloc-2048",
+	};
+	static_assert(object_cache::sc_MaxObjectSize >= Heap::sc_MaxSmall, "The largest class must fit in a slab");
+
+	// Header of a large block, where a slab keeps its cache pointer.
+	struct large_block
+	{
+		object_cache	*m_Cache;		// Always nullptr
+		u64				m_Order;
+		u64				m_Phys;
+	};
+	static_assert(sizeof(large_block) <= object_cache::sc_HeaderSize, "The large block header must fit in front of the data");
+
+	object_cache s_Classes[Heap::sc_Classes];
+	object_cache s_Magazines;
+
+	// Class of each size, in steps of 16 bytes.
+	u8 s_ClassOf[(Heap::sc_MaxSmall >> 4) + 1];
+
+	object_cache::slab_source s_Source = nullptr;
+	object_cache::slab_sink s_Sink = nullptr;
+
+	volatile s64 s_LargeAllocs = 0;
+	volatile s64 s_LargeFrees = 0;
+	volatile s64 s_LargeFailures = 0;
+	volatile s64 s_LargeBlocks = 0;
+	volatile s64 s_LargeFrames = 0;
+
+	void * allocLarge (u32 cpu, u64 size)
+	{
+		// Anything bigger wraps the frame count below.
+		if (size > ~0ULL - object_cache::sc_HeaderSize - Paging::e_Page4K)
+		{
+			_InterlockedIncrement64(&s_LargeFailures);
+			return nullptr;
+		}
+
+		const u64 frames = (size + object_cache::sc_HeaderSize + Paging::e_Page4K - 1) / Paging::e_Page4K;
+		u32 order = frames > 1 ? native::highestBit(frames - 1) + 1 : 0;
+		// Smaller blocks would not be aligned enough for kfree () to find the header.
+		if (order < object_cache::sc_SlabOrder)
+			order = object_cache::sc_SlabOrder;
+
+		const u64 phys = s_Source(cpu, order);
+		if (phys == object_cache::sc_NoSlab)
+		{
+			_InterlockedIncrement64(&s_LargeFailures);
+			return nullptr;
+		}
+
+		large_block *block = (large_block *)Paging::phys_to_virt(phys);
+		block->m_Cache = nullptr;
+		block->m_Order = order;
+		block->m_Phys = phys;
+
+		_InterlockedIncrement64(&s_LargeAllocs);
+		_InterlockedIncrement64(&s_LargeBlocks);
+		_InterlockedExchangeAdd64(&s_LargeFrames, s64(1) << order);
+		return (u8 *)block + object_cache::sc_HeaderSize;
+	}
+
+	void freeLarge (void *p)
+	{
+		const large_block *block = (const large_block *)((u8 *)p - object_cache::sc_HeaderSize);
+		const u32 order = u32(block->m_Order);
+
+		_InterlockedIncrement64(&s_LargeFrees);
+		_InterlockedDecrement64(&s_LargeBlocks);
+		_InterlockedExchangeAdd64(&s_LargeFrames, -(s64(1) << order));
+		s_Sink(block->m_Phys, order);
+	}
+}
+
+void Heap::init (object_cache::slab_source source, object_cache::slab_sink sink)
+{
+	s_Source = source;
+	s_Sink = sink;
+
+	s_Magazines.init("magazine", sizeof(object_cache::magazine), 64, source, sink, nullptr);
+
+	u32 c = 0;
+	for (u32 i = 0; i < sc_Classes; ++i)
+	{
+		s_Classes[i].init(sc_ClassNames[i], sc_ClassSizes[i], sc_ClassSizes[i] % 64 ? 16 : 64, source, sink, &s_Magazines);
+		for (; c <= (sc_ClassSizes[i] >> 4); ++c)
+			s_ClassOf[c] = u8(i);
+	}
+
+	s_LargeAllocs = 0;
+	s_LargeFrees = 0;
+	s_LargeFailures = 0;
+	s_LargeBlocks = 0;
+	s_LargeFrames = 0;
+}
+
+void * Heap::alloc (u32 cpu, u64 size)
+{
+	if (size > sc_MaxSmall)
+		return allocLarge(cpu, size);
+	return s_Classes[s_ClassOf[(size + 15) >> 4]].alloc(cpu);
+}
+
+void Heap::free (u32 cpu, void *p)
+{
+	if (!p)
+		return;
+
+	object_cache *cache = object_cache::cacheOf(p);
+	if (cache)
+		cache->free(cpu, p);
+	else
+		freeLarge(p);
+}
+
+void Heap::flush (u32 cpu)
+{
+	for (u32 i = 0; i < sc_Classes; ++i)
+		s_Classes[i].flush(cpu);
+}
+
+u32 Heap::reap (u32 cpu)
+{
+	// Magazines last: reaping the classes frees theirs.
+	u32 released = 0;
+	for (u32 i = 0; i < sc_Classes; ++i)
+		released += s_Classes[i].reap(cpu);
+	return released + s_Magazines.reap(cpu);
+}
+
+const object_cache & Heap::getCache (u32 index)
+{
+	return index < sc_Classes ? s_Classes[index] : s_Magazines;
+}
+
+Heap::large_stats Heap::getLargeStats ()
+{
+	large_stats st;
+	st.m_Allocs = u64(s_LargeAllocs);
+	st.m_Frees = u64(s_LargeFrees);
+	st.m_Failures = u64(s_LargeFailures);
+	st.m_Blocks = u64(s_LargeBlocks);
+	st.m_Frames = u64(s_LargeFrames);
+	return st;
+}
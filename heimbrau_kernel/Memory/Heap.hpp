@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "ObjectCache.hpp"
+
+// General purpose kernel heap: kmalloc () and kfree ().
+// Sizes up to sc_MaxSmall are rounded up to one of sc_Classes size classes, each an object_cache, so the common case
+// is a pop from the calling CPU's magazine with no lock taken. Anything larger is a whole buddy block of at least
+// object_cache::sc_SlabSize, with a header in front that kfree () tells apart from a slab by its null cache pointer.
+// Pointers are 16 byte aligned; class sizes that are multiples of 64 (and large blocks) are cache line aligned.
+// Same rule as the magazines: a CPU's heap state must not be used from an interrupt handler that can interrupt it.
+
+namespace Heap
+{
+	static const u32 sc_Classes = 14;
+	static const u64 sc_MaxSmall = 2048;
+	// Every class, then the cache the magazines come from.
+	static const u32 sc_Caches = sc_Classes + 1;
+
+	struct large_stats
+	{
+		u64	m_Allocs;
+		u64	m_Frees;
+		u64	m_Failures;
+		u64	m_Blocks;		// Blocks allocated right now
+		u64	m_Frames;		// ... and the 4 KiB frames they take
+	};
+
+	// Slabs and large blocks come from source and go back to sink.
+	void init (object_cache::slab_source source, object_cache::slab_sink sink);
+
+	// size bytes for the given CPU, or nullptr if memory ran out. A size of 0 still returns a distinct pointer.
+	void * alloc (u32 cpu, u64 size);
+	// Frees a pointer from alloc () on any CPU. nullptr is ignored.
+	void free (u32 cpu, void *p);
+
+	// Moves the CPU's magazines to the depots, for a CPU that is going away.
+	void flush (u32 cpu);
+	// Gives every depot's objects back to the slabs and every empty slab back to the sink. Returns the number of
+	// slabs released.
+	u32 reap (u32 cpu);
+
+	// Cache index, below sc_Caches.
+	const object_cache & getCache (u32 index);
+	large_stats getLargeStats ();
+}
+
+inline void * kmalloc (u64 size) { return Heap::alloc(native::cpu::index(), size); }
+inline void kfree (void *p) { Heap::free(native::cpu::index(), p); }
@@ -0,0 +1,122 @@
+#include "NodeAllocator.hpp"
+
+void node_allocator::init (const numa::topology *topology)
+{
+	m_Topology = topology;
+	native::mem::fillBytes(m_Nodes, 0, sizeof(m_Nodes));
+	for (u32 i = 0; i < numa::sc_MaxNodes; ++i)
+		m_Nodes[i].m_Lock.init();
+}
+
+void node_allocator::addNode (u32 node, buddy_allocator *buddy)
+{
+	m_Nodes[node].m_Buddy = buddy;
+}
+
+u64 node_allocator::alloc (u32 order, u32 node)
+{
+	const u32 *fallback = m_Topology->m_Fallback[node];
+
+	for (u32 i = 0; i < m_Topology->m_NodeCount; ++i)
+	{
+		struct node &n = m_Nodes[fallback[i]];
+		if (!n.m_Buddy)
+			continue;
+
+		u64 block;
+		{
+			scoped_lock _lock(n.m_Lock);
+			block = n.m_Buddy->alloc(order);
+		}
+
+		if (block != sc_NoBlock)
+		{
+			if (i == 0)
+				++m_Nodes[node].m_Stats.m_Local;
+			else
+				++m_Nodes[node].m_Stats.m_Remote;
+			return block;
+		}
+	}
+
+	++m_Nodes[node].m_Stats.m_Failures;
+	return sc_NoBlock;
+}
+
+void node_allocator::free (u64 phys, u32 order)
+{
+	struct node &n = m_Nodes[nodeOf(phys)];
+
+	scoped_lock _lock(n.m_Lock);
+	n.m_Buddy->free(phys, order);
+}
+
+u32 node_allocator::allocBatch (u32 node, u64 *frames, u32 count)
+{
+	const u32 batchOrder = native::lowestBit(count);
+	const u32 *fallback = m_Topology->m_Fallback[node];
+
+	u32 filled = 0;
+	for (u32 i = 0; i < m_Topology->m_NodeCount && filled < count; ++i)
+	{
+		struct node &n = m_Nodes[fallback[i]];
+		if (!n.m_Buddy)
+			continue;
+
+		const u32 before = filled;
+		{
+			scoped_lock _lock(n.m_Lock);
+
+			// One block for the whole batch if there is one, which is one list operation instead of count.
+			const u64 block = (filled == 0) ? n.m_Buddy->alloc(batchOrder) : sc_NoBlock;
+			if (block != sc_NoBlock)
+			{
+				// Stacked so the lowest frame comes out first.
+				for (u32 j = 0; j < count; ++j)
+					frames[j] = block + u64(count - 1 - j) * buddy_allocator::sc_FrameSize;
+				filled = count;
+			}
+			else
+			{
+				// Too fragmented for that, take what single frames there are.
+				while (filled < count)
+				{
+					const u64 frame = n.m_Buddy->alloc(0);
+					if (frame == sc_NoBlock)
+						break;
+					frames[filled++] = frame;
+				}
+			}
+		}
+
+		if (filled != before)
+		{
+			if (i == 0)
+				++m_Nodes[node].m_Stats.m_Local;
+			else
+				++m_Nodes[node].m_Stats.m_Remote;
+		}
+	}
+
+	if (filled == 0)
+		++m_Nodes[node].m_Stats.m_Failures;
+
+	return filled;
+}
+
+void node_allocator::freeBatch (const u64 *frames, u32 count)
+{
+	u32 i = 0;
+	while (i < count)
+	{
+		const u32 owner = nodeOf(frames[i]);
+		struct node &n = m_Nodes[owner];
+
+		scoped_lock _lock(n.m_Lock);
+		do
+		{
+			n.m_Buddy->free(frames[i], 0);
+			++i;
+		} while (i < count && nodeOf(frames[i]) == owner);
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "common/numa.hpp"
+#include "common/spinlock.hpp"
+
+#include "BuddyAllocator.hpp"
+
+// One buddy_allocator per NUMA node, each behind its own lock.
+// Allocations go to the requested node first, then to the others in the topology's distance order, so memory only
+// comes from a remote node once the local one is exhausted. Frees go back to whichever node owns the address.
+
+class node_allocator
+{
+public:
+	static const u64 sc_NoBlock = buddy_allocator::sc_NoBlock;
+
+	struct stats
+	{
+		u64	m_Local;		// Blocks handed out to a request for this node
+		u64	m_Remote;		// Blocks handed out to a request for another node
+		u64	m_Failures;		// Requests for this node that no node could satisfy
+	};
+
+	// topology must outlive the allocator. No node has memory until addNode () is called for it.
+	void init (const numa::topology *topology);
+
+	// Gives the node its pool. buddy must outlive the allocator.
+	void addNode (u32 node, buddy_allocator *buddy);
+
+	// Allocates a block of the given order, preferring the given node.
+	u64 alloc (u32 order, u32 node);
+	void free (u64 phys, u32 order);
+
+	// Allocates count single frames (a power of two, at most 1 << sc_MaxOrder) into frames, preferring the given
+	// node. Returns how many were allocated. Only one node's lock is taken per call where possible.
+	u32 allocBatch (u32 node, u64 *frames, u32 count);
+	// Frees count single frames, taking each node's lock once per run of frames from that node.
+	void freeBatch (const u64 *frames, u32 count);
+
+	// Node owning phys. Memory outside every SRAT range belongs to node 0.
+	u32 nodeOf (u64 phys) const
+	{
+		const u32 node = numa::nodeOf(*m_Topology, phys);
+		return (node == numa::sc_NoNode) ? 0 : node;
+	}
+
+	buddy_allocator * getBuddy (u32 node) const { return m_Nodes[node].m_Buddy; }
+	const stats & getStats (u32 node) const { return m_Nodes[node].m_Stats; }
+	u32 getNodeCount () const { return m_Topology->m_NodeCount; }
+
+private:
+	struct _align(64) node
+	{
+		buddy_allocator		*m_Buddy;	// nullptr for nodes without memory
+		spinlock			m_Lock;
+		stats				m_Stats;
+	};
+
+	node					m_Nodes[numa::sc_MaxNodes];
+	const numa::topology	*m_Topology;
+};
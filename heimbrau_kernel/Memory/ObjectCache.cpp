@@ -0,0 +1,466 @@
+#include "ObjectCache.hpp"
+
+#include "../Paging/Paging.hpp"
+
+// Header at the start of every slab.
+struct object_cache::slab
+{
+	object_cache	*m_Cache;		// First, for cacheOf ()
+	slab			*m_Prev;
+	slab			*m_Next;
+	void			*m_Free;		// Freed objects, linked through their first word
+	u32				m_InUse;
+	u32				m_Carved;		// Objects past this one have never been handed out, and are not on m_Free
+	u64				m_Phys;
+};
+
+namespace
+{
+	// Empty slabs kept per cache, so a cache that hovers around a slab boundary doesn't go to the source every time.
+	const u64 sc_KeepEmpty = 1;
+
+	template <class T>
+	inline void pushFront (T *&list, T *item)
+	{
+		item->m_Prev = nullptr;
+		item->m_Next = list;
+		if (list)
+			list->m_Prev = item;
+		list = item;
+	}
+
+	template <class T>
+	inline void unlink (T *&list, T *item)
+	{
+		if (item->m_Prev)
+			item->m_Prev->m_Next = item->m_Next;
+		else
+			list = item->m_Next;
+		if (item->m_Next)
+			item->m_Next->m_Prev = item->m_Prev;
+	}
+
+	// Depot lists, with the depot lock held.
+	inline object_cache::magazine * takeMagazine (object_cache::magazine *&list, u64 &count)
+	{
+		object_cache::magazine *m = list;
+		if (m)
+		{
+			list = m->m_Next;
+			--count;
+		}
+		return m;
+	}
+
+	inline void putMagazine (object_cache::magazine *&list, u64 &count, object_cache::magazine *m)
+	{
+		m->m_Next = list;
+		list = m;
+		++count;
+	}
+
+	inline void swap (object_cache::magazine *&a, object_cache::magazine *&b)
+	{
+		object_cache::magazine *t = a;
+		a = b;
+		b = t;
+	}
+}
+
+void object_cache::init (const char *name, u64 size, u32 align, slab_source source, slab_sink sink, object_cache *magazines)
+{
+	static_assert(sizeof(slab) <= sc_HeaderSize, "The slab header must fit in front of the objects");
+
+	if (align < sc_MinAlign)
+		align = sc_MinAlign;
+
+	m_Name = name;
+	m_Size = (size + align - 1) & ~u64(align - 1);
+	m_SlabCapacity = u32((sc_SlabSize - sc_HeaderSize) / m_Size);
+	m_Source = source;
+	m_Sink = sink;
+	m_Magazines = magazines;
+
+	// A magazine holds at most a slab's worth, or large objects pile up unused on every CPU.
+	m_Rounds = m_SlabCapacity < sc_MagazineRounds ? m_SlabCapacity : sc_MagazineRounds;
+
+	native::mem::fillBytes(m_CPUs, 0, sizeof(m_CPUs));
+	native::mem::fillBytes(&m_Depot, 0, sizeof(depot));
+	native::mem::fillBytes(&m_SlabLayer, 0, sizeof(slab_layer));
+	m_Depot.m_Lock.init();
+	m_SlabLayer.m_Lock.init();
+}
+
+object_cache::slab * object_cache::growSlabs (u32 cpu)
+{
+	const u64 phys = m_Source(cpu, sc_SlabOrder);
+	if (phys == sc_NoSlab)
+		return nullptr;
+
+	slab *s = (slab *)Paging::phys_to_virt(phys);
+	s->m_Cache = this;
+	s->m_Free = nullptr;
+	s->m_InUse = 0;
+	s->m_Carved = 0;
+	s->m_Phys = phys;
+
+	pushFront(m_SlabLayer.m_Empty, s);
+	++m_SlabLayer.m_Slabs;
+	++m_SlabLayer.m_EmptySlabs;
+	++m_SlabLayer.m_SlabAllocs;
+	return s;
+}
+
+void object_cache::releaseSlab (slab *s)
+{
+	unlink(m_SlabLayer.m_Empty, s);
+	--m_SlabLayer.m_Slabs;
+	--m_SlabLayer.m_EmptySlabs;
+	++m_SlabLayer.m_SlabFrees;
+	m_Sink(s->m_Phys, sc_SlabOrder);
+}
+
+u32 object_cache::allocObjects (u32 cpu, void **objects, u32 count)
+{
+	scoped_lock _lock(m_SlabLayer.m_Lock);
+
+	u32 done = 0;
+	while (done < count)
+	{
+		// Partial slabs first, so empty ones stay empty and can be given back.
+		slab *s = m_SlabLayer.m_Partial;
+		if (!s)
+		{
+			s = m_SlabLayer.m_Empty ? m_SlabLayer.m_Empty : growSlabs(cpu);
+			if (!s)
+				break;
+			unlink(m_SlabLayer.m_Empty, s);
+			--m_SlabLayer.m_EmptySlabs;
+			pushFront(m_SlabLayer.m_Partial, s);
+		}
+
+		// As many as this slab can give.
+		while (done < count && s->m_InUse < m_SlabCapacity)
+		{
+			void *object = s->m_Free;
+			if (object)
+				s->m_Free = *(void **)object;
+			else
+				object = (u8 *)s + sc_HeaderSize + u64(s->m_Carved++) * m_Size;
+
+			objects[done++] = object;
+			++s->m_InUse;
+		}
+
+		if (s->m_InUse == m_SlabCapacity)
+			unlink(m_SlabLayer.m_Partial, s);
+	}
+
+	m_SlabLayer.m_Allocated += done;
+	return done;
+}
+
+void object_cache::freeObject (void *object)
+{
+	slab *s = (slab *)(u64(object) & ~(sc_SlabSize - 1));
+
+	*(void **)object = s->m_Free;
+	s->m_Free = object;
+
+	if (s->m_InUse-- == m_SlabCapacity)
+		pushFront(m_SlabLayer.m_Partial, s);
+
+	if (s->m_InUse == 0)
+	{
+		unlink(m_SlabLayer.m_Partial, s);
+		pushFront(m_SlabLayer.m_Empty, s);
+		if (++m_SlabLayer.m_EmptySlabs > sc_KeepEmpty)
+			releaseSlab(s);
+	}
+
+	--m_SlabLayer.m_Allocated;
+}
+
+void object_cache::freeObjects (void * const *objects, u32 count)
+{
+	scoped_lock _lock(m_SlabLayer.m_Lock);
+
+	for (u32 i = 0; i < count; ++i)
+		freeObject(objects[i]);
+}
+
+object_cache::magazine * object_cache::newMagazine (u32 cpu)
+{
+	magazine *m = (magazine *)m_Magazines->alloc(cpu);
+	if (m)
+	{
+		m->m_Next = nullptr;
+		m->m_Rounds = 0;
+	}
+	return m;
+}
+
+void object_cache::deleteMagazine (u32 cpu, magazine *m)
+{
+	m_Magazines->free(cpu, m);
+}
+
+void * object_cache::alloc (u32 cpu)
+{
+	cpu_cache &c = m_CPUs[cpu];
+
+	void *object = nullptr;
+	if (!m_Magazines)
+	{
+		if (allocObjects(cpu, &object, 1) == 0)
+		{
+			++c.m_Failures;
+			return nullptr;
+		}
+		++c.m_Allocs;
+		return object;
+	}
+
+	if (c.m_Loaded && c.m_Loaded->m_Rounds != 0)
+	{
+		++c.m_Allocs;
+		++c.m_Hits;
+		return c.m_Loaded->m_Objects[--c.m_Loaded->m_Rounds];
+	}
+
+	if (c.m_Previous && c.m_Previous->m_Rounds != 0)
+	{
+		swap(c.m_Loaded, c.m_Previous);
+		++c.m_Allocs;
+		++c.m_Hits;
+		return c.m_Loaded->m_Objects[--c.m_Loaded->m_Rounds];
+	}
+
+	// Both empty. Trade the previous one for a full one from the depot.
+	magazine *full;
+	{
+		scoped_lock _lock(m_Depot.m_Lock);
+		full = takeMagazine(m_Depot.m_Full, m_Depot.m_FullCount);
+		if (full)
+		{
+			if (c.m_Previous)
+				putMagazine(m_Depot.m_Empty, m_Depot.m_EmptyCount, c.m_Previous);
+			++m_Depot.m_Hits;
+		}
+		else
+		{
+			++m_Depot.m_Misses;
+		}
+	}
+
+	if (full)
+	{
+		c.m_Previous = c.m_Loaded;
+		c.m_Loaded = full;
+	}
+	else
+	{
+		// Nothing to trade: fill the loaded magazine from the slabs in one go, or get just the one object if
+		// there is no magazine to fill.
+		if (!c.m_Loaded)
+			c.m_Loaded = newMagazine(cpu);
+
+		if (c.m_Loaded)
+			c.m_Loaded->m_Rounds = allocObjects(cpu, c.m_Loaded->m_Objects, m_Rounds);
+		else if (allocObjects(cpu, &object, 1) != 0)
+		{
+			++c.m_Allocs;
+			return object;
+		}
+
+		if (!c.m_Loaded || c.m_Loaded->m_Rounds == 0)
+		{
+			++c.m_Failures;
+			return nullptr;
+		}
+	}
+
+	++c.m_Allocs;
+	return c.m_Loaded->m_Objects[--c.m_Loaded->m_Rounds];
+}
+
+void object_cache::free (u32 cpu, void *object)
+{
+	cpu_cache &c = m_CPUs[cpu];
+	++c.m_Frees;
+
+	if (!m_Magazines)
+	{
+		freeObjects(&object, 1);
+		return;
+	}
+
+	if (c.m_Loaded && c.m_Loaded->m_Rounds < m_Rounds)
+	{
+		++c.m_Hits;
+		c.m_Loaded->m_Objects[c.m_Loaded->m_Rounds++] = object;
+		return;
+	}
+
+	if (c.m_Previous && c.m_Previous->m_Rounds < m_Rounds)
+	{
+		swap(c.m_Loaded, c.m_Previous);
+		++c.m_Hits;
+		c.m_Loaded->m_Objects[c.m_Loaded->m_Rounds++] = object;
+		return;
+	}
+
+	// Both full (or missing). Trade the previous one for an empty one from the depot, or a new one.
+	magazine *empty;
+	{
+		scoped_lock _lock(m_Depot.m_Lock);
+		empty = takeMagazine(m_Depot.m_Empty, m_Depot.m_EmptyCount);
+		if (empty)
+		{
+			if (c.m_Previous)
+				putMagazine(m_Depot.m_Full, m_Depot.m_FullCount, c.m_Previous);
+			++m_Depot.m_Hits;
+		}
+		else
+		{
+			++m_Depot.m_Misses;
+		}
+	}
+
+	if (!empty)
+	{
+		empty = newMagazine(cpu);
+		if (!empty)
+		{
+			// No memory for a magazine, so straight back to the slab.
+			freeObjects(&object, 1);
+			return;
+		}
+
+		if (c.m_Previous)
+		{
+			scoped_lock _lock(m_Depot.m_Lock);
+			putMagazine(m_Depot.m_Full, m_Depot.m_FullCount, c.m_Previous);
+		}
+	}
+
+	c.m_Previous = c.m_Loaded;
+	c.m_Loaded = empty;
+	c.m_Loaded->m_Objects[c.m_Loaded->m_Rounds++] = object;
+}
+
+void object_cache::flush (u32 cpu)
+{
+	cpu_cache &c = m_CPUs[cpu];
+	magazine *mags[2] = { c.m_Loaded, c.m_Previous };
+	c.m_Loaded = nullptr;
+	c.m_Previous = nullptr;
+
+	scoped_lock _lock(m_Depot.m_Lock);
+	for (u32 i = 0; i < 2; ++i)
+	{
+		if (!mags[i])
+			continue;
+		if (mags[i]->m_Rounds != 0)
+			putMagazine(m_Depot.m_Full, m_Depot.m_FullCount, mags[i]);
+		else
+			putMagazine(m_Depot.m_Empty, m_Depot.m_EmptyCount, mags[i]);
+	}
+}
+
+u32 object_cache::reap (u32 cpu)
+{
+	magazine *full;
+	magazine *empty;
+	{
+		scoped_lock _lock(m_Depot.m_Lock);
+		full = m_Depot.m_Full;
+		empty = m_Depot.m_Empty;
+		m_Depot.m_Full = nullptr;
+		m_Depot.m_Empty = nullptr;
+		m_Depot.m_FullCount = 0;
+		m_Depot.m_EmptyCount = 0;
+	}
+
+	while (full)
+	{
+		magazine *next = full->m_Next;
+		freeObjects(full->m_Objects, full->m_Rounds);
+		deleteMagazine(cpu, full);
+		full = next;
+	}
+	while (empty)
+	{
+		magazine *next = empty->m_Next;
+		deleteMagazine(cpu, empty);
+		empty = next;
+	}
+
+	scoped_lock _lock(m_SlabLayer.m_Lock);
+	u32 released = 0;
+	while (m_SlabLayer.m_Empty)
+	{
+		releaseSlab(m_SlabLayer.m_Empty);
+		++released;
+	}
+	return released;
+}
+
+object_cache::stats object_cache::getStats () const
+{
+	stats st;
+	native::mem::fillBytes(&st, 0, sizeof(stats));
+
+	// Other CPUs' counters are read without their owners stopping, so the totals are only as exact as that allows.
+	for (u32 i = 0; i < native::cpu::sc_MaxCPUs; ++i)
+	{
+		const cpu_cache &c = m_CPUs[i];
+		st.m_Allocs += c.m_Allocs;
+		st.m_Frees += c.m_Frees;
+		st.m_Hits += c.m_Hits;
+		st.m_Failures += c.m_Failures;
+		if (c.m_Loaded)
+			st.m_Cached += c.m_Loaded->m_Rounds;
+		if (c.m_Previous)
+			st.m_Cached += c.m_Previous->m_Rounds;
+	}
+
+	{
+		scoped_lock _lock(const_cast<spinlock &>(m_Depot.m_Lock));
+		for (const magazine *m = m_Depot.m_Full; m; m = m->m_Next)
+			st.m_Cached += m->m_Rounds;
+		st.m_DepotHits = m_Depot.m_Hits;
+		st.m_DepotMisses = m_Depot.m_Misses;
+		st.m_DepotFull = m_Depot.m_FullCount;
+		st.m_DepotEmpty = m_Depot.m_EmptyCount;
+	}
+
+	{
+		scoped_lock _lock(const_cast<spinlock &>(m_SlabLayer.m_Lock));
+		st.m_Slabs = m_SlabLayer.m_Slabs;
+		st.m_EmptySlabs = m_SlabLayer.m_EmptySlabs;
+		st.m_SlabAllocs = m_SlabLayer.m_SlabAllocs;
+		st.m_SlabFrees = m_SlabLayer.m_SlabFrees;
+		st.m_Allocated = m_SlabLayer.m_Allocated;
+	}
+	st.m_Capacity = st.m_Slabs * m_SlabCapacity;
+
+	return st;
+}
+
+u32 object_cache::utilization (const stats &st)
+{
+	if (st.m_Capacity == 0)
+		return 0;
+	const u64 live = st.m_Allocated > st.m_Cached ? st.m_Allocated - st.m_Cached : 0;
+	return u32((live * 1000) / st.m_Capacity);
+}
+
+u32 object_cache::fragmentation (const stats &st)
+{
+	if (st.m_Capacity == 0)
+		return 0;
+	const u64 emptyRoom = st.m_EmptySlabs * (st.m_Capacity / st.m_Slabs);
+	const u64 free = st.m_Capacity - st.m_Allocated;
+	return u32(((free > emptyRoom ? free - emptyRoom : 0) * 1000) / st.m_Capacity);
+}
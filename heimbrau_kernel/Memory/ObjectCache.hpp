@@ -0,0 +1,163 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "common/spinlock.hpp"
+
+// Slab allocator for objects of one size, with per-CPU magazines in front of it.
+// Three layers, each only reached when the one above it can't help:
+//	CPU		- two magazines (stacks of free objects) per CPU, loaded and previous. alloc () pops from loaded, free ()
+//			  pushes onto it, and when loaded runs dry or fills up the two are swapped. No lock, no atomics.
+//	depot	- full and empty magazines shared by every CPU, behind a lock. A CPU whose magazines are both empty
+//			  trades one for a full one, and one whose magazines are both full trades one for an empty one, so objects
+//			  freed on one CPU flow to the CPUs allocating them a magazine at a time.
+//	slabs	- sc_SlabSize blocks from the frame source, carved into objects on a free list, behind a second lock. Only
+//			  used when the depot has nothing to trade: a whole magazine is filled or emptied at once.
+// Every layer above the slabs holds objects the slabs count as allocated. flush () and then reap () hand them back.
+// A CPU's magazines must only be used by that CPU, and not from an interrupt handler that can interrupt it.
+// Objects are reached through Paging::phys_to_virt.
+
+class object_cache
+{
+public:
+	// Slabs are buddy blocks of this order, so they are aligned to their size and an object's slab is its address
+	// rounded down.
+	static const u32 sc_SlabOrder = 2;
+	static const u64 sc_SlabSize = 0x1000ULL << sc_SlabOrder;
+	// The slab header, at the start of every slab.
+	static const u64 sc_HeaderSize = 64;
+	static const u32 sc_MinAlign = 16;
+	static const u64 sc_MaxObjectSize = (sc_SlabSize - sc_HeaderSize) / 4;
+	// Rounds a magazine can hold. Caches of large objects use fewer, so fewer of them sit idle on each CPU.
+	static const u32 sc_MagazineRounds = 30;
+	static const u64 sc_NoSlab = ~0ULL;
+
+	// Where slabs come from and go back to, as blocks of the given order. The source returns sc_NoSlab when out of
+	// memory.
+	typedef u64 (*slab_source) (u32 cpu, u32 order);
+	typedef void (*slab_sink) (u64 phys, u32 order);
+
+	// A stack of free objects.
+	struct magazine
+	{
+		magazine	*m_Next;		// Depot list link
+		u32			m_Rounds;
+		u32			m_Reserved;
+		void		*m_Objects[sc_MagazineRounds];
+	};
+
+	struct stats
+	{
+		u64	m_Allocs;		// alloc () calls that returned an object
+		u64	m_Frees;
+		u64	m_Hits;			// Calls served by the CPU's own magazines
+		u64	m_DepotHits;	// Magazines traded with the depot
+		u64	m_DepotMisses;	// Times the depot had nothing to trade and the slabs were used
+		u64	m_Failures;		// alloc () calls that found no memory
+
+		u64	m_Slabs;		// Slabs held right now
+		u64	m_EmptySlabs;	// ... of which every object is free
+		u64	m_SlabAllocs;	// Slabs ever taken from the source
+		u64	m_SlabFrees;	// Slabs ever given back to the sink
+		u64	m_Capacity;		// Objects the slabs held have room for
+		u64	m_Allocated;	// Objects allocated from the slabs, including those cached below
+		u64	m_Cached;		// Objects sitting in CPU and depot magazines
+		u64	m_DepotFull;	// Magazines in the depot
+		u64	m_DepotEmpty;
+	};
+
+	// size is rounded up to align, a power of two from sc_MinAlign to sc_HeaderSize, and must then be at most
+	// sc_MaxObjectSize. magazines is the cache the magazines themselves come from; nullptr turns the magazine layers
+	// off (as they must be for that cache), leaving just the slabs. name must outlive the cache.
+	void init (const char *name, u64 size, u32 align, slab_source source, slab_sink sink, object_cache *magazines);
+
+	// An object for the given CPU, or nullptr if the source is out of memory.
+	void * alloc (u32 cpu);
+	// Frees an object from any CPU's alloc ().
+	void free (u32 cpu, void *object);
+
+	// Moves the CPU's magazines to the depot, so nothing stays cached for a CPU that is going away.
+	void flush (u32 cpu);
+	// Gives every object in the depot back to its slab and every empty slab back to the sink. Returns the number of
+	// slabs released.
+	u32 reap (u32 cpu);
+
+	const char * getName () const { return m_Name; }
+	u64 getSize () const { return m_Size; }
+	u32 getSlabCapacity () const { return m_SlabCapacity; }
+
+	stats getStats () const;
+
+	// Objects handed out and not freed, per 1000 objects the slabs have room for.
+	static u32 utilization (const stats &st);
+	// Free room in slabs that are still partly in use, per 1000 objects the slabs have room for: memory that only
+	// comes back once the rest of its slab is freed. Cached objects and empty slabs don't count, reap () frees those.
+	static u32 fragmentation (const stats &st);
+
+	// The cache an object from alloc () belongs to. Blocks that don't come from an object_cache can start with a
+	// null pointer to be told apart.
+	static object_cache * cacheOf (const void *object)
+	{
+		return *(object_cache * const *)(u64(object) & ~(sc_SlabSize - 1));
+	}
+
+private:
+	struct slab;
+
+	// One per CPU, on its own cache line so CPUs never share a written line.
+	struct _align(64) cpu_cache
+	{
+		magazine	*m_Loaded;
+		magazine	*m_Previous;
+		u64			m_Allocs;
+		u64			m_Frees;
+		u64			m_Hits;
+		u64			m_Failures;
+	};
+
+	// Slab layer. allocObjects and freeObjects take m_SlabLayer.m_Lock, the rest expect it held.
+	u32 allocObjects (u32 cpu, void **objects, u32 count);
+	void freeObjects (void * const *objects, u32 count);
+	void freeObject (void *object);
+	slab * growSlabs (u32 cpu);
+	void releaseSlab (slab *s);
+
+	magazine * newMagazine (u32 cpu);
+	void deleteMagazine (u32 cpu, magazine *m);
+
+	// Magazines shared by every CPU.
+	struct _align(64) depot
+	{
+		spinlock	m_Lock;
+		magazine	*m_Full;
+		magazine	*m_Empty;
+		u64			m_FullCount;
+		u64			m_EmptyCount;
+		u64			m_Hits;
+		u64			m_Misses;
+	};
+
+	struct _align(64) slab_layer
+	{
+		spinlock	m_Lock;
+		slab		*m_Partial;		// Slabs with some objects free, the most recently used first
+		slab		*m_Empty;		// Slabs with every object free
+		u64			m_Slabs;
+		u64			m_EmptySlabs;
+		u64			m_SlabAllocs;
+		u64			m_SlabFrees;
+		u64			m_Allocated;
+	};
+
+	cpu_cache		m_CPUs[native::cpu::sc_MaxCPUs];
+	depot			m_Depot;
+	slab_layer		m_SlabLayer;
+
+	const char		*m_Name;
+	u64				m_Size;
+	u32				m_SlabCapacity;
+	u32				m_Rounds;
+	slab_source		m_Source;
+	slab_sink		m_Sink;
+	object_cache	*m_Magazines;
+};
@@ -0,0 +1,233 @@
+#include "common.hpp"
+
+#include "..\..\heimbrau_asm\hb_asm.hpp"
+
+#include "AddressSpace.hpp"
+#include "PageTable.hpp"
+
+namespace
+{
+	// CR4 bits
+	const u64 sc_CR4PGE = 1ULL << 7;	// Global pages
+	const u64 sc_CR4PCIDE = 1ULL << 17;	// Process-context identifiers
+
+	const u32 sc_NoSlot = ~0U;
+
+	// A CPU's PCIDs. Slot i is PCID i + 1, owned by the address space with ID m_Owner[i] (0 if none), last used at
+	// m_LastUse[i] by this CPU's own clock. Only ever touched by the CPU it belongs to, so each starts a cache line.
+	struct _align(64) pcid_cache
+	{
+		u64	m_Owner[Paging::sc_PCIDSlots];
+		u64	m_LastUse[Paging::sc_PCIDSlots];
+		u64	m_Clock;
+		u64	m_Current;	// ID of the current address space, 0 before the first switch
+	};
+
+	pcid_cache s_Caches[native::cpu::sc_MaxCPUs];
+
+	volatile s64 s_NextID = 0;
+	volatile s64 s_OnlineCPUs = 0;
+
+	bool s_GlobalPages = false;
+	bool s_PCIDs = false;
+	bool s_INVPCID = false;
+
+	inline pcid_cache & local () { return s_Caches[native::cpu::index()]; }
+
+	u32 findSlot (const pcid_cache &c, u64 id)
+	{
+		for (u32 i = 0; i < Paging::sc_PCIDSlots; ++i)
+		{
+			if (c.m_Owner[i] == id)
+				return i;
+		}
+		return sc_NoSlot;
+	}
+
+	// Least recently used slot. Free slots have never been used, so they go first.
+	u32 victimSlot (const pcid_cache &c)
+	{
+		u32 victim = 0;
+		for (u32 i = 1; i < Paging::sc_PCIDSlots; ++i)
+		{
+			if (c.m_LastUse[i] < c.m_LastUse[victim])
+				victim = i;
+		}
+		return victim;
+	}
+
+	inline u32 pcidOf (u32 slot) { return slot + 1; }
+}
+
+void Paging::initTLB ()
+{
+	const native::cpu::features &cpu = native::cpu::get();
+
+	// The PCID caches are per cpu::index (). A CPU sharing its index with one already online would share its cache,
+	// find PCIDs the other CPU assigned and load CR3 without flushing translations it never flushed. Stop it before it
+	// turns anything on.
+	const s64 self = s64(1ULL << native::cpu::index());
+	if (_InterlockedOr64(&s_OnlineCPUs, self) & self)
+		native::stop();
+
+	u64 cr4 = native::readCR(4);
+	if (cpu.m_PGE)
+		cr4 |= sc_CR4PGE;
+	if (cpu.m_PCID)
+	{
+		// PCIDE can only be set while CR3 holds PCID 0. PCD and PWT share those bits, and we never set them.
+		native::writeCR(3, native::readCR(3) & sc_AddressMask);
+		cr4 |= sc_CR4PCIDE;
+	}
+	native::writeCR(4, cr4);
+
+	s_GlobalPages = cpu.m_PGE;
+	s_PCIDs = cpu.m_PCID;
+	s_INVPCID = cpu.m_PCID && cpu.m_INVPCID;
+
+	native::mem::fillBytes(&local(), 0, sizeof(pcid_cache));
+}
+
+bool Paging::globalPages () { return s_GlobalPages; }
+bool Paging::pcids () { return s_PCIDs; }
+bool Paging::invpcid () { return s_INVPCID; }
+u64 Paging::onlineCPUs () { return u64(s_OnlineCPUs); }
+
+void Paging::initAddressSpace (address_space &as, u64 pml4)
+{
+	as.m_PML4 = pml4 & sc_AddressMask;
+	as.m_ID = u64(_InterlockedIncrement64(&s_NextID));
+	as.m_CPUs = 0;
+}
+
+void Paging::switchTo (address_space &as)
+{
+	// With interrupts off, so no shootdown is handled halfway through: one that saw as current before CR3 held it
+	// would invlpg under the old PCID, and one that forgot as's slot after we chose to keep it would be undone by the
+	// CR3 write. Shootdowns that arrive meanwhile wait, and see the switch done.
+	const u64 flags = native::readFlags();
+	native::cli();
+
+	pcid_cache &c = local();
+
+	// Before CR3, so shootdowns for as reach this CPU from now on.
+	const s64 self = s64(1ULL << native::cpu::index());
+	if (!(as.m_CPUs & self))
+		_InterlockedOr64(&as.m_CPUs, self);
+
+	if (!s_PCIDs)
+	{
+		native::loadPT((const void *)as.m_PML4);
+	}
+	else
+	{
+		u32 slot = findSlot(c, as.m_ID);
+		const bool keep = slot != sc_NoSlot;
+		if (!keep)
+		{
+			// The slot's PCID may still tag the previous owner's translations, so it is loaded with a flush.
+			slot = victimSlot(c);
+			c.m_Owner[slot] = as.m_ID;
+		}
+		c.m_LastUse[slot] = ++c.m_Clock;
+
+		native::loadPT(as.m_PML4, pcidOf(slot), keep);
+	}
+
+	// Only once CR3 holds it.
+	c.m_Current = as.m_ID;
+
+	native::writeFlags(flags);
+}
+
+void Paging::invalidatePage (const address_space &as, u64 virt)
+{
+	pcid_cache &c = local();
+	if (c.m_Current == as.m_ID)
+	{
+		native::invlpg((void *)virt);
+		return;
+	}
+
+	// Without PCIDs, switching to as will flush everything anyway.
+	if (!s_PCIDs)
+		return;
+
+	const u32 slot = findSlot(c, as.m_ID);
+	if (slot == sc_NoSlot)
+		return;
+
+	if (s_INVPCID)
+	{
+		native::invpcid(native::e_InvPCIDAddress, pcidOf(slot), virt);
+	}
+	else
+	{
+		// Forget the PCID, so the next switch to as flushes it.
+		c.m_Owner[slot] = 0;
+		c.m_LastUse[slot] = 0;
+	}
+}
+
+void Paging::invalidateAddressSpace (const address_space &as)
+{
+	pcid_cache &c = local();
+	const u32 slot = s_PCIDs ? findSlot(c, as.m_ID) : sc_NoSlot;
+
+	if (c.m_Current == as.m_ID)
+	{
+		if (slot == sc_NoSlot)
+			native::loadPT((const void *)as.m_PML4);
+		else if (s_INVPCID)
+			native::invpcid(native::e_InvPCIDContext, pcidOf(slot), 0);
+		else
+			native::loadPT(as.m_PML4, pcidOf(slot), false);
+		return;
+	}
+
+	if (slot == sc_NoSlot)
+		return;
+
+	if (s_INVPCID)
+	{
+		native::invpcid(native::e_InvPCIDContext, pcidOf(slot), 0);
+	}
+	else
+	{
+		c.m_Owner[slot] = 0;
+		c.m_LastUse[slot] = 0;
+	}
+}
+
+void Paging::invalidateAll ()
+{
+	if (s_INVPCID)
+	{
+		native::invpcid(native::e_InvPCIDAllGlobal, 0, 0);
+	}
+	else if (s_GlobalPages)
+	{
+		// Toggling PGE flushes every translation, global or not, under every PCID.
+		const u64 cr4 = native::readCR(4);
+		native::writeCR(4, cr4 & ~sc_CR4PGE);
+		native::writeCR(4, cr4);
+	}
+	else
+	{
+		// No global pages to worry about, but a CR3 write only flushes the PCID it loads. Forget the others.
+		pcid_cache &c = local();
+		const u64 cr3 = native::readCR(3);
+		if (s_PCIDs)
+		{
+			for (u32 i = 0; i < sc_PCIDSlots; ++i)
+			{
+				if (pcidOf(i) != (cr3 & 0xFFF))
+				{
+					c.m_Owner[i] = 0;
+					c.m_LastUse[i] = 0;
+				}
+			}
+		}
+		native::writeCR(3, cr3 & ~(1ULL << 63));
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.hpp"
+
+// Address space switches that keep the TLB warm.
+// Kernel mappings are global (sc_Global, CR4.PGE), so no CR3 write ever flushes them. With CR4.PCIDE, every CPU
+// also keeps the translations of its sc_PCIDSlots most recently used address spaces, each tagged with its own PCID,
+// and switching back to one of them loads CR3 with the no-flush bit set. PCID 0 is never handed out: it is what CR3
+// runs with before the first switch (the loader's tables).
+// Without PCIDs everything still works; a switch then flushes all non-global translations, as CR3 writes always did.
+//
+// PCIDs are per-CPU and an address space gets one lazily on each CPU it runs on, so nothing has to be freed when an
+// address space goes away: its ID is never reused, and its slots are recycled (and flushed) like any other.
+// The invalidate functions only act on the calling CPU. tlb_batch (TLB.hpp) batches them and reaches the others.
+
+namespace Paging
+{
+	// PCIDs per CPU, 1 to sc_PCIDSlots.
+	static const u32 sc_PCIDSlots = 8;
+
+	struct address_space
+	{
+		u64		m_PML4;		// Physical address of the PML4
+		u64		m_ID;		// Unique, never reused. 0 is never a valid ID.
+		// CPUs that have switched to it, and so may have its translations cached. Bits are never cleared.
+		volatile s64	m_CPUs;
+	};
+
+	// Enables global pages and PCIDs on the calling CPU, as far as it supports them.
+	// Call once on every CPU, after cpu::setIndex () and before it first switches address spaces, with CR3 pointing at
+	// its first tables. A CPU whose index is already online is halted.
+	void initTLB ();
+
+	// Whether initTLB () enabled global pages / PCIDs / INVPCID. The same on every CPU.
+	bool globalPages ();
+	bool pcids ();
+	bool invpcid ();
+
+	// CPUs that have run initTLB (), one bit per cpu::index ().
+	u64 onlineCPUs ();
+
+	// Gives the address space a fresh ID and no CPUs. The PML4 is not touched.
+	void initAddressSpace (address_space &as, u64 pml4);
+
+	// Makes as the current address space of the calling CPU. Kernel translations survive, and so do as's own if
+	// this CPU still has them under a PCID. Runs with interrupts off, and restores the interrupt flag it found.
+	void switchTo (address_space &as);
+
+	// Drops a single page of as from the calling CPU's TLB. as does not have to be current.
+	void invalidatePage (const address_space &as, u64 virt);
+
+	// Drops every non-global translation of as from the calling CPU's TLB. as does not have to be current.
+	void invalidateAddressSpace (const address_space &as);
+
+	// Drops everything from the calling CPU's TLB, global kernel translations included. Needed after changing
+	// kernel mappings.
+	void invalidateAll ();
+}
@@ -0,0 +1,298 @@
+#include "common.hpp"
+
+#include "..\..\heimbrau_asm\hb_asm.hpp"
+
+#include "common/spinlock.hpp"
+
+#include "Demand.hpp"
+#include "Paging.hpp"
+#include "TLB.hpp"
+#include "..\Interrupts\IDT.hpp"
+
+namespace
+{
+	// #PF error code bits
+	enum
+	{
+		e_FaultPresent	= 1 << 0,	// The page was present: a protection violation, not a missing page
+		e_FaultWrite	= 1 << 1,
+		e_FaultUser		= 1 << 2,
+		e_FaultReserved	= 1 << 3,
+		e_FaultFetch	= 1 << 4,
+	};
+
+	struct lazy_region
+	{
+		u64	m_Start;
+		u64	m_End;
+		u64	m_Flags;
+		u64	m_FaultAround;		// Bytes, a power of two
+	};
+
+	// Sorted by m_Start, never overlapping.
+	lazy_region s_Regions[Paging::sc_MaxLazyRegions];
+	u32 s_RegionCount = 0;
+	spinlock s_Lock = { 0 };
+
+	Paging::frame_allocator s_Alloc = nullptr;
+	Paging::frame_freer s_Free = nullptr;
+	table_pool *s_Tables = nullptr;
+
+	Paging::map_stats s_MapStats;
+	Paging::demand_stats s_Stats;
+
+	const u64 sc_NoFrame = ~0ULL;
+	const u64 sc_Page = Paging::e_Page4K;
+	// End of the list of tables release () unmapped. Page aligned, so the link is never a present entry to a CPU that
+	// still walks a stale table.
+	const u64 sc_LastTable = ~(sc_Page - 1);
+
+	// Tables emptied by the unmap in progress, linked through their first word. Only touched under s_Lock.
+	u64 s_DeadTables = sc_LastTable;
+
+	// Holds s_Lock with interrupts off: the #PF handler takes it too, and would spin forever on a CPU it interrupted
+	// while that CPU held it.
+	class demand_lock
+	{
+		u64		m_Flags;
+
+		demand_lock & operator = (const demand_lock &);
+	public:
+		demand_lock () : m_Flags(native::readFlags()) { native::cli(); s_Lock.lock(); }
+		~demand_lock () { s_Lock.unlock(); native::writeFlags(m_Flags); }
+	};
+
+	// table_freer for release (): the table may still be in another CPU's paging-structure caches, so it only goes back
+	// to the pool after the flush.
+	void deferTable (u64 phys)
+	{
+		*(u64 *)Paging::phys_to_virt(phys) = s_DeadTables;
+		s_DeadTables = phys;
+	}
+
+	// Index of the region holding virt, or s_RegionCount.
+	u32 findRegion (u64 virt)
+	{
+		u32 lo = 0;
+		u32 hi = s_RegionCount;
+		while (lo < hi)
+		{
+			const u32 mid = (lo + hi) / 2;
+			if (s_Regions[mid].m_End <= virt)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return (lo < s_RegionCount && s_Regions[lo].m_Start <= virt) ? lo : s_RegionCount;
+	}
+
+	inline u64 currentPML4 () { return native::readCR(3) & Paging::sc_AddressMask; }
+
+	// Maps a zeroed frame at virt. The faulting page is about to be used, so it is zeroed through the cache; its
+	// neighbours may not be touched for a while, so they are not.
+	bool installPage (u64 pml4, u64 virt, u64 flags, bool hot)
+	{
+		const u64 phys = s_Alloc();
+		if (phys == sc_NoFrame)
+			return false;
+
+		if (hot)
+			native::memset_16(Paging::phys_to_virt(phys), 0ULL, sc_Page);
+		else
+			native::mem::zeroPages(Paging::phys_to_virt(phys), sc_Page);
+
+		if (!Paging::mapRange(pml4, virt, phys, sc_Page, flags, Paging::e_Page4K, *s_Tables, s_MapStats))
+		{
+			s_Free(phys);
+			return false;
+		}
+		++s_Stats.m_Pages;
+		return true;
+	}
+}
+
+// Size of the XSAVE area asm_isrPageFault saves the interrupted code's extended state in, 0 to use FXSAVE.
+extern "C" u64 isr_extendedStateSize = 0;
+
+// Called by asm_isrPageFault.
+extern "C" void isr_pageFault (Interrupts::interrupt_frame *frame)
+{
+	// A kernel fault outside any reservation is a bug. There is nowhere to report it from the kernel yet, so stop
+	// here, where a debugger still sees CR2 and the frame.
+	if (!Paging::handleFault(native::readCR(2), frame->m_Error))
+		native::stop();
+}
+
+bool Paging::initDemand (frame_allocator alloc, frame_freer free, table_pool &tables)
+{
+	s_Alloc = alloc;
+	s_Free = free;
+	s_Tables = &tables;
+	s_RegionCount = 0;
+	s_Lock.init();
+	s_DeadTables = sc_LastTable;
+	native::mem::fillBytes(&s_MapStats, 0, sizeof(map_stats));
+	native::mem::fillBytes(&s_Stats, 0, sizeof(demand_stats));
+
+	// The window's table, shared by every address space from here on. It is never freed: unmapShared () keeps it.
+	u64 &slot = ((u64 *)phys_to_virt(currentPML4()))[(demandBase() >> rootShift()) & (sc_Entries - 1)];
+	if (!(slot & sc_Present))
+	{
+		const u64 table = createTable(tables, s_MapStats);
+		if (table == sc_NoTable)
+			return false;
+		slot = table | sc_Present | sc_Writable;
+	}
+
+	// cpu::init () only sizes the area once it has enabled XSAVE.
+	const native::cpu::features &cpu = native::cpu::get();
+	isr_extendedStateSize = cpu.m_XSAVE ? cpu.m_XSAVESize : 0;
+
+	Interrupts::setGate(Interrupts::e_VectorPageFault, asm_isrPageFault);
+	return true;
+}
+
+bool Paging::reserve (u64 virt, u64 size, u64 flags, u32 faultAround)
+{
+	const u64 start = virt & ~(sc_Page - 1);
+	const u64 end = (virt + size + sc_Page - 1) & ~(sc_Page - 1);
+	if (end <= start || start < demandBase() || end - demandBase() > demandSize())
+		return false;
+
+	demand_lock _lock;
+
+	if (s_RegionCount == sc_MaxLazyRegions)
+		return false;
+
+	// First region that ends past start. It must also start at or after end.
+	u32 at = 0;
+	while (at < s_RegionCount && s_Regions[at].m_End <= start)
+		++at;
+	if (at < s_RegionCount && s_Regions[at].m_Start < end)
+		return false;
+
+	native::memmove(s_Regions + at + 1, s_Regions + at, (s_RegionCount - at) * sizeof(lazy_region));
+	++s_RegionCount;
+
+	lazy_region &r = s_Regions[at];
+	r.m_Start = start;
+	r.m_End = end;
+	r.m_Flags = flags | sc_Present;
+	r.m_FaultAround = sc_Page << (faultAround > 1 ? native::highestBit(faultAround) : 0);
+	return true;
+}
+
+bool Paging::release (u64 virt)
+{
+	lazy_region r;
+	// Frames and tables unmapped below, linked through their first word until they can be freed.
+	u64 frames = sc_NoFrame;
+	u64 tables = sc_LastTable;
+	{
+		demand_lock _lock;
+
+		const u32 index = findRegion(virt);
+		if (index == s_RegionCount || s_Regions[index].m_Start != (virt & ~(sc_Page - 1)))
+			return false;
+		r = s_Regions[index];
+
+		native::memmove(s_Regions + index, s_Regions + index + 1, (s_RegionCount - index - 1) * sizeof(lazy_region));
+		--s_RegionCount;
+
+		const u64 pml4 = currentPML4();
+		for (u64 v = r.m_Start; v < r.m_End; v += sc_Page)
+		{
+			const u64 phys = translate(pml4, v);
+			if (phys != sc_NotMapped)
+			{
+				*(u64 *)phys_to_virt(phys) = frames;
+				frames = phys;
+			}
+		}
+		if (frames == sc_NoFrame)
+			return true;
+
+		// Reservations are only ever mapped with 4 KiB pages, so nothing is split and no table is allocated.
+		s_DeadTables = sc_LastTable;
+		unmapShared(pml4, r.m_Start, r.m_End - r.m_Start, nullptr, deferTable, s_MapStats);
+		tables = s_DeadTables;
+		s_DeadTables = sc_LastTable;
+	}
+
+	// Frames and tables can only be freed once no CPU can reach them any more. The flush waits for the other CPUs,
+	// which may be spinning on s_Lock in handleFault (), so it runs without the lock, once for the whole region.
+	tlb_batch batch(nullptr);
+	batch.add(r.m_Start, r.m_End - r.m_Start);
+	batch.flush();
+
+	// The pool only takes all-zero frames.
+	while (tables != sc_LastTable)
+	{
+		u64 *link = (u64 *)phys_to_virt(tables);
+		const u64 next = *link;
+		*link = 0;
+		s_Tables->free(tables);
+		tables = next;
+	}
+
+	while (frames != sc_NoFrame)
+	{
+		const u64 next = *(const u64 *)phys_to_virt(frames);
+		s_Free(frames);
+		frames = next;
+	}
+	return true;
+}
+
+bool Paging::handleFault (u64 addr, u64 error)
+{
+	// The #PF gate already turned interrupts off.
+	scoped_lock _lock(s_Lock);
+
+	// User mode never gets kernel memory, not even by touching a reservation.
+	const u32 index = (error & (e_FaultPresent | e_FaultReserved | e_FaultUser)) ? s_RegionCount : findRegion(addr);
+	if (index == s_RegionCount)
+	{
+		++s_Stats.m_Unhandled;
+		return false;
+	}
+	const lazy_region &r = s_Regions[index];
+
+	++s_Stats.m_Faults;
+
+	const u64 pml4 = currentPML4();
+	const u64 page = addr & ~(sc_Page - 1);
+
+	// Another CPU faulted on the same page and got the lock first.
+	if (translate(pml4, page) != sc_NotMapped)
+	{
+		++s_Stats.m_Spurious;
+		return true;
+	}
+
+	if (!installPage(pml4, page, r.m_Flags, true))
+	{
+		++s_Stats.m_Unhandled;
+		return false;
+	}
+
+	// The rest of the aligned block around the page, as far as memory allows.
+	const u64 blockStart = page & ~(r.m_FaultAround - 1);
+	const u64 start = blockStart > r.m_Start ? blockStart : r.m_Start;
+	const u64 end = (r.m_End - blockStart > r.m_FaultAround) ? blockStart + r.m_FaultAround : r.m_End;
+	for (u64 v = start; v < end; v += sc_Page)
+	{
+		if (v == page || translate(pml4, v) != sc_NotMapped)
+			continue;
+		if (!installPage(pml4, v, r.m_Flags, false))
+			break;
+	}
+
+	return true;
+}
+
+Paging::demand_stats Paging::demandStats ()
+{
+	demand_lock _lock;
+	return s_Stats;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "Paging.hpp"
+#include "TablePool.hpp"
+
+// Demand-zero kernel memory.
+// reserve () sets a virtual range aside without backing it. The first touch of a page faults, and the #PF handler
+// maps a zeroed frame there and resumes; with fault-around, the rest of the aligned block of pages around it is
+// mapped in the same fault. Large sparse structures (per-CPU areas, tables sized for the most memory the machine can
+// hold) then only cost the frames that are actually used.
+// Ranges live in the demand window, one top level slot of the kernel half. initDemand () gives it its table up front and
+// nothing ever frees that table, so every address space that copies the kernel half shares everything below it, and the
+// handler can map into whatever CR3 holds. The TLB never caches not-present entries, so installing pages needs no
+// flush; release () flushes what it unmaps.
+// The handler takes the lock that reserve (), release () and demandStats () hold, so they hold it with interrupts off.
+
+namespace Paging
+{
+	static const u32 sc_MaxLazyRegions = 64;
+	// Pages mapped per fault, a power of two. 1 disables fault-around.
+	static const u32 sc_DefaultFaultAround = 16;
+
+	// Frames for the pages themselves. Return ~0 when out of memory.
+	typedef u64 (*frame_allocator) ();
+	typedef void (*frame_freer) (u64 phys);
+
+	struct demand_stats
+	{
+		u64	m_Faults;		// Faults handled
+		u64	m_Pages;		// Pages mapped, the faulting ones included
+		u64	m_Spurious;		// Faults on pages another CPU had already mapped
+		u64	m_Unhandled;	// Faults outside any reservation, from user mode, or on present pages
+	};
+
+	// The demand window: the top level slot right above the direct map, 512 GiB with 4 levels and 256 TiB with 5.
+	inline u64 demandBase () { return s_DirectMapBase + s_DirectMapSize; }
+	inline u64 demandSize () { return 1ULL << rootShift(); }
+
+	// Where frames and page tables come from, and installs the #PF handler. Gives the demand window its table in the
+	// current top level table, which address spaces made afterwards must copy the kernel half of. Interrupts::init and
+	// native::cpu::init must have run. Returns false if there was no table.
+	bool initDemand (frame_allocator alloc, frame_freer free, table_pool &tables);
+
+	// Reserves [virt, virt + size), to be backed by zeroed frames mapped with flags as it is touched.
+	// virt and size are rounded out to 4 KiB. faultAround is rounded down to a power of two.
+	// Returns false if the range is not inside the demand window, overlaps another reservation, or there is no room
+	// for it.
+	bool reserve (u64 virt, u64 size, u64 flags, u32 faultAround = sc_DefaultFaultAround);
+
+	// Unmaps the reservation starting at virt on every CPU, frees its frames and forgets it.
+	bool release (u64 virt);
+
+	// Maps the page at addr if it is in a reservation. error is the #PF error code.
+	// Returns false if the fault isn't one of ours. User mode faults never are.
+	bool handleFault (u64 addr, u64 error);
+
+	demand_stats demandStats ();
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include "common.hpp"
+
+// Page table entries, and a walker over them that maps, unmaps and translates.
+// entry<Level> is one entry of a level-Level table: 1 is the PT, 2 the PD, 3 the PDPT, 4 the PML4, 5 the PML5 (with
+// LA57). The layout differences between levels (PS, where PAT lives, the address bits of a large page) are all in
+// level_traits, and flags are plain u64 constants, so composing them folds at compile time.
+// The walker is a template over how physical memory is reached (Memory), so the same code runs in the kernel
+// through the direct map and in host tests against a simulated physical memory. It needs nothing but common.hpp.
+//
+// Memory must provide:
+//	u64 * table (u64 phys)		- pointer to the 512 entries of the table at phys
+//	u64 allocTable ()			- a zeroed 4 KiB frame for a new table, or sc_NoTable
+//	void freeTable (u64 phys)	- gives a table back once it is empty
+
+namespace Paging
+{
+	// Flags. Leaves take any of them, tables are always present and writable (and user if a leaf below is).
+	static const u64 sc_Present			= 1ULL << 0;
+	static const u64 sc_Writable		= 1ULL << 1;
+	static const u64 sc_User			= 1ULL << 2;
+	static const u64 sc_WriteThrough	= 1ULL << 3;
+	static const u64 sc_CacheDisable	= 1ULL << 4;
+	static const u64 sc_Accessed		= 1ULL << 5;
+	static const u64 sc_Dirty			= 1ULL << 6;	// Leaves only
+	static const u64 sc_PAT				= 1ULL << 7;	// Leaves only. Moved to bit 12 in large pages by entry::leaf
+	static const u64 sc_Global			= 1ULL << 8;	// Leaves only
+	static const u64 sc_NoExecute		= 1ULL << 63;	// Only valid once EFER.NXE is set
+
+	// Memory types for leaves: PAT/PCD/PWT select one of the eight IA32_PAT entries, as Paging::initPAT programs them.
+	// Entries 0, 2 and 3 keep their power-on types, so tables built before initPAT (all sc_CacheWB) mean the same.
+	static const u64 sc_CacheWB			= 0;									// PAT 0: write-back
+	static const u64 sc_CacheWC			= sc_WriteThrough;						// PAT 1: write-combining
+	static const u64 sc_CacheUCMinus	= sc_CacheDisable;						// PAT 2: uncached, MTRRs may override with WC
+	static const u64 sc_CacheUC			= sc_CacheDisable | sc_WriteThrough;	// PAT 3: uncached
+	static const u64 sc_CacheWP			= sc_PAT | sc_WriteThrough;				// PAT 5: write-protect
+	static const u64 sc_CacheWT			= sc_PAT | sc_CacheDisable | sc_WriteThrough;	// PAT 7: write-through
+	static const u64 sc_CacheMask		= sc_PAT | sc_CacheDisable | sc_WriteThrough;
+
+	// PS: the entry maps a page instead of pointing to a table. PD and PDPT only, set by entry::leaf.
+	static const u64 sc_LargePage		= 1ULL << 7;
+
+	static const u64 sc_AddressMask = 0x000FFFFFFFFFF000ULL;
+	static const u32 sc_Entries = 512;
+
+	static const u64 sc_NoTable = ~0ULL;
+	static const u64 sc_NotMapped = ~0ULL;
+
+	enum page_size
+	{
+		e_Page4K	= 0x1000,
+		e_Page2M	= 0x200000,
+		e_Page1G	= 0x40000000,
+	};
+
+	// Pages currently mapped and tables currently in use, kept up to date by map/unmap.
+	struct map_stats
+	{
+		u64	m_Pages4K;
+		u64	m_Pages2M;
+		u64	m_Pages1G;
+		u64	m_Tables;
+
+		u64 & pagesAt (u32 level) { return level == 1 ? m_Pages4K : (level == 2 ? m_Pages2M : m_Pages1G); }
+	};
+
+	template <u32 Level>
+	struct level_traits
+	{
+		static const u32 sc_Shift = 12 + 9 * (Level - 1);
+		static const u64 sc_PageSize = 1ULL << sc_Shift;
+		// The PT always maps pages, the PD and PDPT can with PS set, anything above never does.
+		static const bool sc_CanBeLeaf = Level <= 3;
+		static const u64 sc_LeafBits = (Level == 1) ? 0 : sc_LargePage;
+		static const u64 sc_LeafPAT = (Level == 1) ? sc_PAT : (1ULL << 12);
+		static const u64 sc_LeafAddressMask = sc_AddressMask & ~(sc_PageSize - 1);
+	};
+
+	template <u32 Level>
+	struct entry
+	{
+		typedef level_traits<Level> traits;
+
+		u64	m_Value;
+
+		static entry make (u64 value) { entry e; e.m_Value = value; return e; }
+
+		// Points at the next level's table.
+		static entry table (u64 phys, u64 flags)
+		{
+			return make((phys & sc_AddressMask) | sc_Present | sc_Writable | (flags & sc_User));
+		}
+
+		// Maps a page of this level's size. phys must be aligned to it.
+		static entry leaf (u64 phys, u64 flags)
+		{
+			const u64 pat = (flags & sc_PAT) ? traits::sc_LeafPAT : 0;
+			return make((phys & traits::sc_LeafAddressMask) | (flags & ~sc_AddressMask & ~sc_PAT) | pat | sc_Present | traits::sc_LeafBits);
+		}
+
+		static u32 index (u64 virt) { return u32(virt >> traits::sc_Shift) & (sc_Entries - 1); }
+
+		bool present () const { return (m_Value & sc_Present) != 0; }
+		bool isLeaf () const { return Level == 1 || (traits::sc_CanBeLeaf && (m_Value & sc_LargePage) != 0); }
+
+		u64 address () const { return m_Value & (isLeaf() ? traits::sc_LeafAddressMask : sc_AddressMask); }
+
+		// Flags as they were passed to leaf () or table ().
+		u64 flags () const
+		{
+			if (!isLeaf())
+				return m_Value & ~sc_AddressMask;
+			const u64 f = m_Value & ~traits::sc_LeafAddressMask & ~traits::sc_LeafBits & ~traits::sc_LeafPAT;
+			return f | ((m_Value & traits::sc_LeafPAT) ? sc_PAT : 0);
+		}
+	};
+
+	static_assert(sizeof(entry<1>) == 8 && sizeof(entry<4>) == 8, "Page table entries are 8 bytes");
+	static_assert(level_traits<3>::sc_PageSize == e_Page1G && level_traits<2>::sc_PageSize == e_Page2M, "Level sizes");
+	static_assert(level_traits<5>::sc_Shift == 48, "A PML5 entry covers 256 TiB");
+
+	template <class Memory>
+	inline bool tableEmpty (Memory &memory, u64 table)
+	{
+		const u64 *entries = memory.table(table);
+		for (u32 i = 0; i < sc_Entries; ++i)
+		{
+			if (entries[i] != 0)
+				return false;
+		}
+		return true;
+	}
+
+	// One level of the walk. Every function handles the entries of a single table from virt onwards, stopping at end
+	// or at the end of the table, and advances virt (and phys) past what it handled.
+	template <class Memory, u32 Level>
+	struct walker
+	{
+		typedef entry<Level> entry_type;
+		typedef level_traits<Level> traits;
+		typedef walker<Memory, Level - 1> lower;
+
+		static u64 translate (Memory &memory, u64 table, u64 virt, u64 *size)
+		{
+			const entry_type e = ((const entry_type *)memory.table(table))[entry_type::index(virt)];
+			if (!e.present())
+				return sc_NotMapped;
+			if (e.isLeaf())
+			{
+				if (size)
+					*size = traits::sc_PageSize;
+				return e.address() | (virt & (traits::sc_PageSize - 1));
+			}
+			return lower::translate(memory, e.address(), virt, size);
+		}
+
+		static bool map (Memory &memory, u64 table, u64 &virt, u64 &phys, u64 end, u64 flags, u64 largest, map_stats &stats)
+		{
+			entry_type *entries = (entry_type *)memory.table(table);
+			for (u32 i = entry_type::index(virt); i < sc_Entries && virt < end; ++i)
+			{
+				entry_type &e = entries[i];
+
+				if (traits::sc_CanBeLeaf && largest >= traits::sc_PageSize && !e.present() &&
+					((virt | phys) & (traits::sc_PageSize - 1)) == 0 && end - virt >= traits::sc_PageSize)
+				{
+					e = entry_type::leaf(phys, flags);
+					++stats.pagesAt(Level);
+					virt += traits::sc_PageSize;
+					phys += traits::sc_PageSize;
+					continue;
+				}
+
+				if (!e.present())
+				{
+					const u64 child = memory.allocTable();
+					if (child == sc_NoTable)
+						return false;
+					++stats.m_Tables;
+					e = entry_type::table(child, flags);
+				}
+				else if (e.isLeaf())
+				{
+					return false;
+				}
+				else
+				{
+					e.m_Value |= flags & sc_User;
+				}
+
+				if (!lower::map(memory, e.address(), virt, phys, end, flags, largest, stats))
+					return false;
+			}
+			return true;
+		}
+
+		// keepTables leaves this table's children in place even once they are empty.
+		static bool unmap (Memory &memory, u64 table, u64 &virt, u64 end, map_stats &stats, bool keepTables = false)
+		{
+			entry_type *entries = (entry_type *)memory.table(table);
+			for (u32 i = entry_type::index(virt); i < sc_Entries && virt < end; ++i)
+			{
+				entry_type &e = entries[i];
+				const u64 next = (virt | (traits::sc_PageSize - 1)) + 1;
+
+				if (!e.present())
+				{
+					virt = (next - 1 < end - 1) ? next : end;
+					continue;
+				}
+
+				if (e.isLeaf())
+				{
+					if ((virt & (traits::sc_PageSize - 1)) == 0 && end - virt >= traits::sc_PageSize)
+					{
+						e.m_Value = 0;
+						--stats.pagesAt(Level);
+						virt = next;
+						continue;
+					}
+
+					// Only part of a large page goes. Split it into pages of the next size down and carry on there.
+					const u64 child = memory.allocTable();
+					if (child == sc_NoTable)
+						return false;
+					++stats.m_Tables;
+					lower::fill(memory, child, e.address(), e.flags(), stats);
+					--stats.pagesAt(Level);
+					e = entry_type::table(child, e.flags());
+				}
+
+				if (!lower::unmap(memory, e.address(), virt, end, stats))
+					return false;
+
+				if (!keepTables && tableEmpty(memory, e.address()))
+				{
+					memory.freeTable(e.address());
+					--stats.m_Tables;
+					e.m_Value = 0;
+				}
+			}
+			return true;
+		}
+
+		// Maps every entry of a fresh table to consecutive pages from phys.
+		static void fill (Memory &memory, u64 table, u64 phys, u64 flags, map_stats &stats)
+		{
+			entry_type *entries = (entry_type *)memory.table(table);
+			for (u32 i = 0; i < sc_Entries; ++i)
+				entries[i] = entry_type::leaf(phys + i * traits::sc_PageSize, flags);
+			stats.pagesAt(Level) += sc_Entries;
+		}
+	};
+
+	// The PT: every entry is a page.
+	template <class Memory>
+	struct walker<Memory, 1>
+	{
+		typedef entry<1> entry_type;
+
+		static u64 translate (Memory &memory, u64 table, u64 virt, u64 *size)
+		{
+			const entry_type e = ((const entry_type *)memory.table(table))[entry_type::index(virt)];
+			if (!e.present())
+				return sc_NotMapped;
+			if (size)
+				*size = e_Page4K;
+			return e.address() | (virt & (e_Page4K - 1));
+		}
+
+		static bool map (Memory &memory, u64 table, u64 &virt, u64 &phys, u64 end, u64 flags, u64, map_stats &stats)
+		{
+			entry_type *entries = (entry_type *)memory.table(table);
+			for (u32 i = entry_type::index(virt); i < sc_Entries && virt < end; ++i)
+			{
+				if (entries[i].present())
+					return false;
+				entries[i] = entry_type::leaf(phys, flags);
+				++stats.m_Pages4K;
+				virt += e_Page4K;
+				phys += e_Page4K;
+			}
+			return true;
+		}
+
+		static bool unmap (Memory &memory, u64 table, u64 &virt, u64 end, map_stats &stats)
+		{
+			entry_type *entries = (entry_type *)memory.table(table);
+			for (u32 i = entry_type::index(virt); i < sc_Entries && virt < end; ++i)
+			{
+				if (entries[i].present())
+				{
+					entries[i].m_Value = 0;
+					--stats.m_Pages4K;
+				}
+				virt += e_Page4K;
+			}
+			return true;
+		}
+
+		static void fill (Memory &memory, u64 table, u64 phys, u64 flags, map_stats &stats)
+		{
+			entry_type *entries = (entry_type *)memory.table(table);
+			for (u32 i = 0; i < sc_Entries; ++i)
+				entries[i] = entry_type::leaf(phys + i * e_Page4K, flags);
+			stats.m_Pages4K += sc_Entries;
+		}
+	};
+
+	// An address space rooted at a top level table: the PML4, or the PML5 with Levels = 5.
+	// Nothing here flushes the TLB; after unmapping or changing a live mapping the caller must.
+	template <class Memory, u32 Levels = 4>
+	class page_table
+	{
+		typedef walker<Memory, Levels> top;
+
+		Memory	&m_Memory;
+		u64		m_Root;
+
+		page_table & operator = (const page_table &);
+	public:
+		page_table (Memory &memory, u64 root) : m_Memory(memory), m_Root(root) {}
+
+		u64 root () const { return m_Root; }
+
+		// Maps [virt, virt + size) to [phys, phys + size). virt and phys must be 4 KiB aligned, size is rounded up to
+		// 4 KiB, and the range must not wrap. Each step uses the largest page up to largest that virt, phys and what
+		// is left are all aligned to. Returns false if a table could not be allocated or part of the range was
+		// already mapped; whatever was mapped before that stays mapped.
+		bool map (u64 virt, u64 phys, u64 size, u64 flags, u64 largest, map_stats &stats)
+		{
+			const u64 end = virt + ((size + e_Page4K - 1) & ~u64(e_Page4K - 1));
+			return top::map(m_Memory, m_Root, virt, phys, end, flags, largest, stats);
+		}
+
+		// Unmaps every page in [virt, virt + size), splitting large pages that are only partly covered, and frees
+		// tables that end up empty, except those the root points at if keepTopTables is set. Returns false if a split
+		// needed a table and there was none.
+		bool unmap (u64 virt, u64 size, map_stats &stats, bool keepTopTables = false)
+		{
+			const u64 end = virt + ((size + e_Page4K - 1) & ~u64(e_Page4K - 1));
+			return top::unmap(m_Memory, m_Root, virt, end, stats, keepTopTables);
+		}
+
+		// Physical address virt maps to, or sc_NotMapped. size, if given, is set to the size of the page.
+		u64 translate (u64 virt, u64 *size = nullptr) const
+		{
+			return top::translate(m_Memory, m_Root, virt, size);
+		}
+	};
+}
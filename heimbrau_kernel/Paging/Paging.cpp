@@ -2,161 +2,140 @@
 
 #include "..\..\heimbrau_asm\hb_asm.hpp"
 
-#pragma pack(push, 1)
+#include "Paging.hpp"
+#include "AddressSpace.hpp"
 
-// Entry for the PML4
-struct PML4E
+namespace
 {
-	union
+	const u32 sc_MSR_PAT = 0x277;
+	const u64 sc_CR4_LA57 = 1ULL << 12;
+
+	// PAT memory type encodings
+	enum
 	{
-		struct
-		{
-			u64	present		: 1; // Present Bit
-			u64 R_W			: 1; // Read-Write Bit : 0 == read only
-			u64 U_S			: 1; // User-Supervisor : 0 = supervisor only
-			u64 PWT			: 1; // page-level write-through
-			u64 PCD			: 1; // page-level cache disable
-			u64 A			: 1; // accessed
-			u64				: 1;
-			u64 PS			: 1; // Reserved (must be zero)
-			u64				: 4;
-			u64	PDPT_PP		: 40; // Physical pointer to PDPT (Page Directory Pointer Table)
-			u64				: 11;
-			u64 NX			: 1;
-		};
-		u64 _i;
+		e_PAT_UC		= 0x00,
+		e_PAT_WC		= 0x01,
+		e_PAT_WT		= 0x04,
+		e_PAT_WP		= 0x05,
+		e_PAT_WB		= 0x06,
+		e_PAT_UCMinus	= 0x07,
 	};
 
-	PML4E () : _i(0) {}
-};
-
-// The _entire_ PML4 for the system, residing in the kernel binary.
-// As of current implementations, the PML4 is only 512 entries.
-// When future CPUs are released that do not have 48-bit memory addressing,
-// this will likely need to be updated. This should be a trivial task.
-_align(0x1000) struct PML4
-{
-	PML4E	entries[512];
+	// Entry n is byte n. Must agree with the sc_Cache* flags in PageTable.hpp.
+	const u64 sc_PATLayout =
+		(u64(e_PAT_WB) << 0) | (u64(e_PAT_WC) << 8) | (u64(e_PAT_UCMinus) << 16) | (u64(e_PAT_UC) << 24) |
+		(u64(e_PAT_WB) << 32) | (u64(e_PAT_WP) << 40) | (u64(e_PAT_UCMinus) << 48) | (u64(e_PAT_WT) << 56);
 
-	PML4E & operator [] (size_t i) { return entries[i]; }
-	PML4E operator [] (size_t i) const { return entries[i]; }
-};
+	// The depth is only known at boot, but a walk should not test it at every level. These pick the specialization
+	// once per call; with 4 levels that is one predictable branch in front of the same walk as before.
+	template <class Memory>
+	bool mapAt (Memory &memory, u64 root, u64 virt, u64 phys, u64 size, u64 flags, u64 largest, Paging::map_stats &stats)
+	{
+		if (Paging::s_Levels == 5)
+			return Paging::page_table<Memory, 5>(memory, root).map(virt, phys, size, flags, largest, stats);
+		return Paging::page_table<Memory, 4>(memory, root).map(virt, phys, size, flags, largest, stats);
+	}
 
-// Page Directory Pointer Table entry
-struct PDPTE
-{
-	union
+	template <class Memory>
+	bool unmapAt (Memory &memory, u64 root, u64 virt, u64 size, Paging::map_stats &stats, bool keepTopTables = false)
 	{
-		struct
-		{
-			u64	present		: 1; // Present Bit
-			u64 R_W			: 1; // Read-Write Bit : 0 == read only
-			u64 U_S			: 1; // User-Supervisor : 0 = supervisor only
-			u64 PWT			: 1; // page-level write-through
-			u64 PCD			: 1; // page-level cache disable
-			u64 A			: 1; // accessed
-			u64	D			: 1; // dirty
-			u64 PS			: 1; // Reserved (must be zero unless it maps a 1GB page)
-			u64	G			: 1; // global
-			u64				: 3;
-			u64	PD_PP		: 40; // Physical pointer to Page Table
-			u64				: 11;
-			u64 NX			: 1;
-		};
-		u64 _i;
-	};
+		if (Paging::s_Levels == 5)
+			return Paging::page_table<Memory, 5>(memory, root).unmap(virt, size, stats, keepTopTables);
+		return Paging::page_table<Memory, 4>(memory, root).unmap(virt, size, stats, keepTopTables);
+	}
 
-	PDPTE () : _i(0) {}
-};
+	template <class Memory>
+	u64 translateAt (Memory &memory, u64 root, u64 virt, u64 *size)
+	{
+		if (Paging::s_Levels == 5)
+			return Paging::page_table<Memory, 5>(memory, root).translate(virt, size);
+		return Paging::page_table<Memory, 4>(memory, root).translate(virt, size);
+	}
+}
 
-// TODO :
-// Everything below this is going to have to be restructured for dynamic physical memory allocation.
-// We should only _statically_ have room for the page structures requires for the kernel itself. All others should be
-// dynamically allocated.
+u32 Paging::s_Levels = 4;
+u64 Paging::s_DirectMapBase = Paging::sc_DirectMapBase4;
+u64 Paging::s_DirectMapSize = Paging::sc_DirectMapSize4;
 
-// Array of 512 PDPT entries. Not flexible, meant for kernel use.
-_align(0x1000) struct PDPT
+u32 Paging::initLevels ()
 {
+	const bool la57 = (native::readCR(4) & sc_CR4_LA57) != 0;
+	s_Levels = la57 ? 5 : 4;
+	s_DirectMapBase = la57 ? sc_DirectMapBase5 : sc_DirectMapBase4;
+	s_DirectMapSize = la57 ? sc_DirectMapSize5 : sc_DirectMapSize4;
+	return s_Levels;
+}
 
-	PDPTE	entries[512];
-
-	PDPTE & operator [] (size_t i) { return entries[i]; }
-	PDPTE operator [] (size_t i) const { return entries[i]; }
-};
+bool Paging::initPAT ()
+{
+	if (!native::cpu::get().m_PAT)
+		return false;
+
+	native::wbinvd();
+	native::writeMSR(sc_MSR_PAT, sc_PATLayout);
+	native::wbinvd();
+	invalidateAll();
+	return true;
+}
 
-// Page Directory Entry
-struct PDE
+Paging::page_size Paging::largestPageSize ()
 {
-	union
-	{
-		struct
-		{
-			u64	present		: 1; // Present Bit
-			u64 R_W			: 1; // Read-Write Bit : 0 == read only
-			u64 U_S			: 1; // User-Supervisor : 0 = supervisor only
-			u64 PWT			: 1; // page-level write-through
-			u64 PCD			: 1; // page-level cache disable
-			u64 A			: 1; // accessed
-			u64	D			: 1; // dirty
-			u64 PS			: 1; // Reserved (must be zero unless it maps a 2MB page)
-			u64	G			: 1; // global
-			u64				: 3;
-			u64	PT_PP		: 40; // Physical pointer to Page Table
-			u64				: 11;
-			u64 NX			: 1;
-		};
-		u64 _i;
-	};
+	return native::cpu::get().m_Page1GB ? e_Page1G : e_Page2M;
+}
 
-	PDE () : _i(0) {}
-};
+u64 Paging::createTable (table_allocator alloc, map_stats &stats)
+{
+	direct_memory memory(alloc, nullptr);
+	const u64 table = memory.allocTable();
+	if (table != sc_NoTable)
+		++stats.m_Tables;
+	return table;
+}
 
-// Array of 512 Page Directory Entries
-_align(0x1000) struct PD
+u64 Paging::createTable (table_pool &pool, map_stats &stats)
 {
-	PDE	entries[512];
+	pooled_memory memory(pool);
+	const u64 table = memory.allocTable();
+	if (table != sc_NoTable)
+		++stats.m_Tables;
+	return table;
+}
 
-	PDE & operator [] (size_t i) { return entries[i]; }
-	PDE operator [] (size_t i) const { return entries[i]; }
-};
+bool Paging::mapRange (u64 pml4, u64 virt, u64 phys, u64 size, u64 flags, page_size largest, table_allocator alloc, map_stats &stats)
+{
+	direct_memory memory(alloc, nullptr);
+	return mapAt(memory, pml4, virt, phys, size, flags, largest, stats);
+}
 
-// Page Table Entry
-struct PTE
+bool Paging::mapRange (u64 pml4, u64 virt, u64 phys, u64 size, u64 flags, page_size largest, table_pool &pool, map_stats &stats)
 {
-	union
-	{
-		struct
-		{
-			u64	present		: 1; // Present Bit
-			u64 R_W			: 1; // Read-Write Bit : 0 == read only
-			u64 U_S			: 1; // User-Supervisor : 0 = supervisor only
-			u64 PWT			: 1; // page-level write-through
-			u64 PCD			: 1; // page-level cache disable
-			u64 A			: 1; // accessed
-			u64	D			: 1; // dirty
-			u64 PAT			: 1; // Indirectly determines the memory type used to access the 4-KByte page referenced by this entry (see Section 4.9.2)
-			u64	G			: 1; // global
-			u64				: 3;
-			u64	PD_PP		: 40; // Physical pointer to Page Entry
-			u64				: 11;
-			u64 NX			: 1;
-		};
-		u64 _i;
-	};
+	pooled_memory memory(pool);
+	return mapAt(memory, pml4, virt, phys, size, flags, largest, stats);
+}
 
-	PTE () : _i(0) {}
-};
+bool Paging::unmapRange (u64 pml4, u64 virt, u64 size, table_allocator alloc, table_freer free, map_stats &stats)
+{
+	direct_memory memory(alloc, free);
+	return unmapAt(memory, pml4, virt, size, stats);
+}
 
-// Array of 512 Page Table Entries
-_align(0x1000) struct PT
+bool Paging::unmapRange (u64 pml4, u64 virt, u64 size, table_pool &pool, map_stats &stats)
 {
-	PTE	entries[512];
+	pooled_memory memory(pool);
+	return unmapAt(memory, pml4, virt, size, stats);
+}
 
-	PTE & operator [] (size_t i) { return entries[i]; }
-	PTE operator [] (size_t i) const { return entries[i]; }
-};
+bool Paging::unmapShared (u64 pml4, u64 virt, u64 size, table_allocator alloc, table_freer free, map_stats &stats)
+{
+	direct_memory memory(alloc, free);
+	return unmapAt(memory, pml4, virt, size, stats, true);
+}
 
-#pragma pack(pop)
+u64 Paging::translate (u64 pml4, u64 virt, u64 *size)
+{
+	direct_memory memory(nullptr, nullptr);
+	return translateAt(memory, pml4, virt, size);
+}
 
 #if defined(KERNEL)
 extern "C" 
@@ -195,84 +174,4 @@ void initializeProtoPaging ()
 	// TODO
 }
 
-void initializePagingSystem ()
-{
-	// TODO
-
-	//u64 *phy_PML4 = 
-}
-
-#pragma pack(push, 1)
-struct SimpleMemoryEntry
-{
-	u64 offset;
-	u64 extent;
-	u32 type;
-};
-#pragma pack(pop)
-
-#include "../../heimbrau_loader/LoaderIO/lio.hpp"
-
-// Gets basic memory information.
-// We pass in the memory map, which is sorted and cleaned.
-// nentries it the number of entries in the input memory map.
-// This function is sort of complex. It will determine the number of 4k pages requires to store the kernel image.
-// It takes an array (allocPages) of pointers that it will populate with physical page addresses that are to be 
-// used for the kernel, none of them being less than the value of startAt.
-void getKernelPPages (const SimpleMemoryEntry *entries, u32 nentries, void **allocPages, u64 startAt)
-{
-	static const u32 numPages = ((kerneldata::kernelSize % 4096) == 0) ? 
-		kerneldata::kernelSize / 4096:
-		(kerneldata::kernelSize + (4096 - (kerneldata::kernelSize % 4096))) / 4096;
-
-	u32 iterator = 1;
-	const SimpleMemoryEntry *lastEntry = &entries[0];
-	u64	lastOffset = lastEntry->offset;	
-	if ((lastOffset % 4096) != 0)
-	{
-		lastOffset += 4096 - (lastOffset % 4096);
-	}
-
-	auto getPage = [entries, nentries, &lastEntry, &lastOffset, &iterator, startAt] () -> u64
-	{
-		restart:
-		if ((lastOffset + 4096 + 4096) > (lastEntry->extent + lastEntry->offset))
-		{
-			// Get next entry.
-			for (u32 i = iterator; i < nentries; ++i)
-			{
-				if (entries[i].type != 1)
-					continue;
-
-				lastEntry = &entries[i];
-				iterator = i + 1;
-
-				//check for alignment
-				lastOffset = entries[i].offset;
-				if ((lastOffset % 4096) != 0)
-				{
-					lastOffset += 4096 - (lastOffset % 4096);
-				}
-				// Perform the check again.
-				goto restart;
-			}
-		}
-
-		u64 offset = lastOffset;
-		lastOffset += 4096;
-
-		if (offset <= startAt)
-		{
-			goto restart;
-		}
-
-		return offset;
-	};
-
-	for (u32 i = 0; i < numPages; ++i)
-	{
-		allocPages[i] = (void *)getPage();
-	}
-}
-
 #endif // defined(KERNEL)
\ No newline at end of file
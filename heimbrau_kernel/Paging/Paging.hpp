@@ -0,0 +1,141 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "PageTable.hpp"
+#include "TablePool.hpp"
+
+// Page table building, shared by the loader and the kernel. Thin wrappers over page_table (PageTable.hpp) with
+// tables reached through phys_to_virt: identity in the loader, the direct map in the kernel.
+// All addresses passed in and returned are physical unless the name says virtual.
+
+namespace Paging
+{
+	// All RAM is mapped in the direct map, at s_DirectMapBase + phys, by the loader's KernelPaging::Build. It takes
+	// top level slots 256 to 383 either way: 64 TiB from the bottom of the kernel half with 4 levels, 32 PiB with 5.
+	static const u64 sc_DirectMapBase4 = 0xFFFF800000000000ULL;
+	static const u64 sc_DirectMapSize4 = 64ULL << 40;
+	static const u64 sc_DirectMapBase5 = 0xFF00000000000000ULL;
+	static const u64 sc_DirectMapSize5 = 32ULL << 50;
+
+	// Paging depth, 4 or 5, and the direct map that goes with it. Fixed by initLevels before anything is mapped;
+	// until then they hold the 4-level values.
+	extern u32 s_Levels;
+	extern u64 s_DirectMapBase;
+	extern u64 s_DirectMapSize;
+
+	// Reads the depth mb2_entry left paging at (CR4.LA57, set at entry when CPUID reports it) into s_Levels and
+	// picks the direct map to match. Returns s_Levels. The loader and the kernel each call it once, early.
+	u32 initLevels ();
+
+	// Shift of the address bits a top level entry selects: 39 for the PML4, 48 for the PML5.
+	inline u32 rootShift () { return 12 + 9 * (s_Levels - 1); }
+
+	// Returns a free 4 KiB frame for a new table, or sc_NoTable. The builder zeroes it.
+	typedef u64 (*table_allocator) ();
+	// Takes back a table frame from table_allocator once it is empty.
+	typedef void (*table_freer) (u64 phys);
+
+	// Programs IA32_PAT on the calling CPU with the layout the sc_Cache* flags select from, and flushes caches and
+	// TLB so no line or translation of the old types is left. Call on every CPU, after initTLB, before any
+	// sc_CacheWC/WP/WT mapping is used. Returns false, leaving the power-on layout, if the CPU has no PAT.
+	bool initPAT ();
+
+	// Largest page the CPU can map: 1 GiB if CPUID reports it, otherwise 2 MiB.
+	page_size largestPageSize ();
+
+	// Allocates and zeroes a table. Returns sc_NoTable if alloc did.
+	u64 createTable (table_allocator alloc, map_stats &stats);
+	u64 createTable (table_pool &pool, map_stats &stats);
+
+	// mapRange, unmapRange and translate take the top level table as pml4, PML5 included, and walk s_Levels levels.
+	// Maps [virt, virt + size) to [phys, phys + size) under pml4. virt and phys must be 4 KiB aligned; size is rounded
+	// up to 4 KiB. Every step uses the largest page, up to largest, that virt, phys and what is left are all aligned to,
+	// so 4 KiB pages are only used at the unaligned edges. The range must not already be mapped.
+	// Returns false if a table could not be allocated, or if part of the range is already mapped.
+	bool mapRange (u64 pml4, u64 virt, u64 phys, u64 size, u64 flags, page_size largest, table_allocator alloc, map_stats &stats);
+	// The same, with tables from a pool of zeroed frames.
+	bool mapRange (u64 pml4, u64 virt, u64 phys, u64 size, u64 flags, page_size largest, table_pool &pool, map_stats &stats);
+
+	// Unmaps [virt, virt + size) under pml4, splitting large pages that are only partly covered (with tables from
+	// alloc) and giving tables that end up empty to free. Does not flush the TLB: add the range to a tlb_batch (TLB.hpp).
+	bool unmapRange (u64 pml4, u64 virt, u64 size, table_allocator alloc, table_freer free, map_stats &stats);
+	// The same, with tables from and back to a pool of zeroed frames. Emptied tables are zero, so they go straight back.
+	bool unmapRange (u64 pml4, u64 virt, u64 size, table_pool &pool, map_stats &stats);
+	// Like the first unmapRange, but the tables pml4 points at stay, even once empty. In the kernel half every address
+	// space shares them, so freeing one would leave it in the other address spaces.
+	bool unmapShared (u64 pml4, u64 virt, u64 size, table_allocator alloc, table_freer free, map_stats &stats);
+
+	// Physical address virt maps to under pml4, or sc_NotMapped. size, if given, is set to the size of the page.
+	u64 translate (u64 pml4, u64 virt, u64 *size = nullptr);
+
+	// Pointer to physical memory. The loader runs identity mapped, so there it is the address itself.
+	inline void * phys_to_virt (u64 phys)
+	{
+#if defined(KERNEL)
+		return (void *)(phys + s_DirectMapBase);
+#else
+		return (void *)phys;
+#endif
+	}
+
+	// Physical address behind a pointer. Direct map pointers are a subtraction; anything else is looked up in the
+	// current address space, and is sc_NotMapped if it isn't mapped.
+	inline u64 virt_to_phys (const void *virt)
+	{
+#if defined(KERNEL)
+		const u64 v = u64(virt);
+		if (v - s_DirectMapBase < s_DirectMapSize)
+			return v - s_DirectMapBase;
+		return translate(native::readCR(3) & sc_AddressMask, v);
+#else
+		return u64(virt);
+#endif
+	}
+
+	// Physical memory as the page_table walker sees it in the loader and kernel: through phys_to_virt, with table
+	// frames from the given callbacks.
+	class direct_memory
+	{
+		table_allocator		m_Alloc;
+		table_freer			m_Free;
+
+	public:
+		direct_memory (table_allocator alloc, table_freer free) : m_Alloc(alloc), m_Free(free) {}
+
+		u64 * table (u64 phys) const { return (u64 *)phys_to_virt(phys); }
+
+		u64 allocTable ()
+		{
+			const u64 phys = m_Alloc ? m_Alloc() : sc_NoTable;
+			if (phys != sc_NoTable)
+				native::mem::zeroPages(table(phys), e_Page4K);
+			return phys;
+		}
+
+		void freeTable (u64 phys)
+		{
+			if (m_Free)
+				m_Free(phys);
+		}
+	};
+
+	// The same, with tables from a table_pool. Nothing is zeroed here: the pool only holds zeroed frames.
+	class pooled_memory
+	{
+		table_pool			&m_Pool;
+
+	public:
+		explicit pooled_memory (table_pool &pool) : m_Pool(pool) {}
+
+		u64 * table (u64 phys) const { return (u64 *)phys_to_virt(phys); }
+
+		u64 allocTable ()
+		{
+			const u64 phys = m_Pool.alloc();
+			return phys != table_pool::sc_NoFrame ? phys : sc_NoTable;
+		}
+
+		void freeTable (u64 phys) { m_Pool.free(phys); }
+	};
+}
@@ -0,0 +1,202 @@
+#include "common.hpp"
+
+#include "..\..\heimbrau_asm\hb_asm.hpp"
+
+#include "TLB.hpp"
+
+u32 Paging::s_FullFlushPages = 32;
+
+namespace
+{
+	struct shootdown_request;
+
+	// A request's place on one target's list. Lives in the request, on the initiator's stack.
+	struct shootdown_node
+	{
+		shootdown_node		*m_Next;
+		shootdown_request	*m_Request;
+	};
+
+	struct shootdown_request
+	{
+		const Paging::tlb_batch	*m_Batch;
+		volatile long			m_Pending;		// Targets that haven't acknowledged yet
+		shootdown_node			m_Nodes[native::cpu::sc_MaxCPUs];
+	};
+
+	// Requests waiting for each CPU, newest first.
+	shootdown_node * volatile s_Mailboxes[native::cpu::sc_MaxCPUs];
+
+	Paging::ipi_sender s_SendIPI = nullptr;
+
+	// Per-CPU and a line each, so counting never bounces a cache line between CPUs.
+	struct _align(64) cpu_stats
+	{
+		Paging::tlb_stats	m_Stats;
+	};
+
+	cpu_stats s_Stats[native::cpu::sc_MaxCPUs];
+
+	inline Paging::tlb_stats & localStats () { return s_Stats[native::cpu::index()].m_Stats; }
+
+	// Returns true if the list was empty, ie: the target has no IPI coming yet.
+	bool post (u32 cpu, shootdown_node *node)
+	{
+		shootdown_node *head;
+		do
+		{
+			head = s_Mailboxes[cpu];
+			node->m_Next = head;
+		}
+		while (_InterlockedCompareExchangePointer((void * volatile *)&s_Mailboxes[cpu], node, head) != head);
+		return head == nullptr;
+	}
+}
+
+Paging::tlb_stats Paging::tlbStats ()
+{
+	tlb_stats total;
+	native::mem::fillBytes(&total, 0, sizeof(tlb_stats));
+	for (u32 i = 0; i < native::cpu::sc_MaxCPUs; ++i)
+	{
+		total.m_Flushes += s_Stats[i].m_Stats.m_Flushes;
+		total.m_Pages += s_Stats[i].m_Stats.m_Pages;
+		total.m_FullFlushes += s_Stats[i].m_Stats.m_FullFlushes;
+		total.m_Shootdowns += s_Stats[i].m_Stats.m_Shootdowns;
+		total.m_IPIs += s_Stats[i].m_Stats.m_IPIs;
+		total.m_Handled += s_Stats[i].m_Stats.m_Handled;
+	}
+	return total;
+}
+
+void Paging::setShootdownIPI (ipi_sender send)
+{
+	s_SendIPI = send;
+}
+
+void Paging::handleShootdown ()
+{
+	shootdown_node *node = (shootdown_node *)_InterlockedExchangePointer((void * volatile *)&s_Mailboxes[native::cpu::index()], nullptr);
+	while (node)
+	{
+		// The node belongs to the initiator, and may be gone as soon as the request is acknowledged.
+		shootdown_node *next = node->m_Next;
+		shootdown_request *request = node->m_Request;
+
+		request->m_Batch->flushLocal();
+		++localStats().m_Handled;
+		_InterlockedDecrement(&request->m_Pending);
+
+		node = next;
+	}
+}
+
+void Paging::tlb_batch::add (u64 virt, u64 size, u64 pageSize)
+{
+	if (m_Everything || size == 0)
+		return;
+
+	u64 start = virt & ~(pageSize - 1);
+	u64 end = (virt + size + pageSize - 1) & ~(pageSize - 1);
+
+	// Unmapping usually walks upwards, so only the last range is worth trying to extend.
+	u32 range = m_Count;
+	if (m_Count > 0)
+	{
+		const u32 last = m_Count - 1;
+		if (m_Step[last] == pageSize && start <= m_End[last] && end >= m_Start[last])
+		{
+			range = last;
+			m_Pages -= (m_End[last] - m_Start[last]) / pageSize;
+			start = start < m_Start[last] ? start : m_Start[last];
+			end = end > m_End[last] ? end : m_End[last];
+		}
+	}
+
+	m_Pages += (end - start) / pageSize;
+	if (m_Pages > s_FullFlushPages || range == sc_BatchRanges)
+	{
+		m_Everything = true;
+		return;
+	}
+
+	m_Start[range] = start;
+	m_End[range] = end;
+	m_Step[range] = pageSize;
+	if (range == m_Count)
+		++m_Count;
+}
+
+void Paging::tlb_batch::flushLocal () const
+{
+	if (m_Everything)
+	{
+		if (m_Space)
+			invalidateAddressSpace(*m_Space);
+		else
+			invalidateAll();
+		return;
+	}
+
+	for (u32 i = 0; i < m_Count; ++i)
+	{
+		for (u64 virt = m_Start[i]; virt < m_End[i]; virt += m_Step[i])
+		{
+			// invlpg drops global translations of the address too, whatever the PCID.
+			if (m_Space)
+				invalidatePage(*m_Space, virt);
+			else
+				native::invlpg((void *)virt);
+		}
+	}
+}
+
+void Paging::tlb_batch::flush ()
+{
+	if (empty())
+		return;
+
+	const u32 self = native::cpu::index();
+	tlb_stats &stats = localStats();
+	++stats.m_Flushes;
+	if (m_Everything)
+		++stats.m_FullFlushes;
+	else
+		stats.m_Pages += m_Pages;
+
+	flushLocal();
+
+	u64 targets = (m_Space ? u64(m_Space->m_CPUs) : onlineCPUs()) & ~(1ULL << self);
+	if (targets != 0 && s_SendIPI)
+	{
+		++stats.m_Shootdowns;
+
+		shootdown_request request;
+		request.m_Batch = this;
+		request.m_Pending = long(native::popcount(targets));
+
+		while (targets != 0)
+		{
+			const u32 cpu = native::lowestBit(targets);
+			targets &= targets - 1;
+
+			shootdown_node &node = request.m_Nodes[cpu];
+			node.m_Request = &request;
+			if (post(cpu, &node))
+			{
+				s_SendIPI(cpu);
+				++stats.m_IPIs;
+			}
+		}
+
+		while (request.m_Pending != 0)
+		{
+			handleShootdown();
+			_mm_pause();
+		}
+	}
+
+	m_Count = 0;
+	m_Pages = 0;
+	m_Everything = false;
+}
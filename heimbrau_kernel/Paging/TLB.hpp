@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "PageTable.hpp"
+#include "AddressSpace.hpp"
+
+// Batched TLB invalidation, on this CPU and every other one that may have the translations cached.
+// Code that changes mappings adds what it changed to a tlb_batch and flushes once at the end, instead of one invlpg
+// (and on SMP, one IPI) per page. Past s_FullFlushPages pages or sc_BatchRanges separate ranges, a batch stops
+// recording and drops the whole address space instead: every non-global translation of it for a user batch, the
+// whole TLB for a kernel one. A long run of invlpg costs more than refilling the TLB.
+//
+// Each flush sends at most one IPI to each other CPU, however large the batch. A CPU that already has an unanswered
+// shootdown IPI gets none: it picks the new request up from its mailbox with the old one. Requests are pushed onto
+// per-CPU lists with compare-and-swap, and targets acknowledge with an atomic decrement, so neither side takes a lock.
+// Nothing sends IPIs until the interrupt code installs a sender with setShootdownIPI; until then flushes are local.
+
+namespace Paging
+{
+	static const u32 sc_BatchRanges = 16;
+
+	// Pages above which a batch drops the whole address space instead. Tunable at any time.
+	extern u32 s_FullFlushPages;
+
+	// Totals over all CPUs.
+	struct tlb_stats
+	{
+		u64	m_Flushes;			// tlb_batch::flush () calls that had anything to flush
+		u64	m_Pages;			// Pages invalidated one by one, on the CPU that flushed
+		u64	m_FullFlushes;		// Flushes that dropped the whole address space instead
+		u64	m_Shootdowns;		// Flushes that had to reach other CPUs
+		u64	m_IPIs;				// IPIs sent. Less than the CPUs reached when IPIs were coalesced.
+		u64	m_Handled;			// Requests handled for other CPUs
+	};
+
+	tlb_stats tlbStats ();
+
+	// Sends the shootdown IPI to a CPU, by cpu::index (). Its handler must call handleShootdown ().
+	typedef void (*ipi_sender) (u32 cpu);
+	void setShootdownIPI (ipi_sender send);
+
+	// Handles every shootdown request waiting for the calling CPU. Called by the IPI handler, and by CPUs waiting
+	// for their own shootdowns to be acknowledged, so two CPUs shooting at each other don't deadlock.
+	void handleShootdown ();
+
+	class tlb_batch
+	{
+		address_space	*m_Space;
+		u64				m_Start[sc_BatchRanges];
+		u64				m_End[sc_BatchRanges];
+		u64				m_Step[sc_BatchRanges];
+		u32				m_Count;
+		u64				m_Pages;
+		bool			m_Everything;
+
+	public:
+		// space is the address space the mappings were changed in, or nullptr for kernel (global) mappings.
+		explicit tlb_batch (address_space *space) : m_Space(space), m_Count(0), m_Pages(0), m_Everything(false) {}
+
+		// Records that [virt, virt + size) changed. pageSize is the size of the pages that were mapped there; one
+		// invalidation per page is enough.
+		void add (u64 virt, u64 size, u64 pageSize = e_Page4K);
+
+		bool empty () const { return m_Count == 0 && !m_Everything; }
+
+		// Invalidates everything added, here and on every other CPU that may have it, and waits until they all have.
+		// The batch is empty afterwards.
+		void flush ();
+
+		// Invalidates everything added on the calling CPU only.
+		void flushLocal () const;
+	};
+}
@@ -0,0 +1,138 @@
+#include "common.hpp"
+
+#include "..\..\heimbrau_asm\hb_asm.hpp"
+
+#include "TablePool.hpp"
+#include "Paging.hpp"
+
+namespace
+{
+	inline volatile u64 * link (u64 phys) { return (volatile u64 *)Paging::phys_to_virt(phys); }
+}
+
+void table_pool::init (frame_source source, frame_sink sink, u32 low, u32 high)
+{
+	m_Head = 0;
+	m_Free = 0;
+	m_Source = source;
+	m_Sink = sink;
+	m_Low = low;
+	m_High = high > low ? high : low;
+
+	m_Allocs = 0;
+	m_Misses = 0;
+	m_Frees = 0;
+	m_Zeroed = 0;
+	m_Released = 0;
+}
+
+void table_pool::push (u64 phys)
+{
+	const u64 entry = (phys >> 12) + 1;
+	volatile u64 *next = link(phys);
+
+	s64 head;
+	s64 replacement;
+	do
+	{
+		head = m_Head;
+		*next = u64(head) & sc_FrameMask;
+		replacement = s64((((u64(head) >> sc_FrameBits) + 1) << sc_FrameBits) | entry);
+	}
+	while (_InterlockedCompareExchange64(&m_Head, replacement, head) != head);
+
+	_InterlockedIncrement64(&m_Free);
+}
+
+u64 table_pool::pop ()
+{
+	s64 head;
+	s64 replacement;
+	u64 phys;
+	do
+	{
+		head = m_Head;
+		const u64 entry = u64(head) & sc_FrameMask;
+		if (entry == 0)
+			return sc_NoFrame;
+
+		// The frame may be popped and reused by someone else meanwhile, making this read garbage. The generation
+		// has moved on if so, and the exchange fails.
+		phys = (entry - 1) << 12;
+		replacement = s64((((u64(head) >> sc_FrameBits) + 1) << sc_FrameBits) | *link(phys));
+	}
+	while (_InterlockedCompareExchange64(&m_Head, replacement, head) != head);
+
+	_InterlockedDecrement64(&m_Free);
+
+	// The rest of the frame is already zero.
+	*link(phys) = 0;
+	return phys;
+}
+
+u64 table_pool::alloc ()
+{
+	u64 phys = pop();
+	if (phys == sc_NoFrame)
+	{
+		_InterlockedIncrement64(&m_Misses);
+		phys = m_Source ? m_Source() : sc_NoFrame;
+		if (phys == sc_NoFrame)
+			return sc_NoFrame;
+		native::mem::zeroPages(Paging::phys_to_virt(phys), Paging::e_Page4K);
+	}
+
+	_InterlockedIncrement64(&m_Allocs);
+	return phys;
+}
+
+void table_pool::free (u64 phys)
+{
+	_InterlockedIncrement64(&m_Frees);
+	push(phys);
+}
+
+u32 table_pool::refill ()
+{
+	u32 added = 0;
+	while (m_Source && u64(m_Free) < m_High)
+	{
+		const u64 phys = m_Source();
+		if (phys == sc_NoFrame)
+			break;
+		native::mem::zeroPages(Paging::phys_to_virt(phys), Paging::e_Page4K);
+		push(phys);
+		++added;
+	}
+
+	_InterlockedExchangeAdd64(&m_Zeroed, added);
+	return added;
+}
+
+u32 table_pool::trim ()
+{
+	u32 released = 0;
+	while (m_Sink && u64(m_Free) > m_High)
+	{
+		const u64 phys = pop();
+		if (phys == sc_NoFrame)
+			break;
+		m_Sink(phys);
+		++released;
+	}
+
+	_InterlockedExchangeAdd64(&m_Released, released);
+	return released;
+}
+
+table_pool::stats table_pool::getStats () const
+{
+	stats s;
+	s.m_Allocs = u64(m_Allocs);
+	s.m_Misses = u64(m_Misses);
+	s.m_Frees = u64(m_Frees);
+	s.m_Zeroed = u64(m_Zeroed);
+	s.m_Released = u64(m_Released);
+	s.m_Free = u64(m_Free);
+	return s;
+}
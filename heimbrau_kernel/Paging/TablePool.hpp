@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.hpp"
+
+// Reserve of zeroed 4 KiB frames for page tables, so building a mapping never waits on zeroing a frame.
+// alloc () and free () are lock-free and O(1): the free frames form a stack linked through their first word, pushed
+// and popped with compare-and-swap on a head that carries a generation count against ABA. Every word of a frame in
+// the pool is zero except that link, which alloc () clears before handing the frame out.
+// Zeroing happens in refill (), which tops the pool up to its high mark from the frame source. Call it wherever
+// there is time to spare; alloc () only zeroes a frame itself when the pool is empty. Tables freed by the mapper
+// are already all zero (they are only freed once empty), so they go straight back in without being touched.
+// Frames are reached through Paging::phys_to_virt.
+
+class table_pool
+{
+public:
+	static const u64 sc_NoFrame = ~0ULL;
+
+	// Where refill () gets frames and trim () returns them. The source returns sc_NoFrame when out of memory.
+	typedef u64 (*frame_source) ();
+	typedef void (*frame_sink) (u64 phys);
+
+	struct stats
+	{
+		u64	m_Allocs;		// Frames handed out
+		u64	m_Misses;		// alloc () calls that found the pool empty and zeroed a frame themselves
+		u64	m_Frees;		// Empty tables taken back
+		u64	m_Zeroed;		// Frames zeroed by refill ()
+		u64	m_Released;		// Frames given back to the sink by trim ()
+		u64	m_Free;			// Frames in the pool right now
+	};
+
+	// Starts out empty. refill () keeps between low and high frames in the pool.
+	void init (frame_source source, frame_sink sink, u32 low, u32 high);
+
+	// A zeroed frame, or sc_NoFrame if the pool is empty and so is the source.
+	u64 alloc ();
+
+	// Takes back a frame whose every word is zero, ie: a table that has become empty.
+	void free (u64 phys);
+
+	// Whether the pool has dropped below its low mark and refill () has work to do.
+	bool low () const { return u64(m_Free) < m_Low; }
+
+	// Zeroes frames from the source until the pool holds its high mark. Returns the number of frames added.
+	u32 refill ();
+
+	// Gives frames above the high mark back to the sink. Returns the number of frames released.
+	u32 trim ();
+
+	stats getStats () const;
+
+private:
+	// Head of the stack: frame number + 1 (0 for empty) in the low sc_FrameBits, generation above.
+	static const u32 sc_FrameBits = 40;
+	static const u64 sc_FrameMask = (1ULL << sc_FrameBits) - 1;
+
+	void push (u64 phys);
+	u64 pop ();
+
+	volatile s64	m_Head;
+	volatile s64	m_Free;
+
+	frame_source	m_Source;
+	frame_sink		m_Sink;
+	u64				m_Low;
+	u64				m_High;
+
+	volatile s64	m_Allocs;
+	volatile s64	m_Misses;
+	volatile s64	m_Frees;
+	volatile s64	m_Zeroed;
+	volatile s64	m_Released;
+};
@@ -0,0 +1,30 @@
+#include "BootProfile.hpp"
+
+#include "../LoaderIO/lio.hpp"
+
+bootprofile::table BootProfile::s_Table;
+
+void BootProfile::finish ()
+{
+	s_Table.m_TotalCycles = native::tsc::stop() - s_Table.m_BootTSC;
+	s_Table.m_TSCHz = native::tsc::s_Hz;
+}
+
+void BootProfile::print ()
+{
+	lio::printf("Boot Profile (TSC %Lu MHz):\n", s_Table.m_TSCHz / 1000000);
+	for (u32 i = 0; i < bootprofile::e_PhaseCount; ++i)
+	{
+		const bootprofile::entry &phase = s_Table.m_Phases[i];
+		lio::printf("\t%-20s %14Lu cycles %10Lu us\n",
+			bootprofile::s_PhaseNames[i],
+			phase.m_Cycles,
+			native::tsc::toMicroseconds(phase.m_Cycles)
+		);
+	}
+	lio::printf("\t%-20s %14Lu cycles %10Lu us\n",
+		"Total",
+		s_Table.m_TotalCycles,
+		native::tsc::toMicroseconds(s_Table.m_TotalCycles)
+	);
+}
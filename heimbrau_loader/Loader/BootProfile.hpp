@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "common/boot_profile.hpp"
+
+// Loader side of the boot phase profiler. The table itself is what gets handed to the kernel.
+namespace BootProfile
+{
+	extern bootprofile::table s_Table;
+
+	// Marks the start of the boot. Call first thing in loader::entry.
+	inline void begin ()
+	{
+		s_Table.m_BootTSC = native::tsc::start();
+	}
+
+	// Times the enclosing scope as the given phase.
+	class scope
+	{
+		bootprofile::entry				&m_Entry;
+		native::tsc::scoped_timer		m_Timer;
+
+		scope & operator = (const scope &);
+	public:
+		scope (bootprofile::phase p) :
+			m_Entry(s_Table.m_Phases[p]),
+			m_Timer(s_Table.m_Phases[p].m_Cycles)
+		{
+			m_Entry.m_Start = native::tsc::start() - s_Table.m_BootTSC;
+		}
+	};
+
+	// Records the total and the TSC frequency. Call once all phases are done.
+	void finish ();
+
+	// Prints the cycle/microsecond breakdown of every phase.
+	void print ();
+}
@@ -0,0 +1,142 @@
+#include "KernelImage.hpp"
+
+// MMK : For hashing
+#include "common/hash.hpp"
+
+#include "../LoaderIO/lio.hpp"
+#include "PhysicalMemory.hpp"
+
+namespace kerneldata
+{
+#	include "..\..\bin64\kernel_kdf.hpp"
+}
+
+namespace
+{
+	static const u64 sc_ImageSize = (kerneldata::kernelSize + 4095) & ~4095ULL;
+
+	// Finds the extent backing the given image offset. Extents are in image order, and so are sections, so the
+	// search normally starts at the last one used.
+	inline const KernelImage::extent & extentAt (const KernelImage::extent *extents, u32 count, u32 &cursor, u64 offset)
+	{
+		if (offset < extents[cursor].m_Offset)
+			cursor = 0;
+		while (cursor + 1 < count && offset >= extents[cursor].m_Offset + extents[cursor].m_Size)
+			++cursor;
+		return extents[cursor];
+	}
+
+	// Physical address backing offset, and the bytes from there to the end of its extent (or size if that comes first).
+	// The loader runs identity mapped, so the physical address can be written through directly.
+	inline u8 * chunkAt (const KernelImage::extent &e, u64 offset, u64 size, u64 &chunk)
+	{
+		const u64 toEnd = e.m_Offset + e.m_Size - offset;
+		chunk = toEnd < size ? toEnd : size;
+		return (u8 *)(e.m_Physical + (offset - e.m_Offset));
+	}
+}
+
+u32 KernelImage::Allocate (extent *extents)
+{
+	const u64 pages = sc_ImageSize / frame_bitmap::sc_FrameSize;
+	frame_bitmap &frames = PhysicalMemory::s_Frames;
+	// Place () writes the image through its physical address.
+	const u64 limit = PhysicalMemory::s_IdentityLimit;
+
+	// One aligned run is the best case: one extent, and mappable with large pages.
+	u64 run = frames.allocRun(pages, sc_LargeAlignment, limit);
+	if (run == frame_bitmap::sc_NoFrame)
+		run = frames.allocRun(pages, frame_bitmap::sc_FrameSize, limit);
+	if (run != frame_bitmap::sc_NoFrame)
+	{
+		extents[0].m_Physical = run;
+		extents[0].m_Offset = 0;
+		extents[0].m_Size = sc_ImageSize;
+		return 1;
+	}
+
+	// Memory is too fragmented for that. Take the largest pieces we can get, halving the request each time
+	// nothing that size is left.
+	u32 count = 0;
+	u64 offset = 0;
+	u64 want = pages;
+	while (offset < sc_ImageSize)
+	{
+		const u64 remaining = (sc_ImageSize - offset) / frame_bitmap::sc_FrameSize;
+		if (want > remaining)
+			want = remaining;
+
+		run = (count < sc_MaxExtents) ? frames.allocRun(want, frame_bitmap::sc_FrameSize, limit) : frame_bitmap::sc_NoFrame;
+		if (run == frame_bitmap::sc_NoFrame)
+		{
+			want /= 2;
+			if (want != 0 && count < sc_MaxExtents)
+				continue;
+
+			// Out of memory, or out of extents. Give back what we took.
+			for (u32 i = 0; i < count; ++i)
+				frames.freeRun(extents[i].m_Physical, extents[i].m_Size / frame_bitmap::sc_FrameSize);
+			lio::printf("Could not place the kernel image (%Lu bytes) in %u extents\n", sc_ImageSize, sc_MaxExtents);
+			return 0;
+		}
+
+		extents[count].m_Physical = run;
+		extents[count].m_Offset = offset;
+		extents[count].m_Size = want * frame_bitmap::sc_FrameSize;
+		offset += extents[count].m_Size;
+		++count;
+	}
+
+	return count;
+}
+
+u32 KernelImage::Place (const extent *extents, u32 count)
+{
+	u32 mismatches = 0;
+	u32 cursor = 0;
+
+	for (u32 i = 0; i < kerneldata::numSections; ++i)
+	{
+		const kerneldata::sectionMap &section = kerneldata::sectionMaps[i];
+
+		const u64 start = u64(section.mSectionLogicalAddress) - kerneldata::kernelBase;
+		const u64 logicalSize = section.mSectionLogicalSize;
+		const u64 rawSize = section.mSectionRawSize < logicalSize ? section.mSectionRawSize : logicalSize;
+
+		// The copy is split wherever the section crosses from one extent into the next.
+		// The hash state carries across the splits.
+		xxh::state hash;
+		hash.init();
+
+		u64 offset = 0;
+		while (offset < rawSize)
+		{
+			u64 chunk;
+			u8 * const dst = chunkAt(extentAt(extents, count, cursor, start + offset), start + offset, rawSize - offset, chunk);
+			hash.copyUpdate(dst, section.mSectionRawAddress + offset, chunk);
+			offset += chunk;
+		}
+
+		// Everything past the raw data (ie: .bss) is zero.
+		while (offset < logicalSize)
+		{
+			u64 chunk;
+			u8 * const dst = chunkAt(extentAt(extents, count, cursor, start + offset), start + offset, logicalSize - offset, chunk);
+			native::mem::zeroPages(dst, chunk);
+			offset += chunk;
+		}
+
+		if (rawSize != 0)
+		{
+			const u64 digest = hash.digest();
+			if (digest != section.mHash)
+			{
+				lio::printf("Section %u at 0x%016LX: hash mismatch, expected 0x%016LX got 0x%016LX\n",
+					i, u64(section.mSectionLogicalAddress), section.mHash, digest);
+				++mismatches;
+			}
+		}
+	}
+
+	return mismatches;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace KernelImage
+{
+	// Most extents the kernel image is ever split into. Placement fails rather than going past this.
+	static const u32 sc_MaxExtents = 16;
+	// Alignment placement tries for first, so the kernel can be mapped with 2 MiB pages.
+	static const u64 sc_LargeAlignment = 0x200000;
+
+	// A physically contiguous piece of the kernel image.
+	struct extent
+	{
+		u64	m_Physical;		// Physical address
+		u64	m_Offset;		// Offset into the image (from kerneldata::kernelBase)
+		u64	m_Size;			// Bytes, a multiple of 4 KiB
+	};
+
+	// Allocates physical memory for the whole kernel image from PhysicalMemory::s_Frames, below
+	// PhysicalMemory::s_IdentityLimit, as a single sc_LargeAlignment aligned run if there is one, then a single
+	// unaligned run, then as few runs as possible.
+	// Extents are in image order. Returns the number of extents used, or 0 if memory ran out.
+	extern u32 Allocate (extent *extents);
+
+	// Copies every kernel section into the extents from Allocate and zero-fills whatever is past each section's
+	// raw data.
+	// Each section's hash is computed in the same pass as the copy and checked against the one kdfgen recorded.
+	// Returns the number of sections that did not match.
+	extern u32 Place (const extent *extents, u32 count);
+}
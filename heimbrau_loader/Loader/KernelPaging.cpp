@@ -0,0 +1,130 @@
+#include "KernelPaging.hpp"
+#include "PhysicalMemory.hpp"
+
+#include "../LoaderIO/lio.hpp"
+
+namespace kerneldata
+{
+#	include "..\..\bin64\kernel_kdf.hpp"
+}
+
+u64 KernelPaging::s_PML4 = Paging::sc_NoTable;
+Paging::map_stats KernelPaging::s_Stats;
+table_pool KernelPaging::s_Tables;
+
+namespace
+{
+	// Frames kept zeroed for the kernel's tables. Building the direct map of a large machine takes a few hundred.
+	const u32 sc_TablesLow = 64;
+	const u32 sc_TablesHigh = 256;
+
+	// Legacy VGA text memory. Not RAM, so the RAM runs never cover it.
+	const u64 sc_VGABase = 0xB8000;
+	const u64 sc_VGASize = 0x8000;
+
+	u64 allocFrame () { return PhysicalMemory::AllocFrame(); }
+	void freeFrame (u64 phys) { PhysicalMemory::FreeFrame(phys); }
+
+	inline bool isRAM (u32 type)
+	{
+		return type == MemoryMap::e_TypeUsable || type == MemoryMap::e_TypeACPI || type == MemoryMap::e_TypeNVS;
+	}
+}
+
+bool KernelPaging::Build (const SimpleMemoryEntry *_mmap, u32 entries, const KernelImage::extent *extents, u32 count)
+{
+	native::mem::fillBytes(&s_Stats, 0, sizeof(Paging::map_stats));
+
+	s_Tables.init(allocFrame, freeFrame, sc_TablesLow, sc_TablesHigh);
+	s_Tables.refill();
+
+	s_PML4 = Paging::createTable(s_Tables, s_Stats);
+	if (s_PML4 == Paging::sc_NoTable)
+		return false;
+
+	const Paging::page_size largest = Paging::largestPageSize();
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		const KernelImage::extent &e = extents[i];
+		if (!Paging::mapRange(s_PML4, kerneldata::kernelBase + e.m_Offset, e.m_Physical, e.m_Size, Paging::sc_Writable | Paging::sc_Global, largest, s_Tables, s_Stats))
+		{
+			lio::printf("Could not map kernel extent %u\n", i);
+			return false;
+		}
+	}
+
+	// Neighbouring RAM entries of different types are mapped as one run, so large pages can span the boundary.
+	u32 i = 0;
+	while (i < entries)
+	{
+		if (!isRAM(_mmap[i].type))
+		{
+			++i;
+			continue;
+		}
+
+		const u64 start = _mmap[i].offset & ~0xFFFULL;
+		u64 end = _mmap[i].offset + _mmap[i].extent;
+		for (++i; i < entries && isRAM(_mmap[i].type) && _mmap[i].offset == end; ++i)
+			end = _mmap[i].offset + _mmap[i].extent;
+
+		if (start >= Paging::s_DirectMapSize)
+		{
+			lio::printf("RAM 0x%016LX - 0x%016LX is past the direct map, not mapped\n", start, end);
+			continue;
+		}
+		if (end > Paging::s_DirectMapSize)
+			end = Paging::s_DirectMapSize;
+
+		// Between runs is as good a time as any to zero more tables, so the mapper itself never has to.
+		if (s_Tables.low())
+			s_Tables.refill();
+
+		// The direct map base is top level slot aligned, so every physical alignment carries over to the virtual side.
+		if (!Paging::mapRange(s_PML4, Paging::s_DirectMapBase + start, start, end - start, Paging::sc_Writable | Paging::sc_Global, largest, s_Tables, s_Stats) ||
+			Paging::translate(s_PML4, Paging::s_DirectMapBase + end - 1) != end - 1)
+		{
+			lio::printf("Could not map RAM 0x%016LX - 0x%016LX\n", start, end);
+			return false;
+		}
+	}
+
+	// VGA text memory at its direct map address, write-combining, for the kernel's console.
+	if (!Paging::mapRange(s_PML4, Paging::s_DirectMapBase + sc_VGABase, sc_VGABase, sc_VGASize,
+		Paging::sc_Writable | Paging::sc_Global | Paging::sc_CacheWC, Paging::e_Page4K, s_Tables, s_Stats))
+	{
+		lio::printf("Could not map VGA memory\n");
+		return false;
+	}
+
+	// The kernel starts out with a full reserve.
+	s_Tables.refill();
+
+	// Every page of the image must lead back to where Place put it.
+	for (u32 e = 0; e < count; ++e)
+	{
+		const KernelImage::extent &ext = extents[e];
+		for (u64 offset = 0; offset < ext.m_Size; offset += Paging::e_Page4K)
+		{
+			if (Paging::translate(s_PML4, kerneldata::kernelBase + ext.m_Offset + offset) != ext.m_Physical + offset)
+			{
+				lio::printf("Kernel image offset 0x%LX does not translate to its extent\n", ext.m_Offset + offset);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void KernelPaging::Print ()
+{
+	lio::printf("Kernel PML%u: 0x%016LX, direct map at 0x%016LX\n", Paging::s_Levels, s_PML4, Paging::s_DirectMapBase);
+	lio::printf("Kernel Pages 4K/2M/1G: %Lu / %Lu / %Lu, %Lu tables (%Lu KiB)\n",
+		s_Stats.m_Pages4K, s_Stats.m_Pages2M, s_Stats.m_Pages1G, s_Stats.m_Tables, (s_Stats.m_Tables * Paging::e_Page4K) / 1024);
+
+	const table_pool::stats tables = s_Tables.getStats();
+	lio::printf("Table pool: %Lu allocated, %Lu zeroed on demand, %Lu zeroed ahead, %Lu free\n",
+		tables.m_Allocs, tables.m_Misses, tables.m_Zeroed, tables.m_Free);
+}
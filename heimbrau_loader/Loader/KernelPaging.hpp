@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "MemoryMap.hpp"
+#include "KernelImage.hpp"
+#include "heimbrau_kernel\Paging\Paging.hpp"
+
+namespace KernelPaging
+{
+	// Physical address of the kernel's top level table (a PML5 if Paging::initLevels found LA57 on). Valid once Build
+	// has returned true.
+	extern u64 s_PML4;
+	// Pages and tables Build used.
+	extern Paging::map_stats s_Stats;
+	// Zeroed frames for the kernel's page tables, from PhysicalMemory. Handed to the kernel with what is left in it.
+	extern table_pool s_Tables;
+
+	// Builds the kernel's page tables: the kernel image at kerneldata::kernelBase, and every RAM range of the memory
+	// map (usable, ACPI and NVS) in the direct map at Paging::s_DirectMapBase. Both use the largest pages their
+	// alignment allows. RAM past Paging::s_DirectMapSize is left out. Both are global, so they stay in the TLB
+	// across address space switches. VGA text memory goes in the direct map too, write-combining.
+	// Tables come from s_Tables, filled from PhysicalMemory::AllocFrame, so InitBuddy must have run. Returns false if memory ran out or
+	// the kernel image did not translate back to its extents.
+	extern bool Build (const SimpleMemoryEntry *_mmap, u32 entries, const KernelImage::extent *extents, u32 count);
+
+	// Prints the page and table counts, and the s_Tables counters.
+	extern void Print ();
+}
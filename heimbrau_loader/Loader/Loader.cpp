@@ -4,6 +4,14 @@
 #include "common/hash.hpp"
 
 #include "MemoryMap.hpp"
+#include "NUMA.hpp"
+#include "PhysicalMemory.hpp"
+#include "BootProfile.hpp"
+#include "KernelImage.hpp"
+#include "KernelPaging.hpp"
+#include "TLBBench.hpp"
+
+#include "heimbrau_kernel\Paging\AddressSpace.hpp"
 
 #include "../LoaderIO/lio.hpp"
 
@@ -12,33 +20,117 @@ namespace kerneldata
 #	include "..\..\bin64\kernel_kdf.hpp"
 }
 
-// Gets basic memory information.
-// We pass in the memory map, which is sorted and cleaned.
-// nentries it the number of entries in the input memory map.
-// This function is sort of complex. It will determine the number of 4k pages requires to store the kernel image.
-// It takes an array (allocPages) of pointers that it will populate with physical page addresses that are to be 
-// used for the kernel, none of them being less than the value of startAt.
-extern void getKernelPPages (const SimpleMemoryEntry *, u32, void **, u64);
-
-// These are used to store physical pointers for the lPPA
-// These are the actual physical pages that will be used to store the kernel image.
-static void *s_AllocationPages[
-	((kerneldata::kernelSize % 4096) == 0) ? 
-		kerneldata::kernelSize / 4096:
-		(kerneldata::kernelSize + (4096 - (kerneldata::kernelSize % 4096))) / 4096
-];
+// Physical extents holding the kernel image, filled in by KernelImage::Allocate.
+static KernelImage::extent s_KernelExtents[KernelImage::sc_MaxExtents];
+static u32 s_KernelExtentCount = 0;
+
+// Cleaned up memory map, filled in by MemoryMap::Process.
+static SimpleMemoryEntry s_MemoryMap[MemoryMap::sc_MaxCleanEntries];
 
 // Multiboot 2 Header
 extern volatile multiboot2::header mb2_header;
 
+// Whether option appears as a whole word on the command line the boot loader passed.
+static bool hasOption (const multiboot2::info &mbinfo, const char *option)
+{
+	if (!(mbinfo.m_Flags & multiboot2::e_InfoCmdLine) || mbinfo.m_CmdLine == 0)
+		return false;
+
+	const char *p = (const char *)u64(mbinfo.m_CmdLine);
+	while (*p)
+	{
+		while (*p == ' ')
+			++p;
+
+		const char *o = option;
+		while (*o && *p == *o)
+		{
+			++p;
+			++o;
+		}
+		if (*o == '\0' && (*p == ' ' || *p == '\0'))
+			return true;
+
+		while (*p && *p != ' ')
+			++p;
+	}
+	return false;
+}
+
+// Remaps VGA text memory write-combining in the loader's identity map, so the console's copies go out as bursts
+// instead of uncached stores. This splits the 2 MiB page it sits in; the new table comes from PhysicalMemory, and the
+// boot tables being split are static, so nothing is ever freed.
+static bool mapVideoWriteCombining ()
+{
+	const u64 base = u64(lio::s_VideoOut);
+	const u64 size = 80 * 25 * sizeof(lio::character);
+	const u64 start = base & ~0xFFFULL;
+	const u64 end = (base + size + 0xFFF) & ~0xFFFULL;
+
+	const u64 pml4 = native::readCR(3) & Paging::sc_AddressMask;
+	Paging::map_stats stats;
+	native::mem::fillBytes(&stats, 0, sizeof(Paging::map_stats));
+
+	if (!Paging::unmapRange(pml4, start, end - start, PhysicalMemory::AllocFrame, nullptr, stats) ||
+		!Paging::mapRange(pml4, start, start, end - start, Paging::sc_Writable | Paging::sc_CacheWC, Paging::e_Page4K, PhysicalMemory::AllocFrame, stats))
+	{
+		return false;
+	}
+
+	// invlpg anywhere in the old 2 MiB translation drops all of it.
+	for (u64 v = start; v < end; v += Paging::e_Page4K)
+		native::invlpg((void *)v);
+	return true;
+}
+
 __declspec(noreturn)
 void loader::entry (const multiboot2::info &mbinfo, u64 magic)
 {
+	BootProfile::begin();
+
 	// Enable SSE support, used by VC++ for lots of things including variadics.
 	native::enableSSE();
 
-	// Initialize Loader I/O (really just O)
-	lio::init();
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseCPUInit);
+
+		// Probe the CPU once and enable AVX state in XCR0 where supported.
+		native::cpu::init();
+
+		// Select the copy/fill engine used by native::memcpy/memset.
+		native::mem::init();
+
+		// Determine the TSC frequency, for the boot profile.
+		native::tsc::init();
+
+		// 4 or 5 levels, as mb2_entry left it. Everything that builds tables or uses the direct map goes by this.
+		Paging::initLevels();
+
+		// Global pages and PCIDs, so the kernel's address space switches keep what they can in the TLB.
+		Paging::initTLB();
+
+		// Memory types for sc_CacheWC and friends.
+		Paging::initPAT();
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseLIOInit);
+
+		// Initialize Loader I/O (really just O)
+		lio::init();
+	}
+
+	{
+		const native::cpu::features &cpu = native::cpu::get();
+		lio::printf("CPU: %s family 0x%X model 0x%X stepping %u\n", cpu.m_VendorString, cpu.m_Family, cpu.m_Model, cpu.m_Stepping);
+		lio::printf("CPU: SSE4.2 %u AVX %u AVX2 %u AVX512F %u ERMSB %u FSRM %u\n",
+			u32(cpu.m_SSE42), u32(cpu.m_AVX), u32(cpu.m_AVX2), u32(cpu.m_AVX512F), u32(cpu.m_ERMSB), u32(cpu.m_FSRM));
+		lio::printf("CPU: 1GB %u PCID %u INVPCID %u x2APIC %u TSC-deadline %u invariant TSC %u\n",
+			u32(cpu.m_Page1GB), u32(cpu.m_PCID), u32(cpu.m_INVPCID), u32(cpu.m_x2APIC), u32(cpu.m_TSCDeadline), u32(cpu.m_InvariantTSC));
+		lio::printf("CPU: global pages %u PCIDs %u INVPCID %u enabled, %u-level paging (LA57 %u)\n",
+			u32(Paging::globalPages()), u32(Paging::pcids()), u32(Paging::invpcid()), Paging::s_Levels, u32(cpu.m_LA57));
+		lio::printf("CPU: XCR0 0x%LX XSAVE %u/%u bytes\n", cpu.m_XCR0, cpu.m_XSAVESize, cpu.m_XSAVEMaxSize);
+	}
 
 	lio::printf("Testing LIO: 0x%016LX 0x%016LX \n", &mbinfo, magic);
 	lio::printf("Test\n");
@@ -48,23 +140,109 @@ void loader::entry (const multiboot2::info &mbinfo, u64 magic)
 
 	u32 entries = 0;
 	
-	SimpleMemoryEntry *smmap = (SimpleMemoryEntry *)mbinfo.m_MemoryMapAddress;
-	MemoryMap::Process(smmap, entries, mbinfo);
-
-	// Get physical pages for the kernel.
-	getKernelPPages(
-		smmap,
-		entries,
-		s_AllocationPages,
-		mb2_header.m_LoadEndAddress > mb2_header.m_BSSEndAddress ? 
-			mb2_header.m_LoadEndAddress : mb2_header.m_BSSEndAddress
-	);
-	lio::printf("Physical Pages Prepared:\n");
-	for (u32 i = 0; i < sizeof(s_AllocationPages) / sizeof(void *); ++i)
+	SimpleMemoryEntry *smmap = s_MemoryMap;
 	{
-		lio::printf("\tPP %u: 0x%016LX\n", i, s_AllocationPages[i]);
+		BootProfile::scope _phase(bootprofile::e_PhaseMemoryMap);
+		MemoryMap::Process(smmap, entries, mbinfo);
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseNUMA);
+
+		// Node topology from ACPI, and the memory map split so every entry is on a single node.
+		NUMA::Init();
+		NUMA::Tag(smmap, entries, MemoryMap::sc_MaxCleanEntries);
+		NUMA::Print();
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseFrameInit);
+
+		// Everything below the end of the loader image stays where it is.
+		const u64 imageEnd = mb2_header.m_LoadEndAddress > mb2_header.m_BSSEndAddress ? 
+			mb2_header.m_LoadEndAddress : mb2_header.m_BSSEndAddress;
+		if (!PhysicalMemory::Init(smmap, entries, imageEnd))
+		{
+			native::stop();
+		}
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseKernelExtents);
+
+		// Get physical memory for the kernel.
+		s_KernelExtentCount = KernelImage::Allocate(s_KernelExtents);
+		if (s_KernelExtentCount == 0)
+		{
+			native::stop();
+		}
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhasePlaceKernel);
+
+		// Copy the kernel into place, verifying each section on the way.
+		const u32 mismatches = KernelImage::Place(s_KernelExtents, s_KernelExtentCount);
+		if (mismatches != 0)
+		{
+			lio::printf("Kernel image is corrupt: %u section(s) failed verification\n", mismatches);
+			native::stop();
+		}
+		lio::printf("Kernel image placed and verified: %u sections\n", u32(kerneldata::numSections));
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseBuddyInit);
+
+		// Early allocations are done. Everything left over goes to the buddy allocators of the nodes owning it.
+		if (!PhysicalMemory::InitBuddy(smmap, entries, NUMA::s_Topology))
+		{
+			native::stop();
+		}
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseVideoWC);
+
+		// If this fails the console stays as it was: uncached.
+		if (native::cpu::get().m_PAT && !mapVideoWriteCombining())
+		{
+			lio::printf("Could not remap video memory write-combining\n");
+		}
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseKernelPaging);
+
+		// Kernel image and RAM, with large pages wherever the layout allows.
+		if (!KernelPaging::Build(smmap, entries, s_KernelExtents, s_KernelExtentCount))
+		{
+			native::stop();
+		}
+		KernelPaging::Print();
+	}
+
+	if (hasOption(mbinfo, "tlbbench"))
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseTLBBench);
+		TLBBench::Run();
+	}
+
+	{
+		BootProfile::scope _phase(bootprofile::e_PhaseExtentDump);
+
+		lio::printf("Kernel Extents:\n");
+		for (u32 i = 0; i < s_KernelExtentCount; ++i)
+		{
+			const KernelImage::extent &e = s_KernelExtents[i];
+			lio::printf("\tExtent %u: 0x%016LX | +0x%08LX | %Lu KiB%s\n", i, e.m_Physical, e.m_Offset, e.m_Size / 1024,
+				(e.m_Physical % KernelImage::sc_LargeAlignment) == 0 ? " (2 MiB aligned)" : "");
+		}
 	}
 
+	// BootProfile::s_Table is what gets handed to the kernel.
+	BootProfile::finish();
+	BootProfile::print();
 
 	native::stop();
 }
@@ -2,7 +2,7 @@
 
 #include "common.hpp"
 
-#include "heimbrau_loader\Multiboot2\Multiboot2.hpp"
+#include "../Multiboot2/Multiboot2.hpp"
 
 #pragma pack(push, 1)
 struct SimpleMemoryEntry
@@ -10,113 +10,55 @@ struct SimpleMemoryEntry
 	u64 offset;
 	u64 extent;
 	u32 type;
-
-	// Cleans up and sorts the input Memory Map
-	static void cleanup (SimpleMemoryEntry *entrylist, u32 &entries)
-	{
-		// sort first. Let's do a trivial bubble sort.
-		for (u32 i = 0; i < entries; ++i)
-		{
-			uintptr_t offset = entrylist[i].offset;
-
-			u32 nindex = -1U;
-
-			for (u32 ii = i + 1; ii < entries; ++ii)
-			{
-				uintptr_t offset2 = entrylist[ii].offset;
-			
-				if (offset2 < offset)
-				{
-					if (nindex == -1ULL || entrylist[nindex].offset > offset2)
-					{
-						nindex = ii;
-					}
-				}
-			}
-
-			if (nindex != -1U)
-			{
-				// Swap!
-				SimpleMemoryEntry temp = entrylist[i];
-				entrylist[i] = entrylist[nindex];
-				entrylist[nindex] = temp;
-			}
-		}
-
-		// Merge
-		// TODO edge cases where the next entry is entirely inside the current entry, and actually ends before the current one.
-		for (u32 i = 0; i < entries; ++i)
-		{
-			SimpleMemoryEntry &entry = entrylist[i];
-
-			if (i < entries - 1)
-			{
-				// This means that one still exists after it.
-				SimpleMemoryEntry &nextentry = entrylist[i + 1];
-				if (nextentry.offset <= entry.offset + entry.extent)
-				{
-					// If it's a different type, we need to do different stuff.
-					if (nextentry.type != entry.type)
-					{
-						if (nextentry.type > entry.type)
-						{
-							// They are a higher priority, they get the overlap.
-							uintptr_t diff = nextentry.offset - (entry.offset + entry.extent);
-							entry.extent -= diff;
-							if (entry.extent == 0)
-							{
-								uint64_t count = (entries - 2) - i;
-
-								if (count)
-									native::memcpy(&entry, (&entry) + 1, sizeof(SimpleMemoryEntry) * count);
-
-								--entries;
-							}
-						}
-						else
-						{
-							// They are of a lower priority, we get the overlap.
-							uintptr_t diff = (entry.offset + entry.extent) - nextentry.offset;
-							nextentry.offset += diff;
-							nextentry.extent -= diff;
-
-							if (nextentry.extent == 0)
-							{
-								u32 count = (entries - 2) - i;
-
-								if (count)
-									native::memcpy(&nextentry, (&nextentry) + 1, sizeof(SimpleMemoryEntry) * count);
-
-								--entries;
-							}
-						}
-					}
-					else
-					{
-						// Need to eliminate it!
-
-						uintptr_t end = nextentry.offset + nextentry.extent;
-						end = end - (entry.offset + entry.extent);
-
-						entry.extent += end;
-
-						u32 count = (entries - 2) - i;
-						if (count)
-							native::memcpy(&nextentry, (&nextentry) + 1, sizeof(SimpleMemoryEntry) * count);
-
-						--entries;
-
-						// Decrement i so we can check again.
-						--i;
-					}
-				}
-			}
-		}
-	}
+	u32 node;	// NUMA node, filled in by NUMA::Tag. 0 until then.
+
+	// Sorts and normalizes the input Memory Map into output.
+	// Overlaps are resolved by type priority, from the top: bad, reserved (and unknown types), NVS, ACPI, usable. Usable
+	// memory never covers anything else, and ACPI reclaimable memory never covers anything that must stay untouched.
+	// Adjacent ranges of the same type are merged, and empty ranges are dropped. input is left untouched.
+	// output must have room for (2 * entries) - 1 entries, the most that entries ranges can split into.
+	// Returns the number of entries written to output.
+	static u32 cleanup (const SimpleMemoryEntry *input, u32 entries, SimpleMemoryEntry *output);
 };
 #pragma pack(pop)
 
 namespace MemoryMap
 {
+	// Most entries accepted from the firmware. Anything past this is dropped with a warning.
+	static const u32 sc_MaxEntries = 1024;
+	// Size of the output buffer Process needs.
+	static const u32 sc_MaxCleanEntries = sc_MaxEntries * 2;
+
+	// Memory map entry types, as reported by Multiboot.
+	enum
+	{
+		e_TypeUsable		= 1,
+		e_TypeReserved		= 2,
+		e_TypeACPI			= 3,	// ACPI tables, reclaimable once they have been read
+		e_TypeNVS			= 4,	// ACPI non-volatile storage, must be preserved
+		e_TypeBad			= 5,
+	};
+
+	// Summary of a cleaned up memory map.
+	struct stats
+	{
+		u64	m_UsableBytes;
+		u64	m_UsablePages;			// Whole 4 KiB pages inside usable ranges
+		u64	m_ReservedBytes;		// Reserved, bad and unknown types
+		u64	m_ACPIBytes;
+		u64	m_NVSBytes;
+		u64	m_LargestRunOffset;		// Largest contiguous usable range
+		u64	m_LargestRunBytes;
+		u64	m_HighestUsableAddress;	// End of the last usable range
+	};
+
+	// Stats for the map built by Process.
+	extern stats s_Stats;
+
+	// Computes the stats for a cleaned up memory map. O(entries), independent of the amount of memory.
+	extern stats Summarize (const SimpleMemoryEntry *_mmap, u32 entries);
+
+	// Reads the Multiboot memory map, and writes the cleaned up map into _mmap, which must have room for
+	// sc_MaxCleanEntries entries. entries is set to the number of entries written, and s_Stats is filled in.
 	extern void Process (SimpleMemoryEntry *_mmap, u32 &entries, const multiboot2::info &mbinfo);
 }
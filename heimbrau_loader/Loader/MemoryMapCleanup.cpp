@@ -0,0 +1,170 @@
+#include "MemoryMap.hpp"
+
+#include "common/sort.hpp"
+
+// The memory map arithmetic, apart from Process so it doesn't pull in the loader's console: heimbrau_bench builds
+// this file on the host and checks it against a model.
+
+namespace
+{
+	// A range start or end, for the cleanup sweep.
+	struct boundary
+	{
+		u64	address;
+		u32	type;
+		s32	delta;		// +1 for a start, -1 for an end
+	};
+
+	boundary s_Boundaries[MemoryMap::sc_MaxEntries * 2];
+
+	// Types are tracked by count while sweeping. Anything we don't know about is treated as reserved.
+	static const u32 sc_TypeCount = MemoryMap::e_TypeBad + 1;
+	static const u32 sc_TypeReserved = MemoryMap::e_TypeReserved;
+
+	inline u32 clampType (u32 type)
+	{
+		return (type == 0 || type >= sc_TypeCount) ? sc_TypeReserved : type;
+	}
+
+	// Who wins an overlap, first to last. Type values are not in this order: ACPI (3) is only reclaimable, so reserved
+	// (2) must beat it, or reserved memory would end up mapped and handed out as RAM once the tables are read.
+	const u32 sc_ByPriority[] = {
+		MemoryMap::e_TypeBad, MemoryMap::e_TypeReserved, MemoryMap::e_TypeNVS, MemoryMap::e_TypeACPI, MemoryMap::e_TypeUsable,
+	};
+	static_assert(sizeof(sc_ByPriority) / sizeof(sc_ByPriority[0]) == sc_TypeCount - 1, "Every type needs a priority");
+}
+
+u32 SimpleMemoryEntry::cleanup (const SimpleMemoryEntry *input, u32 entries, SimpleMemoryEntry *output)
+{
+	if (entries > MemoryMap::sc_MaxEntries)
+		entries = MemoryMap::sc_MaxEntries;
+
+	// Every range becomes a start and an end boundary.
+	u32 nboundaries = 0;
+	for (u32 i = 0; i < entries; ++i)
+	{
+		const SimpleMemoryEntry &entry = input[i];
+		if (entry.extent == 0)
+			continue;
+
+		u64 end = entry.offset + entry.extent;
+		if (end < entry.offset)
+			end = ~0ULL; // Wrapped. Clamp to the top of the address space.
+
+		const u32 type = clampType(entry.type);
+
+		boundary &start = s_Boundaries[nboundaries++];
+		start.address = entry.offset;
+		start.type = type;
+		start.delta = 1;
+
+		boundary &finish = s_Boundaries[nboundaries++];
+		finish.address = end;
+		finish.type = type;
+		finish.delta = -1;
+	}
+
+	sort::heapSort(s_Boundaries, nboundaries, [] (const boundary &a, const boundary &b) { return a.address < b.address; });
+
+	// Sweep the boundaries in address order. Between two consecutive addresses the range belongs to the open type
+	// that comes first in sc_ByPriority. Containment and partial overlaps both fall out of this.
+	u32 active[sc_TypeCount] = { 0 };
+	u32 current = 0;
+	u64 previous = 0;
+	u32 count = 0;
+
+	u32 i = 0;
+	while (i < nboundaries)
+	{
+		const u64 address = s_Boundaries[i].address;
+
+		if (current != 0 && address > previous)
+		{
+			SimpleMemoryEntry *last = count ? &output[count - 1] : nullptr;
+			if (last && last->type == current && last->offset + last->extent == previous)
+			{
+				last->extent += address - previous;
+			}
+			else
+			{
+				output[count].offset = previous;
+				output[count].extent = address - previous;
+				output[count].type = current;
+				output[count].node = 0;
+				++count;
+			}
+		}
+
+		// Apply everything at this address before deciding what follows it.
+		for (; i < nboundaries && s_Boundaries[i].address == address; ++i)
+		{
+			active[s_Boundaries[i].type] += s_Boundaries[i].delta;
+		}
+
+		current = 0;
+		for (u32 p = 0; p < sc_TypeCount - 1; ++p)
+		{
+			if (active[sc_ByPriority[p]] != 0)
+			{
+				current = sc_ByPriority[p];
+				break;
+			}
+		}
+
+		previous = address;
+	}
+
+	return count;
+}
+
+MemoryMap::stats MemoryMap::Summarize (const SimpleMemoryEntry *_mmap, u32 entries)
+{
+	stats st;
+	native::mem::fillBytes(&st, 0, sizeof(stats));
+
+	for (u32 i = 0; i < entries; ++i)
+	{
+		const SimpleMemoryEntry &entry = _mmap[i];
+		const u64 end = entry.offset + entry.extent;
+
+		switch (entry.type)
+		{
+		case e_TypeUsable:
+			{
+				st.m_UsableBytes += entry.extent;
+
+				// Only whole pages count. Round the start up and the end down.
+				const u64 first = (entry.offset + 4095) & ~4095ULL;
+				const u64 last = end & ~4095ULL;
+				if (last > first)
+				{
+					st.m_UsablePages += (last - first) / 4096;
+				}
+
+				// cleanup merges adjacent usable ranges, so every entry is already a maximal run.
+				if (entry.extent > st.m_LargestRunBytes)
+				{
+					st.m_LargestRunOffset = entry.offset;
+					st.m_LargestRunBytes = entry.extent;
+				}
+
+				if (end > st.m_HighestUsableAddress)
+				{
+					st.m_HighestUsableAddress = end;
+				}
+			}
+			break;
+		case e_TypeACPI:
+			st.m_ACPIBytes += entry.extent;
+			break;
+		case e_TypeNVS:
+			st.m_NVSBytes += entry.extent;
+			break;
+		default:
+			st.m_ReservedBytes += entry.extent;
+			break;
+		}
+	}
+
+	return st;
+}
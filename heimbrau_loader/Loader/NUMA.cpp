@@ -0,0 +1,376 @@
+#include "NUMA.hpp"
+#include "heimbrau_loader\LoaderIO\lio.hpp"
+
+#include "common/acpi.hpp"
+#include "common/sort.hpp"
+
+numa::topology NUMA::s_Topology;
+
+namespace
+{
+	// MMK : ACPI tables are read in place, through mb2_entry's identity map, so physical addresses work as pointers
+	// as long as the table is inside it. Anything past it would fault (there is no IDT yet), so it is skipped.
+	bool identityMapped (u64 address, u64 size)
+	{
+		return address < multiboot2::sc_IdentityMapSize && size <= multiboot2::sc_IdentityMapSize - address;
+	}
+
+	// The table at address, or nullptr if its header or body is outside the identity map.
+	const acpi::sdt_header * mapTable (u64 address)
+	{
+		if (!address || !identityMapped(address, sizeof(acpi::sdt_header)))
+			return nullptr;
+		const acpi::sdt_header *table = (const acpi::sdt_header *)address;
+		return identityMapped(address, table->m_Length) ? table : nullptr;
+	}
+
+	const acpi::rsdp * scanRSDP (u64 start, u64 size)
+	{
+		// The RSDP is always on a 16-byte boundary.
+		for (u64 address = start; address + sizeof(acpi::rsdp) <= start + size; address += 16)
+		{
+			const acpi::rsdp *rsdp = (const acpi::rsdp *)address;
+			if (!acpi::signatureIs(rsdp->m_Signature, "RSD PTR ", 8))
+				continue;
+			if (acpi::checksum(rsdp, 20) != 0)
+				continue;
+			if (rsdp->m_Revision >= 2 && acpi::checksum(rsdp, rsdp->m_Length) != 0)
+				continue;
+			return rsdp;
+		}
+		return nullptr;
+	}
+
+	// The RSDP is in the first KiB of the Extended BIOS Data Area, or in the BIOS area between 0xE0000 and 0xFFFFF.
+	const acpi::rsdp * findRSDP ()
+	{
+		const u64 ebda = u64(*(const volatile u16 *)0x40E) << 4;
+		if (ebda != 0)
+		{
+			const acpi::rsdp *rsdp = scanRSDP(ebda, 1024);
+			if (rsdp)
+				return rsdp;
+		}
+		return scanRSDP(0xE0000, 0x20000);
+	}
+
+	// Finds a table by signature through the XSDT, or the RSDT on ACPI 1.0 firmware.
+	const acpi::sdt_header * findTable (const acpi::rsdp *rsdp, const char *signature)
+	{
+		const bool extended = rsdp->m_Revision >= 2 && rsdp->m_XSDTAddress != 0;
+		const u64 rootAddress = extended ? rsdp->m_XSDTAddress : u64(rsdp->m_RSDTAddress);
+		const acpi::sdt_header *root = mapTable(rootAddress);
+		if (!root)
+		{
+			lio::printf("ACPI: %s at 0x%016LX is outside the identity map, ignoring it\n", extended ? "XSDT" : "RSDT", rootAddress);
+			return nullptr;
+		}
+
+		if (acpi::checksum(root, root->m_Length) != 0)
+			return nullptr;
+
+		const u32 pointerSize = extended ? 8 : 4;
+		const u8 *pointers = (const u8 *)(root + 1);
+		const u32 count = (root->m_Length - sizeof(acpi::sdt_header)) / pointerSize;
+
+		for (u32 i = 0; i < count; ++i)
+		{
+			const u64 address = extended ? *(const u64 *)(pointers + i * 8) : u64(*(const u32 *)(pointers + i * 4));
+			const acpi::sdt_header *table = mapTable(address);
+			if (!table)
+			{
+				if (address)
+					lio::printf("ACPI: a table at 0x%016LX is outside the identity map, skipping it\n", address);
+				continue;
+			}
+			if (!acpi::signatureIs(table->m_Signature, signature, 4))
+				continue;
+			if (acpi::checksum(table, table->m_Length) != 0)
+			{
+				lio::printf("ACPI: %.4s at 0x%016LX has a bad checksum, ignoring it\n", signature, address);
+				continue;
+			}
+			return table;
+		}
+		return nullptr;
+	}
+
+	// Dense node index for a proximity domain, adding it if it is new. sc_NoNode if there are too many.
+	u32 nodeFor (numa::topology &t, u32 domain)
+	{
+		for (u32 i = 0; i < t.m_NodeCount; ++i)
+		{
+			if (t.m_Domains[i] == domain)
+				return i;
+		}
+		if (t.m_NodeCount == numa::sc_MaxNodes)
+			return numa::sc_NoNode;
+
+		t.m_Domains[t.m_NodeCount] = domain;
+		return t.m_NodeCount++;
+	}
+
+	void addCPU (numa::topology &t, u32 apicID, u32 domain)
+	{
+		const u32 node = nodeFor(t, domain);
+		if (node == numa::sc_NoNode || t.m_CPUCount == numa::sc_MaxCPUs)
+			return;
+
+		t.m_CPUs[t.m_CPUCount].m_APICID = apicID;
+		t.m_CPUs[t.m_CPUCount].m_Node = node;
+		++t.m_CPUCount;
+	}
+
+	void addRange (numa::topology &t, u64 start, u64 length, u32 domain)
+	{
+		const u32 node = nodeFor(t, domain);
+		if (node == numa::sc_NoNode || length == 0)
+			return;
+		if (t.m_RangeCount == numa::sc_MaxRanges)
+		{
+			lio::printf("SRAT has more than %u memory ranges, ignoring the rest\n", numa::sc_MaxRanges);
+			return;
+		}
+
+		t.m_Ranges[t.m_RangeCount].m_Start = start;
+		t.m_Ranges[t.m_RangeCount].m_End = start + length;
+		t.m_Ranges[t.m_RangeCount].m_Node = node;
+		++t.m_RangeCount;
+	}
+
+	void parseSRAT (numa::topology &t, const acpi::srat *srat)
+	{
+		const u8 *p = (const u8 *)(srat + 1);
+		const u8 *end = (const u8 *)srat + srat->m_Header.m_Length;
+
+		while (p + sizeof(acpi::srat_entry) <= end)
+		{
+			const acpi::srat_entry *entry = (const acpi::srat_entry *)p;
+			if (entry->m_Length < sizeof(acpi::srat_entry) || p + entry->m_Length > end)
+				break;
+
+			switch (entry->m_Type)
+			{
+			case acpi::e_SRATLocalAPIC:
+				{
+					const acpi::srat_local_apic &e = *(const acpi::srat_local_apic *)entry;
+					if (e.m_Flags & acpi::e_SRATEnabled)
+						addCPU(t, e.m_APICID, e.getDomain());
+				}
+				break;
+			case acpi::e_SRATx2APIC:
+				{
+					const acpi::srat_x2apic &e = *(const acpi::srat_x2apic *)entry;
+					if (e.m_Flags & acpi::e_SRATEnabled)
+						addCPU(t, e.m_x2APICID, e.m_Domain);
+				}
+				break;
+			case acpi::e_SRATMemory:
+				{
+					// Hot-pluggable ranges are listed whether or not anything is plugged in. The memory map decides
+					// what is actually there, so they are harmless.
+					const acpi::srat_memory &e = *(const acpi::srat_memory *)entry;
+					if (e.m_Flags & acpi::e_SRATEnabled)
+						addRange(t, e.m_BaseAddress, e.m_Length, e.m_Domain);
+				}
+				break;
+			default:
+				break;
+			}
+
+			p += entry->m_Length;
+		}
+
+		sort::heapSort(t.m_Ranges, t.m_RangeCount, [] (const numa::range &a, const numa::range &b) { return a.m_Start < b.m_Start; });
+
+		// Merge neighbours on the same node, so lookups have less to search.
+		u32 count = 0;
+		for (u32 i = 0; i < t.m_RangeCount; ++i)
+		{
+			if (count && t.m_Ranges[count - 1].m_Node == t.m_Ranges[i].m_Node && t.m_Ranges[count - 1].m_End == t.m_Ranges[i].m_Start)
+				t.m_Ranges[count - 1].m_End = t.m_Ranges[i].m_End;
+			else
+				t.m_Ranges[count++] = t.m_Ranges[i];
+		}
+		t.m_RangeCount = count;
+	}
+
+	void buildDistances (numa::topology &t, const acpi::slit *slit)
+	{
+		for (u32 from = 0; from < t.m_NodeCount; ++from)
+		{
+			for (u32 to = 0; to < t.m_NodeCount; ++to)
+			{
+				const u32 a = t.m_Domains[from];
+				const u32 b = t.m_Domains[to];
+				if (slit && a < slit->m_Localities && b < slit->m_Localities)
+					t.m_Distance[from][to] = slit->getDistance(a, b);
+				else
+					t.m_Distance[from][to] = (from == to) ? acpi::sc_LocalDistance : acpi::sc_RemoteDistance;
+			}
+		}
+
+		// Fallback order: the node itself, then the rest nearest first. Insertion sort, which is stable, so ties go to
+		// the lower node.
+		for (u32 from = 0; from < t.m_NodeCount; ++from)
+		{
+			u32 *order = t.m_Fallback[from];
+			order[0] = from;
+			u32 count = 1;
+			for (u32 node = 0; node < t.m_NodeCount; ++node)
+			{
+				if (node == from)
+					continue;
+
+				u32 j = count++;
+				for (; j > 1 && t.m_Distance[from][node] < t.m_Distance[from][order[j - 1]]; --j)
+					order[j] = order[j - 1];
+				order[j] = node;
+			}
+		}
+	}
+
+	// Node for [start, end): the one owning start, and where that stops being true.
+	u32 pieceAt (const numa::topology &t, u64 start, u64 end, u64 &pieceEnd)
+	{
+		pieceEnd = end;
+		for (u32 i = 0; i < t.m_RangeCount; ++i)
+		{
+			const numa::range &r = t.m_Ranges[i];
+			if (start < r.m_Start)
+			{
+				// In a hole before this range. Holes belong to node 0.
+				if (r.m_Start < pieceEnd)
+					pieceEnd = r.m_Start;
+				return 0;
+			}
+			if (start < r.m_End)
+			{
+				if (r.m_End < pieceEnd)
+					pieceEnd = r.m_End;
+				return r.m_Node;
+			}
+		}
+		return 0;
+	}
+
+	// Writes the node-split pieces of entry to output, or just counts them if output is nullptr.
+	u32 split (const numa::topology &t, const SimpleMemoryEntry &entry, SimpleMemoryEntry *output)
+	{
+		const u64 end = entry.offset + entry.extent;
+		u64 start = entry.offset;
+		u32 count = 0;
+
+		// Only usable memory is split. Nobody allocates from the rest, so its node is informational.
+		if (entry.type != MemoryMap::e_TypeUsable)
+		{
+			u64 ignored;
+			if (output)
+			{
+				output[0] = entry;
+				output[0].node = pieceAt(t, start, end, ignored);
+			}
+			return 1;
+		}
+
+		while (start < end)
+		{
+			u64 pieceEnd;
+			const u32 node = pieceAt(t, start, end, pieceEnd);
+			if (output)
+			{
+				output[count].offset = start;
+				output[count].extent = pieceEnd - start;
+				output[count].type = entry.type;
+				output[count].node = node;
+			}
+			++count;
+			start = pieceEnd;
+		}
+		return count;
+	}
+}
+
+bool NUMA::Init ()
+{
+	numa::topology &t = s_Topology;
+	native::mem::fillBytes(&t, 0, sizeof(numa::topology));
+
+	const acpi::rsdp *rsdp = findRSDP();
+	const acpi::srat *srat = rsdp ? (const acpi::srat *)findTable(rsdp, "SRAT") : nullptr;
+
+	if (srat)
+	{
+		parseSRAT(t, srat);
+	}
+
+	if (t.m_NodeCount == 0)
+	{
+		// No NUMA information. Everything is on node 0.
+		t.m_NodeCount = 1;
+		t.m_RangeCount = 0;
+		t.m_CPUCount = 0;
+	}
+
+	buildDistances(t, rsdp ? (const acpi::slit *)findTable(rsdp, "SLIT") : nullptr);
+
+	if (!rsdp)
+		lio::printf("ACPI: no RSDP found, assuming a single node\n");
+	else if (!srat)
+		lio::printf("ACPI: no SRAT, assuming a single node\n");
+
+	return srat != nullptr;
+}
+
+void NUMA::Tag (SimpleMemoryEntry *_mmap, u32 &entries, u32 capacity)
+{
+	numa::topology &t = s_Topology;
+
+	u32 total = 0;
+	for (u32 i = 0; i < entries; ++i)
+		total += split(t, _mmap[i], nullptr);
+
+	if (total > capacity)
+	{
+		// Tagging by start address would put the tail of a straddling entry on the wrong node, and frees are routed
+		// by address. Give up on NUMA instead, which is always correct.
+		lio::printf("NUMA: splitting the memory map needs %u entries, only have %u. Falling back to a single node\n", total, capacity);
+		t.m_NodeCount = 1;
+		t.m_RangeCount = 0;
+		t.m_CPUCount = 0;
+		buildDistances(t, nullptr);
+		for (u32 i = 0; i < entries; ++i)
+			_mmap[i].node = 0;
+		return;
+	}
+
+	// Fill from the back, so nothing is overwritten before it is read.
+	u32 write = total;
+	for (u32 i = entries; i-- > 0;)
+	{
+		const SimpleMemoryEntry entry = _mmap[i];
+		write -= split(t, entry, nullptr);
+		split(t, entry, _mmap + write);
+	}
+
+	entries = total;
+}
+
+void NUMA::Print ()
+{
+	const numa::topology &t = s_Topology;
+
+	lio::printf("NUMA: %u node(s), %u range(s), %u CPU(s)\n", t.m_NodeCount, t.m_RangeCount, t.m_CPUCount);
+	for (u32 i = 0; i < t.m_RangeCount; ++i)
+	{
+		const numa::range &r = t.m_Ranges[i];
+		lio::printf("\tNode %u: 0x%016LX - 0x%016LX\n", r.m_Node, r.m_Start, r.m_End);
+	}
+	for (u32 from = 0; from < t.m_NodeCount; ++from)
+	{
+		lio::printf("\tNode %u (domain %u) distances:", from, t.m_Domains[from]);
+		for (u32 to = 0; to < t.m_NodeCount; ++to)
+			lio::printf(" %3u", u32(t.m_Distance[from][to]));
+		lio::printf("\n");
+	}
+}
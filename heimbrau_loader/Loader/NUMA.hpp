@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "common/numa.hpp"
+
+#include "MemoryMap.hpp"
+
+namespace NUMA
+{
+	// Topology from the ACPI SRAT/SLIT. Always valid after Init: a single node if there is no SRAT.
+	// This is what gets handed to the kernel.
+	extern numa::topology s_Topology;
+
+	// Finds the ACPI tables and builds s_Topology from them.
+	// Returns false (and leaves a single node topology) if there is no RSDP or no SRAT.
+	extern bool Init ();
+
+	// Splits the usable entries of a cleaned up memory map at node boundaries and sets every entry's node.
+	// Entries are rewritten in place. capacity is the size of the _mmap buffer; if the split entries would not fit,
+	// s_Topology is collapsed to a single node and everything is tagged node 0.
+	extern void Tag (SimpleMemoryEntry *_mmap, u32 &entries, u32 capacity);
+
+	// Prints nodes, memory ranges and the distance matrix.
+	extern void Print ();
+}
@@ -0,0 +1,214 @@
+#include "PhysicalMemory.hpp"
+#include "heimbrau_loader\LoaderIO\lio.hpp"
+#include "heimbrau_kernel\Paging\Paging.hpp"
+
+frame_bitmap PhysicalMemory::s_Frames;
+buddy_allocator PhysicalMemory::s_Buddies[numa::sc_MaxNodes];
+node_allocator PhysicalMemory::s_Nodes;
+frame_cache PhysicalMemory::s_FrameCache;
+u64 PhysicalMemory::s_IdentityLimit = multiboot2::sc_IdentityMapSize;
+
+namespace
+{
+	// Tables for the identity map above what mb2_entry mapped. They are zeroed before they are mapped, so they must come
+	// from below it; the bitmap hands out the lowest frame first, so they only miss when that memory is all gone.
+	u64 identityTable ()
+	{
+		const u64 phys = PhysicalMemory::s_Frames.alloc();
+		if (phys == frame_bitmap::sc_NoFrame)
+			return Paging::sc_NoTable;
+		if (phys >= multiboot2::sc_IdentityMapSize)
+		{
+			PhysicalMemory::s_Frames.free(phys);
+			return Paging::sc_NoTable;
+		}
+		return phys;
+	}
+
+	// Heap slabs and large blocks, from the allocating CPU's node first.
+	u64 heapSource (u32 cpu, u32 order)
+	{
+		const u64 phys = PhysicalMemory::s_FrameCache.allocBlock(cpu, order);
+		return phys != frame_cache::sc_NoFrame ? phys : object_cache::sc_NoSlab;
+	}
+
+	void heapSink (u64 phys, u32 order)
+	{
+		PhysicalMemory::s_FrameCache.freeBlock(phys, order);
+	}
+}
+
+bool PhysicalMemory::Init (const SimpleMemoryEntry *_mmap, u32 entries, u64 reserveBelow)
+{
+	reserveBelow = (reserveBelow + frame_bitmap::sc_FrameSize - 1) & ~(frame_bitmap::sc_FrameSize - 1);
+
+	// Only frames below the end of the last usable range are ever tracked.
+	const u64 limit = MemoryMap::Summarize(_mmap, entries).m_HighestUsableAddress & ~(frame_bitmap::sc_FrameSize - 1);
+
+	const u64 storageSize = frame_bitmap::storageSize(limit);
+
+	// First fit for the bitmap itself.
+	u64 storage = 0;
+	for (u32 i = 0; i < entries && storage == 0; ++i)
+	{
+		const SimpleMemoryEntry &entry = _mmap[i];
+		if (entry.type != MemoryMap::e_TypeUsable)
+			continue;
+
+		// It is written before the identity map is extended over it.
+		u64 start = (entry.offset + frame_bitmap::sc_FrameSize - 1) & ~(frame_bitmap::sc_FrameSize - 1);
+		if (start < reserveBelow)
+			start = reserveBelow;
+		if (start + storageSize <= entry.offset + entry.extent && start + storageSize <= multiboot2::sc_IdentityMapSize)
+			storage = start;
+	}
+
+	if (storage == 0)
+	{
+		lio::printf("No room for the frame bitmap (%Lu bytes)\n", storageSize);
+		return false;
+	}
+
+	s_Frames.init((void *)storage, limit);
+
+	for (u32 i = 0; i < entries; ++i)
+	{
+		const SimpleMemoryEntry &entry = _mmap[i];
+		if (entry.type == MemoryMap::e_TypeUsable)
+			s_Frames.release(entry.offset, entry.extent);
+	}
+
+	s_Frames.reserve(0, reserveBelow);
+	s_Frames.reserve(storage, storageSize);
+
+	lio::printf("Frame Bitmap: 0x%016LX | %Lu bytes\n", storage, storageSize);
+	lio::printf("Free Frames: %Lu / %Lu (%Lu KiB)\n",
+		s_Frames.freeFrames(), s_Frames.totalFrames(), (s_Frames.freeFrames() * frame_bitmap::sc_FrameSize) / 1024);
+
+	// Everything allocated from here on (buddy state, tables, heap slabs, the kernel image) is touched through its
+	// physical address, and may be anywhere below limit. Map the rest of it the way mb2_entry mapped the start.
+	if (limit > s_IdentityLimit)
+	{
+		const u64 root = native::readCR(3) & Paging::sc_AddressMask;
+		Paging::map_stats stats;
+		native::mem::fillBytes(&stats, 0, sizeof(Paging::map_stats));
+
+		if (!Paging::mapRange(root, s_IdentityLimit, s_IdentityLimit, limit - s_IdentityLimit, Paging::sc_Writable,
+			Paging::largestPageSize(), identityTable, stats))
+		{
+			lio::printf("No room for the identity map up to 0x%016LX\n", limit);
+			return false;
+		}
+		s_IdentityLimit = limit;
+
+		lio::printf("Identity map: up to 0x%016LX, %Lu tables added\n", limit, stats.m_Tables);
+	}
+
+	return true;
+}
+
+bool PhysicalMemory::InitBuddy (const SimpleMemoryEntry *_mmap, u32 entries, const numa::topology &topology)
+{
+	s_Nodes.init(&topology);
+
+	for (u32 node = 0; node < topology.m_NodeCount; ++node)
+	{
+		// Each node's allocator covers the span of its usable memory. Nodes can interleave, so spans can overlap;
+		// that only costs some state for frames the allocator never sees.
+		u64 base = ~0ULL;
+		u64 limit = 0;
+		for (u32 i = 0; i < entries; ++i)
+		{
+			const SimpleMemoryEntry &entry = _mmap[i];
+			if (entry.type != MemoryMap::e_TypeUsable || entry.node != node)
+				continue;
+			if (entry.offset < base)
+				base = entry.offset;
+			if (entry.offset + entry.extent > limit)
+				limit = entry.offset + entry.extent;
+		}
+		if (limit == 0)
+			continue;
+
+		const u64 storageSize = buddy_allocator::storageSize(base, limit);
+		const u64 storage = s_Frames.allocRun((storageSize + frame_bitmap::sc_FrameSize - 1) >> frame_bitmap::sc_FrameShift);
+		if (storage == frame_bitmap::sc_NoFrame)
+		{
+			lio::printf("No room for the node %u buddy allocator (%Lu bytes)\n", node, storageSize);
+			return false;
+		}
+
+		s_Buddies[node].init((void *)storage, base, limit);
+		s_Nodes.addNode(node, &s_Buddies[node]);
+
+		lio::printf("Node %u Buddy Allocator: 0x%016LX | %Lu bytes, covering 0x%016LX - 0x%016LX\n", node, storage, storageSize, base, limit);
+	}
+
+	// Move every free run across to the node owning it, and mark it used in the bitmap so the two never hand out the
+	// same frame. The tagged map is already split at node boundaries.
+	for (u32 i = 0; i < entries; ++i)
+	{
+		const SimpleMemoryEntry &entry = _mmap[i];
+		if (entry.type != MemoryMap::e_TypeUsable)
+			continue;
+
+		const u64 end = entry.offset + entry.extent;
+		u64 phys = entry.offset;
+		u64 size = 0;
+		while (s_Frames.findFreeRange(phys, phys, size) && phys < end)
+		{
+			if (phys + size > end)
+				size = (end - phys) & ~(frame_bitmap::sc_FrameSize - 1);
+			if (size == 0)
+				break;
+
+			s_Buddies[entry.node].release(phys, size);
+			s_Frames.reserve(phys, size);
+			phys += size;
+		}
+	}
+
+	s_FrameCache.init(&s_Nodes);
+	s_FrameCache.setNode(native::cpu::index(), numa::nodeOfAPIC(topology, native::cpu::get().m_APICID));
+
+	Heap::init(heapSource, heapSink);
+
+	PrintBuddy();
+	lio::printf("Heap: %u classes up to %Lu bytes in %Lu KiB slabs, larger sizes in buddy blocks\n",
+		Heap::sc_Classes, Heap::sc_MaxSmall, object_cache::sc_SlabSize / 1024);
+
+	return true;
+}
+
+void PhysicalMemory::PrintBuddy ()
+{
+	for (u32 node = 0; node < s_Nodes.getNodeCount(); ++node)
+	{
+		const buddy_allocator *buddy = s_Nodes.getBuddy(node);
+		const node_allocator::stats &ns = s_Nodes.getStats(node);
+		if (!buddy)
+		{
+			lio::printf("Node %u: no memory, Local/Remote/Failures: %Lu / %Lu / %Lu\n", node, ns.m_Local, ns.m_Remote, ns.m_Failures);
+			continue;
+		}
+
+		const buddy_allocator::stats &st = buddy->getStats();
+
+		lio::printf("Node %u Buddy Free Frames: %Lu / %Lu (%Lu KiB)\n",
+			node, st.m_FreeFrames, st.m_TotalFrames, (st.m_FreeFrames * buddy_allocator::sc_FrameSize) / 1024);
+		for (u32 order = 0; order < buddy_allocator::sc_Orders; ++order)
+		{
+			if (st.m_FreeBlocks[order] == 0)
+				continue;
+			lio::printf("\tOrder %2u (%8Lu KiB): %8Lu free, fragmentation %4u/1000\n",
+				order, (buddy_allocator::sc_FrameSize << order) / 1024, st.m_FreeBlocks[order], buddy->fragmentation(order));
+		}
+		lio::printf("\tAllocs/Frees/Failures: %Lu / %Lu / %Lu, Splits/Merges: %Lu / %Lu\n",
+			st.m_Allocs, st.m_Frees, st.m_Failures, st.m_Splits, st.m_Merges);
+		lio::printf("\tLocal/Remote/Failures: %Lu / %Lu / %Lu\n", ns.m_Local, ns.m_Remote, ns.m_Failures);
+	}
+
+	const frame_cache::stats totals = s_FrameCache.getTotals();
+	lio::printf("Frame Cache Hits/Misses/Refills/Drains: %Lu / %Lu / %Lu / %Lu, %Lu frames cached\n",
+		totals.m_Hits, totals.m_Misses, totals.m_Refills, totals.m_Drains, s_FrameCache.cachedFrames());
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.hpp"
+
+#include "MemoryMap.hpp"
+#include "heimbrau_kernel\Memory\FrameBitmap.hpp"
+#include "heimbrau_kernel\Memory\BuddyAllocator.hpp"
+#include "heimbrau_kernel\Memory\NodeAllocator.hpp"
+#include "heimbrau_kernel\Memory\FrameCache.hpp"
+#include "heimbrau_kernel\Memory\Heap.hpp"
+
+namespace PhysicalMemory
+{
+	// Every usable frame in the system. Valid once Init has returned true.
+	extern frame_bitmap s_Frames;
+
+	// Physical memory below this is identity mapped, and can be used through its address: what mb2_entry mapped until
+	// Init extends it.
+	extern u64 s_IdentityLimit;
+
+	// Builds s_Frames from a cleaned up memory map. Frames below reserveBelow (the loader image) are never handed out.
+	// The bitmap itself is carved out of the first usable range above reserveBelow, and below s_IdentityLimit, that can
+	// hold it. Then extends the identity map up to the end of the last usable range, so every frame s_Frames or the
+	// allocators built from it hand out can be touched.
+	// Returns false if there is nowhere to put the bitmap, or no frames for the identity map's tables.
+	extern bool Init (const SimpleMemoryEntry *_mmap, u32 entries, u64 reserveBelow);
+
+	// Naturally aligned power-of-two runs, one allocator per NUMA node, each covering the span of its node's usable
+	// memory. Valid once InitBuddy has returned true; only use them through s_Nodes.
+	extern buddy_allocator s_Buddies[numa::sc_MaxNodes];
+
+	// Node aware front end over s_Buddies, with a lock per node. Set up by InitBuddy.
+	extern node_allocator s_Nodes;
+
+	// Hands every frame still free in s_Frames over to the buddy allocator of the node owning it. The buddy
+	// allocators' own state is allocated from s_Frames first. After this s_Frames has nothing left to give; allocate
+	// from s_Nodes or s_FrameCache instead, or from kmalloc, whose slabs come from s_FrameCache too.
+	// _mmap must have been tagged with NUMA::Tag for the same topology.
+	// Returns false if there was no room for the buddy allocators' state.
+	extern bool InitBuddy (const SimpleMemoryEntry *_mmap, u32 entries, const numa::topology &topology);
+
+	// Per-CPU frame magazines in front of s_Nodes. Set up by InitBuddy, with the boot CPU refilling from its own node.
+	extern frame_cache s_FrameCache;
+
+	// Single frames for the current CPU.
+	inline u64 AllocFrame () { return s_FrameCache.alloc(native::cpu::index()); }
+	inline void FreeFrame (u64 phys) { s_FrameCache.free(native::cpu::index(), phys); }
+
+	// Prints the free block counts and fragmentation of each node's buddy allocator, and the s_Nodes and
+	// s_FrameCache counters.
+	extern void PrintBuddy ();
+}
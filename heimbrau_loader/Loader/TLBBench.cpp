@@ -0,0 +1,149 @@
+#include "TLBBench.hpp"
+#include "PhysicalMemory.hpp"
+
+#include "heimbrau_kernel\Paging\Paging.hpp"
+#include "../LoaderIO/lio.hpp"
+
+namespace
+{
+	// 64 MiB: 16384 4 KiB pages, far more than any L2 TLB holds, and 32 2 MiB pages, which fit in the L1 TLB.
+	static const u32 sc_BufferOrder = 14;
+	static const u64 sc_BufferSize = buddy_allocator::sc_FrameSize << sc_BufferOrder;
+	static const u64 sc_Pages = sc_BufferSize / Paging::e_Page4K;
+	static const u32 sc_Passes = 8;
+
+	// Each window gets a top level slot of its own, so none of them reaches into tables shared with the loader's
+	// address space. Slot 0 stays the loader's identity map.
+	inline u64 window (u32 slot) { return u64(slot) << Paging::rootShift(); }
+
+	// Tables for all three windows: 32 PTs, the PDs, PDPTs (and PML4s) above them, and the top level table.
+	static const u32 sc_MaxTables = 64;
+	u64 s_Tables[sc_MaxTables];
+	u32 s_TableCount = 0;
+
+	volatile u64 s_Sink = 0;
+
+	u64 allocTable ()
+	{
+		if (s_TableCount == sc_MaxTables)
+			return Paging::sc_NoTable;
+
+		const u64 frame = PhysicalMemory::AllocFrame();
+		if (frame != Paging::sc_NoTable)
+			s_Tables[s_TableCount++] = frame;
+		return frame;
+	}
+
+	// Full period LCG over the page numbers (multiplier 1 mod 4, odd increment), so the chase visits every page
+	// once per pass in an order the prefetchers can't follow.
+	inline u64 nextPage (u64 page)
+	{
+		return (page * 6364136223846793005ULL + 1442695040888963407ULL) & (sc_Pages - 1);
+	}
+
+	// A different cache line in each page, so the chase doesn't also hammer a single cache set.
+	inline u64 offsetOf (u64 page)
+	{
+		return page * Paging::e_Page4K + ((page & 63) << 6);
+	}
+
+	u64 chase (u64 base, u64 steps)
+	{
+		u64 offset = 0;
+		for (u64 i = 0; i < steps; ++i)
+			offset = *(volatile const u64 *)(base + offset);
+		return offset;
+	}
+
+	// Cycles per step, in tenths.
+	u64 measure (u64 base)
+	{
+		s_Sink += chase(base, sc_Pages);
+
+		const u64 steps = sc_Pages * sc_Passes;
+		const u64 start = native::tsc::start();
+		s_Sink += chase(base, steps);
+		const u64 cycles = native::tsc::stop() - start;
+
+		return (cycles * 10) / steps;
+	}
+
+	void printRow (const char *name, u64 tenths, u64 baseline)
+	{
+		lio::printf("\t%s pages: %5Lu.%Lu cycles/access", name, tenths / 10, tenths % 10);
+		if (baseline && tenths)
+			lio::printf(", %Lu.%02Lux faster than 4 KiB", baseline / tenths, ((baseline % tenths) * 100) / tenths);
+		lio::printf("\n");
+	}
+}
+
+void TLBBench::Run ()
+{
+	const u32 cpu = native::cpu::index();
+	const u64 buffer = PhysicalMemory::s_FrameCache.allocBlock(cpu, sc_BufferOrder);
+	if (buffer == frame_cache::sc_NoFrame)
+	{
+		lio::printf("TLB bench: no %Lu MiB run to test with\n", sc_BufferSize >> 20);
+		return;
+	}
+
+	Paging::map_stats stats;
+	native::mem::fillBytes(&stats, 0, sizeof(Paging::map_stats));
+	s_TableCount = 0;
+
+	const bool huge = Paging::largestPageSize() == Paging::e_Page1G;
+	const u64 hugeBase = buffer & ~u64(Paging::e_Page1G - 1);
+
+	const u64 window4K = window(1);
+	const u64 window2M = window(2);
+	const u64 window1G = window(3);
+
+	const u64 pml4 = Paging::createTable(allocTable, stats);
+	bool mapped = pml4 != Paging::sc_NoTable;
+	if (mapped)
+	{
+		const u64 current = native::readCR(3) & ~0xFFFULL;
+		((u64 *)pml4)[0] = ((const u64 *)current)[0];
+
+		mapped = Paging::mapRange(pml4, window4K, buffer, sc_BufferSize, Paging::sc_Writable, Paging::e_Page4K, allocTable, stats) &&
+			Paging::mapRange(pml4, window2M, buffer, sc_BufferSize, Paging::sc_Writable, Paging::e_Page2M, allocTable, stats) &&
+			(!huge || Paging::mapRange(pml4, window1G, hugeBase, Paging::e_Page1G, Paging::sc_Writable, Paging::e_Page1G, allocTable, stats));
+	}
+
+	if (mapped)
+	{
+		const u64 previous = native::readCR(3);
+		native::writeCR(3, pml4);
+
+		// Same physical memory behind every window, so the chain only needs writing once.
+		u64 page = 0;
+		for (u64 i = 0; i < sc_Pages; ++i)
+		{
+			const u64 next = nextPage(page);
+			*(u64 *)(window2M + offsetOf(page)) = offsetOf(next);
+			page = next;
+		}
+
+		const u64 tenths4K = measure(window4K);
+		const u64 tenths2M = measure(window2M);
+		const u64 tenths1G = huge ? measure(window1G + (buffer - hugeBase)) : 0;
+
+		native::writeCR(3, previous);
+
+		lio::printf("TLB bench: %Lu MiB at 0x%016LX, %Lu pages x %u passes\n", sc_BufferSize >> 20, buffer, sc_Pages, sc_Passes);
+		printRow("4 KiB", tenths4K, 0);
+		printRow("2 MiB", tenths2M, tenths4K);
+		if (huge)
+			printRow("1 GiB", tenths1G, tenths4K);
+		else
+			lio::printf("\t1 GiB pages: not supported\n");
+	}
+	else
+	{
+		lio::printf("TLB bench: could not map the test windows\n");
+	}
+
+	for (u32 i = 0; i < s_TableCount; ++i)
+		PhysicalMemory::FreeFrame(s_Tables[i]);
+	PhysicalMemory::s_FrameCache.freeBlock(buffer, sc_BufferOrder);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "common.hpp"
+
+// TLB miss benchmark, run in the loader so it measures real (or virtualized) page walks.
+// Enabled with "tlbbench" on the kernel command line, for example:
+//	qemu-system-x86_64 -enable-kvm -cpu host -m 2G -kernel heimbrau_loader.bin -append tlbbench
+// Without KVM the numbers are QEMU's software TLB, which still shows the difference but not its real size.
+// -cpu host (or +pdpe1gb) is needed for the 1 GiB row.
+
+namespace TLBBench
+{
+	// Maps one physically contiguous buffer three times, with 4 KiB, 2 MiB and 1 GiB pages, and times a random
+	// page-to-page pointer chase through each mapping. Touches one cache line per page, so nearly every step is a
+	// TLB miss with 4 KiB pages and nearly none are with large ones.
+	// Needs PhysicalMemory::InitBuddy to have run. Everything it allocates is given back.
+	extern void Run ();
+}
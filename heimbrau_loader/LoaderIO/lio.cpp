@@ -1,7 +1,10 @@
 #include "lio.hpp"
 
 _align(16) lio::character * const lio::s_VideoOut = (lio::character *)0xb8000;
-_align(16) lio::character * const lio::s_VideoBackbuffer = lio::s_VideoOut + (80 * 25);
+// The back buffer is read as well as written (scrolling), so it lives in RAM rather than in video memory, where
+// reads are uncached.
+static _align(16) lio::character s_Backbuffer[80 * 25];
+_align(16) lio::character * const lio::s_VideoBackbuffer = s_Backbuffer;
 
 u32 lio::_WriteHandler::s_Count = 0;
 u32 lio::_WriteHandler::s_DirtyLines = 0;
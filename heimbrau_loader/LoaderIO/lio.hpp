@@ -161,6 +161,8 @@ namespace lio
 				sizeI = 0;
 			}
 		}
+		// Video memory is mapped write-combining once the loader has remapped it; push out what is still buffered.
+		_mm_sfence();
 	}
 
 	static void _ShiftUp ()
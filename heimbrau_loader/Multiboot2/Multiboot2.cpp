@@ -10,10 +10,12 @@ extern "C"
 {
 	void mb2_entry ();
 
+	// Only used if mb2_entry turns on 5-level paging, with the PML4 below as its first entry.
+	_align(0x1000) u64 PML5[512];
 	_align(0x1000) u64 PML4[512];
 	_align(0x1000) u64 PDPT[512];
-	_align(0x1000) u64 PD[512];
-	_align(0x1000) u64 PT[512];
+	// Early identity map built by mb2_entry: the first sc_IdentityMapSize bytes, in 2 MiB pages. One PD per GiB.
+	_align(0x1000) u64 PD[512 * (sc_IdentityMapSize >> 30)];
 }
 
 static const u32 mb2_flags = u32(e_ModuleAlign) | u32(e_MemInfo) | u32(e_ValidOffsets)/* | u64(e_MMapInfo)*/;
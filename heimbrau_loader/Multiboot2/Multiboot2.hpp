@@ -74,5 +74,17 @@ namespace multiboot2
 		e_ValidOffsets	=	(1 << 16),
 	};
 
+	// info::m_Flags
+	enum
+	{
+		e_InfoMemory	=	(1 << 0),
+		e_InfoCmdLine	=	(1 << 2),
+		e_InfoMMap		=	(1 << 6),
+	};
+
 	static const u32 s_GrubHeader = 0x1BADB002U;
+
+	// Physical memory mb2_entry identity maps, from 0. The loader can only read memory below this through a pointer
+	// until it builds its own tables. Must match EARLY_GIB in mb2_entry.asm.
+	static const u64 sc_IdentityMapSize = 4ULL << 30;
 }
@@ -1,7 +1,7 @@
+extern PML5;
 extern PML4;
 extern PDPT;
 extern PD;
-extern PT;
 
 [BITS 32]
 
@@ -37,6 +37,7 @@ GDT64:                           ; Global Descriptor Table (64-bit).
     dq GDT64                     ; Base.
 
 STACKSIZE	equ 0x1000
+EARLY_GIB	equ 4			 ; Identity mapped at entry. Must match multiboot2::sc_IdentityMapSize
 
 mb2_entry:
 	mov esp, stack + STACKSIZE	 ; Create stack.
@@ -44,32 +45,66 @@ mb2_entry:
 	push ebx					 ; Push the second Multiboot 2 parameter onto the stack.
 
 	; set up page table
+	; The first EARLY_GIB GiB are identity mapped with 2 MiB pages: one PDPT entry per PD, 512 PDEs per PD.
+	; MMIO in that range (APIC, PCI holes, framebuffers) is made uncacheable by the firmware's MTRRs.
 	mov edi, PML4				 ; Move temporary PML4 address into EDI register.
 	mov cr3, edi				 ; Move EDI register into CR3 register
 	xor eax, eax				 ; Zero EAX register
-	mov ecx, 4096				 ; Move 0x1000 into ECX register
-	rep stosd					 ; Store EAX (0) into data pointed to by EDI (PML4) ECX (0x1000) times
-								 ; In effect, we are zeroing out the PML4 structure
-	mov edi, cr3				 ; Move EDI (PML4 address) into EDI register.
-	
-	mov DWORD [edi], PDPT + 3	 ; Push PDPT address into PML4
+	mov ecx, 1024				 ; 1024 dwords, one table
+	rep stosd					 ; Zero the PML4. The boot loader does not have to clear .bss for us.
+	mov edi, PDPT
+	mov ecx, 1024
+	rep stosd					 ; Zero the PDPT. Every PD entry is written below, so the PDs are not cleared.
+
+	mov DWORD [PML4], PDPT + 3	 ; Push PDPT address into PML4
+
 	mov edi, PDPT
-	mov DWORD [edi], PD + 3		 ; Push PD address into PDPT
+	mov eax, PD + 3				 ; First PD, present and r/w
+	mov ecx, EARLY_GIB
+.SetPDPTE:
+	mov DWORD [edi], eax		 ; One PDPT entry per GiB, pointing at consecutive PDs
+	add eax, 0x1000
+	add edi, 8
+	dec ecx
+	jnz .SetPDPTE
+
 	mov edi, PD
-	mov DWORD [edi], PT + 3		 ; Push PT address into PD
-	mov edi, PT
-	
-	mov ebx, 0x00000003			 ; Set the first two bits of each page
-	mov ecx, 512				 ; We need to update 512 pages (one page table)
-	
-.SetEntry:
-	mov DWORD [edi], ebx		 ; Loop through the page table and update each page to be set to present and r/w (bits 0 and 1)
-	add ebx, 0x1000
+	mov eax, 0x00000083			 ; Present, r/w and PS (bit 7): a 2 MiB page at physical 0
+	mov ecx, 512 * EARLY_GIB
+.SetPDE:
+	mov DWORD [edi], eax		 ; Low dword: address and flags
+	mov DWORD [edi + 4], 0		 ; High dword: everything is below 4 GiB
+	add eax, 0x200000
 	add edi, 8
-	loop .SetEntry
-	
-	mov eax, cr4				 ; Set the 6th bit of CR4 (PAE Extensions)
-	or eax, 1 << 5
+	dec ecx
+	jnz .SetPDE
+
+	; 5-level paging if the CPU has it (CPUID.7.0:ECX bit 16). LA57 can only be set with paging off, so it is
+	; decided here for good: a PML5 whose first entry is the PML4 above goes in CR3, and CR4.LA57 is set with PAE.
+	; Paging::initLevels reads CR4 back later to learn the depth.
+	mov esi, 1 << 5				 ; CR4 bits to set: PAE. ESI, since CPUID overwrites EAX to EDX.
+	xor eax, eax
+	cpuid
+	cmp eax, 7
+	jb .SetCR4					 ; No leaf 7, no LA57
+	mov eax, 7
+	xor ecx, ecx
+	cpuid
+	test ecx, 1 << 16
+	jz .SetCR4
+
+	mov edi, PML5
+	xor eax, eax
+	mov ecx, 1024
+	rep stosd					 ; Zero the PML5
+	mov DWORD [PML5], PML4 + 3	 ; The PML4 covers the first 256 TiB
+	mov eax, PML5
+	mov cr3, eax
+	or esi, 1 << 12				 ; LA57
+
+.SetCR4:
+	mov eax, cr4				 ; Set PAE (bit 5), and LA57 (bit 12) if chosen above
+	or eax, esi
 	mov cr4, eax
 	
 	mov ecx, 0xC0000080			 ; Set 9th bit in MSR (Long Mode bit)